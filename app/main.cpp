@@ -37,6 +37,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 // Local
 #include <lib/about.h>
 #include <lib/gwenviewconfig.h>
+#include <lib/tracer.h>
 #include "mainwindow.h"
 
 #ifdef HAVE_FITS
@@ -139,10 +140,19 @@ int main(int argc, char *argv[])
                                         i18n("Start in fullscreen mode")));
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("s") << QStringLiteral("slideshow"),
                                         i18n("Start in slideshow mode")));
+    parser.addOption(QCommandLineOption(QStringLiteral("trace"),
+                                        i18n("Write a performance trace to <file>, in the Chrome trace event format"),
+                                        QStringLiteral("file")));
     parser.addPositionalArgument("url", i18n("A starting file or folders"));
     parser.process(app);
     aboutData.data()->processCommandLine(&parser);
 
+    if (parser.isSet(QStringLiteral("trace"))) {
+        Gwenview::Tracer::start(parser.value(QStringLiteral("trace")));
+    } else {
+        Gwenview::Tracer::startFromEnvironment();
+    }
+
     // startHelper must live for the whole life of the application
     StartHelper startHelper(parser.positionalArguments(),
                             parser.isSet(QStringLiteral("f"))
@@ -160,7 +170,9 @@ int main(int argc, char *argv[])
     // to be async rather than using exec().
     qApp->sendPostedEvents(0, QEvent::DeferredDelete);
 
-    return app.exec();
+    const int ret = app.exec();
+    Gwenview::Tracer::stop();
+    return ret;
 }
 
 #ifdef HAVE_FITS
@@ -33,6 +33,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <QVBoxLayout>
 #include <QMenuBar>
 #include <QUrl>
+#ifdef HAVE_QTDBUS
+#include <QDBusConnection>
+#endif
 #ifdef Q_OS_OSX
 #include <QFileOpenEvent>
 #endif
@@ -65,6 +68,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "gvcore.h"
 #include "imageopscontextmanageritem.h"
 #include "infocontextmanageritem.h"
+#include "memoryusagedialog.h"
 #ifdef KIPI_FOUND
 #include "kipiexportaction.h"
 #include "kipiinterface.h"
@@ -87,6 +91,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <lib/documentonlyproxymodel.h>
 #include <lib/gvdebug.h>
 #include <lib/gwenviewconfig.h>
+#include <lib/memoryregistry.h>
 #include <lib/mimetypeutils.h>
 #ifdef HAVE_QTDBUS
 #include <lib/mpris2/mpris2service.h>
@@ -493,6 +498,10 @@ struct MainWindow::Private
         view->addAction(KStandardAction::ConfigureToolbars, q,
                         SLOT(configureToolbars()));
 
+        action = view->addAction("show_memory_usage", q, SLOT(showMemoryUsageDialog()));
+        action->setText(i18nc("@action", "Memory Usage..."));
+        action->setToolTip(i18nc("@info:tooltip", "Show the memory used by Gwenview caches"));
+
 #ifdef KIPI_FOUND
         mKIPIExportAction = new KIPIExportAction(q);
         actionCollection->addAction("kipi_export", mKIPIExportAction);
@@ -858,6 +867,9 @@ MainWindow::MainWindow()
     d->mMpris2Service = new Mpris2Service(d->mSlideShow, d->mContextManager,
                                           d->mToggleSlideShowAction, d->mFullScreenAction,
                                           d->mGoToPreviousAction, d->mGoToNextAction, this);
+    // Lets scripts and developers follow memory usage with qdbus
+    QDBusConnection::sessionBus().registerObject(QStringLiteral("/MemoryUsage"), MemoryRegistry::instance(),
+                                                 QDBusConnection::ExportScriptableSlots | QDBusConnection::ExportScriptableSignals);
 #endif
 
 #ifdef GWENVIEW_SEMANTICINFO_BACKEND_NONE
@@ -1517,6 +1529,13 @@ void MainWindow::showConfigDialog()
     dialog->exec();
 }
 
+void MainWindow::showMemoryUsageDialog()
+{
+    MemoryUsageDialog* dialog = new MemoryUsageDialog(this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->show();
+}
+
 void MainWindow::configureShortcuts()
 {
     guiFactory()->configureShortcuts();
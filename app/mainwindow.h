@@ -118,6 +118,7 @@ private Q_SLOTS:
     void showDocumentInFullScreen(const QUrl&);
 
     void showConfigDialog();
+    void showMemoryUsageDialog();
     void loadConfig();
     void print();
 
@@ -0,0 +1,132 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "memoryusagedialog.h"
+
+// Qt
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QLabel>
+#include <QPushButton>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+// KDE
+#include <KFormat>
+#include <KLocalizedString>
+
+// Local
+#include <lib/memoryregistry.h>
+#include <lib/memoryutils.h>
+
+namespace Gwenview
+{
+
+// How often the figures are updated
+static const int REFRESH_INTERVAL = 1000;
+
+struct MemoryUsageDialogPrivate
+{
+    QTreeWidget* mTreeWidget;
+    QLabel* mSummaryLabel;
+    QTimer* mRefreshTimer;
+
+    void refresh()
+    {
+        const KFormat format;
+        const QList<MemoryRegistry::CacheUsage> usages = MemoryRegistry::instance()->cacheUsages();
+        qint64 total = 0;
+        mTreeWidget->clear();
+        for (const MemoryRegistry::CacheUsage& usage : usages) {
+            QTreeWidgetItem* item = new QTreeWidgetItem(mTreeWidget);
+            item->setText(0, usage.name);
+            item->setText(1, QString::number(usage.entries));
+            item->setText(2, format.formatByteSize(usage.bytes));
+            const qint64 lookups = usage.hits + usage.misses;
+            if (lookups > 0) {
+                item->setText(3, i18nc("@item:intable cache hit rate", "%1%", usage.hits * 100 / lookups));
+            }
+            item->setTextAlignment(1, Qt::AlignRight | Qt::AlignVCenter);
+            item->setTextAlignment(2, Qt::AlignRight | Qt::AlignVCenter);
+            item->setTextAlignment(3, Qt::AlignRight | Qt::AlignVCenter);
+            total += usage.bytes;
+        }
+        mSummaryLabel->setText(
+            i18nc("@info", "Caches: %1, free memory: %2 of %3",
+                  format.formatByteSize(total),
+                  format.formatByteSize(MemoryUtils::getFreeMemory()),
+                  format.formatByteSize(MemoryUtils::getTotalMemory())));
+    }
+};
+
+MemoryUsageDialog::MemoryUsageDialog(QWidget* parent)
+: QDialog(parent)
+, d(new MemoryUsageDialogPrivate)
+{
+    setWindowTitle(i18nc("@title:window", "Memory Usage"));
+
+    d->mTreeWidget = new QTreeWidget(this);
+    d->mTreeWidget->setRootIsDecorated(false);
+    d->mTreeWidget->setHeaderLabels(QStringList()
+        << i18nc("@title:column", "Cache")
+        << i18nc("@title:column number of items", "Entries")
+        << i18nc("@title:column", "Size")
+        << i18nc("@title:column cache hit rate", "Hits"));
+    d->mTreeWidget->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    d->mTreeWidget->header()->setStretchLastSection(false);
+
+    d->mSummaryLabel = new QLabel(this);
+
+    QDialogButtonBox* buttonBox = new QDialogButtonBox(QDialogButtonBox::Close);
+    QPushButton* releaseButton = buttonBox->addButton(i18nc("@action:button", "Release Memory"), QDialogButtonBox::ActionRole);
+    releaseButton->setToolTip(i18nc("@info:tooltip", "Ask the caches to release what they can reload"));
+    connect(releaseButton, &QPushButton::clicked, this, [this]() {
+        MemoryRegistry::instance()->releaseMemory();
+        d->refresh();
+    });
+    connect(buttonBox, SIGNAL(rejected()), this, SLOT(reject()));
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(d->mTreeWidget);
+    layout->addWidget(d->mSummaryLabel);
+    layout->addWidget(buttonBox);
+
+    d->mRefreshTimer = new QTimer(this);
+    d->mRefreshTimer->setInterval(REFRESH_INTERVAL);
+    connect(d->mRefreshTimer, &QTimer::timeout, this, [this]() {
+        d->refresh();
+    });
+    d->mRefreshTimer->start();
+    d->refresh();
+}
+
+MemoryUsageDialog::~MemoryUsageDialog()
+{
+    delete d;
+}
+
+QSize MemoryUsageDialog::sizeHint() const
+{
+    return QSize(500, 300);
+}
+
+} // namespace
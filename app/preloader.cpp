@@ -76,6 +76,7 @@ void Preloader::preload(const QUrl &url, const QSize& size)
     }
 
     d->mDocument = DocumentFactory::instance()->load(url);
+    d->mDocument->setLoadingPriority(Document::PreloadLoadingPriority);
     d->mSize = size;
     connect(d->mDocument.data(), SIGNAL(metaInfoUpdated()),
             SLOT(doPreload()));
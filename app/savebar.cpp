@@ -153,6 +153,9 @@ struct SaveBarPrivate
     {
         qreal maxPercentageOfMemoryUsage = GwenviewConfig::percentageOfMemoryUsageWarning();
         qulonglong maxMemoryUsage = MemoryUtils::getTotalMemory() * maxPercentageOfMemoryUsage;
+        // Document::memoryUsage() includes what the undo stack keeps, as
+        // well as the down sampled images. The warning thus shows up after
+        // fewer changes than when only the image and the raw data counted.
         qulonglong memoryUsage = 0;
         Q_FOREACH(const QUrl &url, list) {
             Document::Ptr doc = DocumentFactory::instance()->load(url);
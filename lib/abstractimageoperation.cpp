@@ -57,6 +57,11 @@ public:
         mOp->redo();
     }
 
+    AbstractImageOperation* operation() const
+    {
+        return mOp;
+    }
+
 private:
     AbstractImageOperation* mOp;
 };
@@ -78,6 +83,17 @@ AbstractImageOperation::~AbstractImageOperation()
     delete d;
 }
 
+qint64 AbstractImageOperation::memoryUsage() const
+{
+    return 0;
+}
+
+qint64 AbstractImageOperation::undoCommandMemoryUsage(const QUndoCommand* command)
+{
+    const ImageOperationCommand* imageCommand = dynamic_cast<const ImageOperationCommand*>(command);
+    return imageCommand ? imageCommand->operation()->memoryUsage() : 0;
+}
+
 void AbstractImageOperation::applyToDocument(Document::Ptr doc)
 {
     d->mUrl = doc->url();
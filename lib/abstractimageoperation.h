@@ -58,6 +58,17 @@ public:
     void applyToDocument(Document::Ptr);
     Document::Ptr document() const;
 
+    /**
+     * Memory kept to be able to undo the operation, in bytes
+     */
+    virtual qint64 memoryUsage() const;
+
+    /**
+     * Returns the memory used by @p command if it has been pushed by an
+     * AbstractImageOperation, 0 otherwise
+     */
+    static qint64 undoCommandMemoryUsage(const QUndoCommand* command);
+
 protected:
     virtual void redo() = 0;
     virtual void undo()
@@ -0,0 +1,220 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "cmsdisplaytransform.h"
+
+// Local
+#include <gvdebug.h>
+#include <taskscheduler.h>
+#include <tracer.h>
+
+// KDE
+
+// Qt
+#include <QDebug>
+#include <QHash>
+#include <QMutex>
+
+// lcms
+#include <lcms2.h>
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+/**
+ * Maximum number of transforms kept around. We usually only need one per
+ * image format, but compare mode can show documents with different profiles.
+ */
+static const int MAX_CACHED_TRANSFORMS = 8;
+
+/**
+ * Images smaller than this are not worth splitting
+ */
+static const int MIN_PIXELS_PER_STRIPE = 64 * 1024;
+
+struct TransformKey
+{
+    QByteArray sourceId;
+    QByteArray monitorId;
+    quint32 renderingIntent;
+    QImage::Format format;
+
+    bool operator==(const TransformKey& other) const
+    {
+        return sourceId == other.sourceId
+            && monitorId == other.monitorId
+            && renderingIntent == other.renderingIntent
+            && format == other.format;
+    }
+};
+
+inline uint qHash(const TransformKey& key)
+{
+    return qHash(key.sourceId) ^ qHash(key.monitorId) ^ key.renderingIntent ^ (uint(key.format) << 8);
+}
+
+struct DisplayTransformPrivate
+{
+    cmsHTRANSFORM mTransform;
+    QImage::Format mFormat;
+    // Keep profiles alive as long as the transform uses them
+    Profile::Ptr mSourceProfile;
+    Profile::Ptr mMonitorProfile;
+};
+
+struct TransformCache
+{
+    QMutex mMutex;
+    QHash<TransformKey, DisplayTransform::Ptr> mTransforms;
+    // Most recently used keys are at the end
+    QList<TransformKey> mKeys;
+};
+
+Q_GLOBAL_STATIC(TransformCache, sTransformCache)
+
+static cmsUInt32Number cmsFormatForImageFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+        return TYPE_BGRA_8;
+    case QImage::Format_Grayscale8:
+        return TYPE_GRAY_8;
+    default:
+        return 0;
+    }
+}
+
+DisplayTransform::DisplayTransform()
+: d(new DisplayTransformPrivate)
+{
+    d->mTransform = nullptr;
+    d->mFormat = QImage::Format_Invalid;
+}
+
+DisplayTransform::~DisplayTransform()
+{
+    if (d->mTransform) {
+        cmsDeleteTransform(d->mTransform);
+    }
+    delete d;
+}
+
+DisplayTransform::Ptr DisplayTransform::get(const Profile::Ptr& profile, quint32 renderingIntent, QImage::Format format)
+{
+    GV_RETURN_VALUE_IF_FAIL(profile, Ptr());
+    const cmsUInt32Number cmsFormat = cmsFormatForImageFormat(format);
+    if (cmsFormat == 0) {
+        qWarning() << "Gwenview can only apply color profile on RGB32 or ARGB32 images";
+        return Ptr();
+    }
+    Profile::Ptr monitorProfile = Profile::getMonitorProfile();
+    if (!monitorProfile) {
+        qWarning() << "Could not get monitor color profile";
+        return Ptr();
+    }
+
+    TransformKey key;
+    key.sourceId = profile->id();
+    key.monitorId = monitorProfile->id();
+    key.renderingIntent = renderingIntent;
+    key.format = format;
+
+    TransformCache* cache = sTransformCache;
+    QMutexLocker locker(&cache->mMutex);
+    DisplayTransform::Ptr ptr = cache->mTransforms.value(key);
+    if (ptr) {
+        cache->mKeys.removeOne(key);
+        cache->mKeys.append(key);
+        return ptr;
+    }
+
+    GV_TRACE("cms", "createTransform");
+    // cmsFLAGS_NOCACHE makes it safe to use the transform from several
+    // threads at the same time
+    cmsHTRANSFORM transform = cmsCreateTransform(profile->handle(), cmsFormat,
+                                                 monitorProfile->handle(), cmsFormat,
+                                                 renderingIntent,
+                                                 cmsFLAGS_BLACKPOINTCOMPENSATION | cmsFLAGS_NOCACHE);
+    if (!transform) {
+        qWarning() << "Could not create color transform";
+        return Ptr();
+    }
+    ptr = new DisplayTransform;
+    ptr->d->mTransform = transform;
+    ptr->d->mFormat = format;
+    ptr->d->mSourceProfile = profile;
+    ptr->d->mMonitorProfile = monitorProfile;
+
+    cache->mTransforms.insert(key, ptr);
+    cache->mKeys.append(key);
+    while (cache->mKeys.count() > MAX_CACHED_TRANSFORMS) {
+        cache->mTransforms.remove(cache->mKeys.takeFirst());
+    }
+    return ptr;
+}
+
+QImage::Format DisplayTransform::format() const
+{
+    return d->mFormat;
+}
+
+void DisplayTransform::apply(QImage* image) const
+{
+    GV_TRACE("cms", "transform");
+    GV_RETURN_IF_FAIL(image->format() == d->mFormat);
+    const int width = image->width();
+    const int height = image->height();
+    if (width == 0 || height == 0) {
+        return;
+    }
+    // Scanlines may be padded, so transform them one by one
+    const int bytesPerLine = image->bytesPerLine();
+    uchar* bits = image->bits();
+    const cmsHTRANSFORM transform = d->mTransform;
+    auto transformLines = [=](int first, int last) {
+        for (int y = first; y < last; ++y) {
+            uchar* line = bits + y * bytesPerLine;
+            cmsDoTransform(transform, line, line, width);
+        }
+    };
+
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int stripeCount = qBound(1, width * height / MIN_PIXELS_PER_STRIPE, scheduler->threadCount());
+    if (stripeCount == 1) {
+        transformLines(0, height);
+        return;
+    }
+    // The calling thread transforms stripes too, and does not wait for
+    // helpers which could not start because the pool is busy
+    const int stripeHeight = (height + stripeCount - 1) / stripeCount;
+    scheduler->runAndWait(TaskScheduler::ViewClass, stripeCount, [=](int stripe) {
+        const int first = stripe * stripeHeight;
+        transformLines(first, qMin(first + stripeHeight, height));
+    });
+}
+
+} // namespace Cms
+
+} // namespace Gwenview
@@ -0,0 +1,77 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef CMSDISPLAYTRANSFORM_H
+#define CMSDISPLAYTRANSFORM_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Local
+#include <lib/cms/cmsprofile.h>
+
+// Qt
+#include <QExplicitlySharedDataPointer>
+#include <QImage>
+#include <QSharedData>
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+struct DisplayTransformPrivate;
+/**
+ * A color transform from an image profile to the monitor profile.
+ *
+ * Creating an lcms transform is expensive, so transforms are cached and
+ * shared: use DisplayTransform::get() to retrieve one.
+ */
+class GWENVIEWLIB_EXPORT DisplayTransform : public QSharedData
+{
+public:
+    typedef QExplicitlySharedDataPointer<DisplayTransform> Ptr;
+
+    ~DisplayTransform();
+
+    /**
+     * Returns a transform from @p profile to the monitor profile, creating it
+     * if it is not in the cache yet. Returns a null pointer if @p format is
+     * not supported.
+     */
+    static DisplayTransform::Ptr get(const Profile::Ptr& profile, quint32 renderingIntent, QImage::Format format);
+
+    QImage::Format format() const;
+
+    /**
+     * Transforms @p image in place. Large images are split in stripes which
+     * are transformed in parallel.
+     */
+    void apply(QImage* image) const;
+
+private:
+    DisplayTransform();
+    DisplayTransformPrivate* const d;
+};
+
+} // namespace Cms
+} // namespace Gwenview
+
+#endif /* CMSDISPLAYTRANSFORM_H */
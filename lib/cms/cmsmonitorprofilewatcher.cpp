@@ -0,0 +1,118 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "cmsmonitorprofilewatcher.h"
+#include <config-gwenview.h>
+
+// Local
+#include <cms/cmsprofile.h>
+
+// Qt
+#include <QGuiApplication>
+#include <QPointer>
+
+// X11
+#ifdef HAVE_X11
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+#include <fixx11h.h>
+#include <QtX11Extras/QX11Info>
+#endif
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+struct MonitorProfileWatcherPrivate
+{
+    // The atom colord sets on the root window of the first screen
+    unsigned long mIccAtom = 0;
+};
+
+MonitorProfileWatcher* MonitorProfileWatcher::instance()
+{
+    // Owned by the application, so that it goes away before it
+    static QPointer<MonitorProfileWatcher> sInstance;
+    if (!sInstance) {
+        sInstance = new MonitorProfileWatcher;
+    }
+    return sInstance;
+}
+
+MonitorProfileWatcher::MonitorProfileWatcher()
+: QObject(qApp)
+, d(new MonitorProfileWatcherPrivate)
+{
+    connect(qApp, &QGuiApplication::screenAdded, this, &MonitorProfileWatcher::invalidate);
+    connect(qApp, &QGuiApplication::screenRemoved, this, &MonitorProfileWatcher::invalidate);
+    connect(qApp, &QGuiApplication::primaryScreenChanged, this, &MonitorProfileWatcher::invalidate);
+
+#ifdef HAVE_X11
+    if (QX11Info::isPlatformX11()) {
+        Display* display = QX11Info::display();
+        const Window root = QX11Info::appRootWindow();
+        d->mIccAtom = XInternAtom(display, "_ICC_PROFILE", False);
+        // Keep the events Qt already asked for
+        XWindowAttributes attributes;
+        if (XGetWindowAttributes(display, root, &attributes)) {
+            XSelectInput(display, root, attributes.your_event_mask | PropertyChangeMask);
+        }
+        qApp->installNativeEventFilter(this);
+    }
+#endif
+}
+
+MonitorProfileWatcher::~MonitorProfileWatcher()
+{
+    delete d;
+}
+
+bool MonitorProfileWatcher::nativeEventFilter(const QByteArray& eventType, void* message, long*)
+{
+#ifdef HAVE_X11
+    if (eventType != "xcb_generic_event_t") {
+        return false;
+    }
+    const xcb_generic_event_t* event = static_cast<xcb_generic_event_t*>(message);
+    if ((event->response_type & ~0x80) != XCB_PROPERTY_NOTIFY) {
+        return false;
+    }
+    const xcb_property_notify_event_t* propertyEvent = reinterpret_cast<const xcb_property_notify_event_t*>(event);
+    if (propertyEvent->window == QX11Info::appRootWindow() && propertyEvent->atom == d->mIccAtom) {
+        invalidate();
+    }
+#else
+    Q_UNUSED(eventType);
+    Q_UNUSED(message);
+#endif
+    return false;
+}
+
+void MonitorProfileWatcher::invalidate()
+{
+    Profile::invalidateMonitorProfile();
+    emit monitorProfileChanged();
+}
+
+} // namespace Cms
+} // namespace Gwenview
@@ -0,0 +1,68 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef CMSMONITORPROFILEWATCHER_H
+#define CMSMONITORPROFILEWATCHER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QAbstractNativeEventFilter>
+#include <QObject>
+
+class QScreen;
+
+namespace Gwenview
+{
+
+namespace Cms
+{
+
+struct MonitorProfileWatcherPrivate;
+/**
+ * Tells when the monitor profile may have changed: when screens are added,
+ * removed or swapped, or when the _ICC_PROFILE property of the root window
+ * changes, which is what colord does when the display profile changes.
+ *
+ * The profile cached by Profile::getMonitorProfile() is forgotten before
+ * monitorProfileChanged() is emitted. Must be used from the GUI thread.
+ */
+class GWENVIEWLIB_EXPORT MonitorProfileWatcher : public QObject, public QAbstractNativeEventFilter
+{
+    Q_OBJECT
+public:
+    static MonitorProfileWatcher* instance();
+    ~MonitorProfileWatcher() override;
+
+    bool nativeEventFilter(const QByteArray& eventType, void* message, long* result) override;
+
+Q_SIGNALS:
+    void monitorProfileChanged();
+
+private:
+    MonitorProfileWatcher();
+    void invalidate();
+    MonitorProfileWatcherPrivate* const d;
+};
+
+} // namespace Cms
+} // namespace Gwenview
+
+#endif /* CMSMONITORPROFILEWATCHER_H */
@@ -37,6 +37,7 @@ extern "C" {
 // Qt
 #include <QBuffer>
 #include <QDebug>
+#include <QMutex>
 #include <QtGlobal>
 
 // lcms
@@ -103,6 +104,7 @@ static cmsHPROFILE loadFromJpegData(const QByteArray& data)
 struct ProfilePrivate
 {
     cmsHPROFILE mProfile;
+    QByteArray mId;
 
     void reset()
     {
@@ -131,6 +133,16 @@ Profile::Profile(cmsHPROFILE hProfile)
 : d(new ProfilePrivate)
 {
     d->mProfile = hProfile;
+    // cmsMD5computeID() writes to the profile, do it now rather than when
+    // profiles are shared between threads
+    if (d->mProfile) {
+        cmsUInt8Number id[16];
+        if (!cmsMD5computeID(d->mProfile)) {
+            qWarning() << "Could not compute profile id";
+        }
+        cmsGetHeaderProfileID(d->mProfile, id);
+        d->mId = QByteArray(reinterpret_cast<const char*>(id), sizeof(id));
+    }
 }
 
 Profile::~Profile()
@@ -180,11 +192,30 @@ Profile::Ptr Profile::loadFromExiv2Image(const Exiv2::Image* image)
     return ptr;
 }
 
+Profile::Ptr Profile::loadFromIccData(const QByteArray& data)
+{
+    Profile::Ptr ptr;
+    if (data.isEmpty()) {
+        return ptr;
+    }
+    cmsHPROFILE hProfile = cmsOpenProfileFromMem(data.constData(), data.size());
+    if (hProfile) {
+        ptr = new Profile(hProfile);
+    }
+    return ptr;
+}
+
 cmsHPROFILE Profile::handle() const
 {
     return d->mProfile;
 }
 
+QByteArray Profile::id() const
+{
+    GV_RETURN_VALUE_IF_FAIL(d->mProfile, QByteArray());
+    return d->mId;
+}
+
 QString Profile::copyright() const
 {
     return d->readInfo(cmsInfoCopyright);
@@ -205,7 +236,15 @@ QString Profile::model() const
     return d->readInfo(cmsInfoModel);
 }
 
-Profile::Ptr Profile::getMonitorProfile()
+struct MonitorProfileCache
+{
+    QMutex mMutex;
+    Profile::Ptr mProfile;
+};
+
+Q_GLOBAL_STATIC(MonitorProfileCache, sMonitorProfileCache)
+
+static cmsHPROFILE readMonitorProfile()
 {
     cmsHPROFILE hProfile = nullptr;
     // Get the profile from you config file if the user has set it.
@@ -219,11 +258,13 @@ Profile::Ptr Profile::getMonitorProfile()
         int format;
         unsigned long nitems;
         unsigned long bytes_after;
-        quint8 *str;
+        quint8 *str = nullptr;
 
-        static Atom icc_atom = XInternAtom(QX11Info::display(), "_ICC_PROFILE", True);
+        // Not cached: the atom does not exist until a profile is set
+        const Atom icc_atom = XInternAtom(QX11Info::display(), "_ICC_PROFILE", True);
 
-        if (XGetWindowProperty(QX11Info::display(),
+        if (icc_atom != None
+                && XGetWindowProperty(QX11Info::display(),
                                QX11Info::appRootWindow(screen),
                                icc_atom,
                                0,
@@ -236,19 +277,52 @@ Profile::Ptr Profile::getMonitorProfile()
                                &bytes_after,
                                (unsigned char **) &str) == Success
                 ) {
-            hProfile = cmsOpenProfileFromMem((void*)str, nitems);
+            if (str) {
+                hProfile = cmsOpenProfileFromMem((void*)str, nitems);
+                XFree(str);
+            }
         }
     }
 #endif
-    if (!hProfile) {
-        return getSRgbProfile();
+    return hProfile;
+}
+
+Profile::Ptr Profile::getMonitorProfile()
+{
+    // Reading the X11 atom is a round-trip to the server and parsing the
+    // profile is not free either: do it only once, until
+    // MonitorProfileWatcher tells it changed
+    MonitorProfileCache* cache = sMonitorProfileCache;
+    QMutexLocker locker(&cache->mMutex);
+    if (cache->mProfile) {
+        return cache->mProfile;
     }
-    return Profile::Ptr(new Profile(hProfile));
+
+    cmsHPROFILE hProfile = readMonitorProfile();
+    if (hProfile) {
+        cache->mProfile = new Profile(hProfile);
+    } else {
+        cache->mProfile = getSRgbProfile();
+    }
+    return cache->mProfile;
+}
+
+void Profile::invalidateMonitorProfile()
+{
+    MonitorProfileCache* cache = sMonitorProfileCache;
+    QMutexLocker locker(&cache->mMutex);
+    cache->mProfile.reset();
 }
 
 Profile::Ptr Profile::getSRgbProfile()
 {
-    return Profile::Ptr(new Profile(cmsCreate_sRGBProfile()));
+    static QMutex mutex;
+    static Profile::Ptr sRgbProfile;
+    QMutexLocker locker(&mutex);
+    if (!sRgbProfile) {
+        sRgbProfile = new Profile(cmsCreate_sRGBProfile());
+    }
+    return sRgbProfile;
 }
 
 } // namespace Cms
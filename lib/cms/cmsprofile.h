@@ -62,9 +62,30 @@ public:
 
     cmsHPROFILE handle() const;
 
+    /**
+     * A digest of the profile content, suitable to identify identical
+     * profiles loaded from different images
+     */
+    QByteArray id() const;
+
     static Profile::Ptr loadFromImageData(const QByteArray& data, const QByteArray& format);
     static Profile::Ptr loadFromExiv2Image(const Exiv2::Image* image);
+    /**
+     * Creates a profile from the content of an ICC file, as returned by
+     * ImageHeader::iccProfile(). Returns a null pointer if @p data is empty or
+     * invalid.
+     */
+    static Profile::Ptr loadFromIccData(const QByteArray& data);
+    /**
+     * Returns the monitor profile. It is read once and shared until
+     * invalidateMonitorProfile() is called.
+     */
     static Profile::Ptr getMonitorProfile();
+    /**
+     * Forgets the monitor profile, so that the next call to
+     * getMonitorProfile() reads it again. See MonitorProfileWatcher.
+     */
+    static void invalidateMonitorProfile();
     static Profile::Ptr getSRgbProfile();
 
 private:
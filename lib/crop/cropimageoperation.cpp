@@ -92,4 +92,9 @@ void CropImageOperation::undo()
     finish(true);
 }
 
+qint64 CropImageOperation::memoryUsage() const
+{
+    return d->mOriginalImage.byteCount();
+}
+
 } // namespace
@@ -44,6 +44,7 @@ public:
 
     void redo() override;
     void undo() override;
+    qint64 memoryUsage() const override;
 
 private:
     CropImageOperationPrivate* const d;
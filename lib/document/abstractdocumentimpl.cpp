@@ -97,4 +97,9 @@ void AbstractDocumentImpl::setDocumentCmsProfile(Cms::Profile::Ptr profile)
     d->mDocument->setCmsProfile(profile);
 }
 
+void AbstractDocumentImpl::setDocumentRegionDecoder(RegionDecoder* decoder)
+{
+    d->mDocument->setRegionDecoder(decoder);
+}
+
 } // namespace
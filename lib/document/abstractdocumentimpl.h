@@ -111,6 +111,7 @@ protected:
     void setDocumentExiv2Image(Exiv2::Image::AutoPtr);
     void setDocumentDownSampledImage(const QImage&, int invertedZoom);
     void setDocumentCmsProfile(Cms::Profile::Ptr profile);
+    void setDocumentRegionDecoder(RegionDecoder*);
     void setDocumentErrorString(const QString&);
     void switchToImpl(AbstractDocumentImpl*  impl);
 
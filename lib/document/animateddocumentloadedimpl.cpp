@@ -23,22 +23,175 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Qt
 #include <QBuffer>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <QImage>
-#include <QMovie>
-#include <QDebug>
+#include <QImageReader>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVector>
 
 // KDE
 
 // Local
+#include <lib/memoryutils.h>
+#include <lib/paintutils.h>
+#include <lib/taskscheduler.h>
+#include <lib/tracer.h>
 
 namespace Gwenview
 {
 
+/**
+ * Maximum amount of memory used to keep decoded frames around
+ */
+static const qint64 MAX_FRAME_CACHE_SIZE = 256 * 1024 * 1024;
+
+/**
+ * Maximum number of frames decoded ahead of the one being shown
+ */
+static const int MAX_QUEUED_FRAMES = 16;
+
+/**
+ * Some animations claim a delay of 0, do not let them eat all the CPU
+ */
+static const int MIN_FRAME_DELAY = 10;
+
+struct AnimatedFrame
+{
+    QImage image;
+    int delay;
+    int number;
+    // Part of the image which changed since the previous frame
+    QRect dirtyRect;
+};
+
+struct DecodeResult
+{
+    QVector<AnimatedFrame> frames;
+    bool atEnd;
+};
+
+/**
+ * Decodes frames in a worker thread. It is shared with the running decode
+ * task, so that the document does not have to wait for it when it goes away.
+ */
+struct AnimatedFrameDecoder
+{
+    explicit AnimatedFrameDecoder(const QByteArray& rawData)
+    : mRawData(rawData)
+    , mDecodedFrameNumber(0)
+    {
+        mBuffer.setBuffer(&mRawData);
+        mBuffer.open(QIODevice::ReadOnly);
+    }
+
+    QByteArray mRawData;
+    QBuffer mBuffer;
+    QScopedPointer<QImageReader> mReader;
+    QImage mLastDecodedImage;
+    int mDecodedFrameNumber;
+
+    DecodeResult decodeFrames(int maxFrames)
+    {
+        DecodeResult result;
+        result.atEnd = false;
+        if (!mReader) {
+            mBuffer.seek(0);
+            mReader.reset(new QImageReader(&mBuffer));
+            mDecodedFrameNumber = 0;
+        }
+        while (result.frames.count() < maxFrames) {
+            if (!mReader->canRead()) {
+                result.atEnd = true;
+                break;
+            }
+            AnimatedFrame frame;
+            frame.image = mReader->read();
+            if (frame.image.isNull()) {
+                result.atEnd = true;
+                break;
+            }
+            frame.delay = qMax(mReader->nextImageDelay(), MIN_FRAME_DELAY);
+            frame.number = mDecodedFrameNumber++;
+            frame.dirtyRect = PaintUtils::changedRect(mLastDecodedImage, frame.image);
+            mLastDecodedImage = frame.image;
+            result.frames << frame;
+        }
+        if (result.atEnd) {
+            // Start again from the first frame next time
+            mReader.reset();
+        }
+        return result;
+    }
+};
+
 struct AnimatedDocumentLoadedImplPrivate
 {
     QByteArray mRawData;
-    QBuffer mMovieBuffer;
-    QMovie mMovie;
+
+    // Only accessed by the decode task once playback started
+    QSharedPointer<AnimatedFrameDecoder> mDecoder;
+    // Size of the last decoded frame
+    qint64 mFrameSize;
+
+    QFutureWatcher<DecodeResult> mDecodeWatcher;
+
+    // Playback state
+    QTimer mFrameTimer;
+    QElapsedTimer mClock;
+    qint64 mNextFrameTime;
+    bool mPlaying;
+    bool mWaitingForFrame;
+    int mLoopCount;
+    int mLoopsDone;
+    bool mShownFrame;
+
+    // Frames decoded ahead, waiting to be shown
+    QQueue<AnimatedFrame> mQueuedFrames;
+    // Frame we took but did not show because the animation ended. It is the
+    // first one shown when the animation is started again.
+    AnimatedFrame mHeldFrame;
+    bool mHasHeldFrame;
+
+    // All frames of the animation, as long as they fit in mFrameCacheBudget.
+    // Once mLoopComplete is true, we stop decoding and play from there.
+    QVector<AnimatedFrame> mLoopFrames;
+    qint64 mLoopFramesSize;
+    qint64 mFrameCacheBudget;
+    bool mCacheLoop;
+    bool mLoopComplete;
+    int mLoopFrameIndex;
+
+    int maxQueuedFrames() const
+    {
+        if (mFrameSize == 0) {
+            return 2;
+        }
+        return qBound(2, int(mFrameCacheBudget / mFrameSize), MAX_QUEUED_FRAMES);
+    }
+
+    bool takeFrame(AnimatedFrame* frame)
+    {
+        if (mHasHeldFrame) {
+            *frame = mHeldFrame;
+            mHeldFrame = AnimatedFrame();
+            mHasHeldFrame = false;
+            return true;
+        }
+        if (!mQueuedFrames.isEmpty()) {
+            *frame = mQueuedFrames.dequeue();
+            return true;
+        }
+        if (mLoopComplete && !mLoopFrames.isEmpty()) {
+            *frame = mLoopFrames.at(mLoopFrameIndex);
+            mLoopFrameIndex = (mLoopFrameIndex + 1) % mLoopFrames.count();
+            return true;
+        }
+        return false;
+    }
 };
 
 AnimatedDocumentLoadedImpl::AnimatedDocumentLoadedImpl(Document* document, const QByteArray& rawData)
@@ -46,16 +199,34 @@ AnimatedDocumentLoadedImpl::AnimatedDocumentLoadedImpl(Document* document, const
 , d(new AnimatedDocumentLoadedImplPrivate)
 {
     d->mRawData = rawData;
+    d->mDecoder.reset(new AnimatedFrameDecoder(rawData));
+    d->mFrameSize = 0;
+    d->mNextFrameTime = 0;
+    d->mPlaying = false;
+    d->mWaitingForFrame = false;
+    d->mLoopsDone = 0;
+    d->mShownFrame = false;
+    d->mHasHeldFrame = false;
+    d->mLoopFramesSize = 0;
+    d->mCacheLoop = true;
+    d->mLoopComplete = false;
+    d->mLoopFrameIndex = 0;
+    d->mFrameCacheBudget = qMin(MAX_FRAME_CACHE_SIZE, qint64(MemoryUtils::getFreeMemory() / 4));
 
-    connect(&d->mMovie, &QMovie::frameChanged, this, &AnimatedDocumentLoadedImpl::slotFrameChanged);
+    d->mDecoder->mReader.reset(new QImageReader(&d->mDecoder->mBuffer));
+    d->mLoopCount = d->mDecoder->mReader->loopCount();
 
-    d->mMovieBuffer.setBuffer(&d->mRawData);
-    d->mMovieBuffer.open(QIODevice::ReadOnly);
-    d->mMovie.setDevice(&d->mMovieBuffer);
+    d->mFrameTimer.setSingleShot(true);
+    d->mFrameTimer.setTimerType(Qt::PreciseTimer);
+    connect(&d->mFrameTimer, &QTimer::timeout, this, &AnimatedDocumentLoadedImpl::showNextFrame);
+    connect(&d->mDecodeWatcher, &QFutureWatcher<DecodeResult>::finished, this, &AnimatedDocumentLoadedImpl::slotFramesDecoded);
 }
 
 AnimatedDocumentLoadedImpl::~AnimatedDocumentLoadedImpl()
 {
+    // A running decode keeps the decoder alive, no need to wait for it
+    d->mDecodeWatcher.disconnect();
+    d->mDecodeWatcher.cancel();
     delete d;
 }
 
@@ -81,11 +252,112 @@ QByteArray AnimatedDocumentLoadedImpl::rawData() const
     return d->mRawData;
 }
 
-void AnimatedDocumentLoadedImpl::slotFrameChanged(int /*frameNumber*/)
+void AnimatedDocumentLoadedImpl::scheduleDecoding()
 {
-    QImage image = d->mMovie.currentImage();
-    setDocumentImage(image);
-    emit imageRectUpdated(image.rect());
+    if (d->mDecodeWatcher.isRunning() || d->mLoopComplete) {
+        return;
+    }
+    const int count = d->maxQueuedFrames() - d->mQueuedFrames.count();
+    if (count <= 0) {
+        return;
+    }
+    QSharedPointer<AnimatedFrameDecoder> decoder = d->mDecoder;
+    d->mDecodeWatcher.setFuture(TaskScheduler::instance()->run(TaskScheduler::ViewClass, [decoder, count]() {
+        return decoder->decodeFrames(count);
+    }));
+}
+
+void AnimatedDocumentLoadedImpl::slotFramesDecoded()
+{
+    const DecodeResult result = d->mDecodeWatcher.result();
+    if (!result.frames.isEmpty()) {
+        const QImage& image = result.frames.last().image;
+        d->mFrameSize = qint64(image.bytesPerLine()) * image.height();
+    }
+    Q_FOREACH(const AnimatedFrame& frame, result.frames) {
+        d->mQueuedFrames.enqueue(frame);
+        if (d->mCacheLoop) {
+            d->mLoopFrames << frame;
+            d->mLoopFramesSize += frame.image.bytesPerLine() * frame.image.height();
+            if (d->mLoopFramesSize > d->mFrameCacheBudget) {
+                GV_TRACE_EVENT("animation", "frameCacheFull",
+                               QStringLiteral("%1 frames, %2 bytes").arg(d->mLoopFrames.count()).arg(d->mLoopFramesSize));
+                d->mCacheLoop = false;
+                d->mLoopFrames.clear();
+            }
+        }
+    }
+    if (result.atEnd) {
+        if (d->mCacheLoop && !d->mLoopFrames.isEmpty()) {
+            GV_TRACE_EVENT("animation", "loopCached", QStringLiteral("%1 frames").arg(d->mLoopFrames.count()));
+            d->mLoopComplete = true;
+        } else if (result.frames.isEmpty() && d->mQueuedFrames.isEmpty() && d->mLoopFrames.isEmpty()) {
+            // Nothing more to play, the animation is probably corrupted
+            d->mPlaying = false;
+            d->mWaitingForFrame = false;
+            return;
+        }
+    }
+
+    if (d->mWaitingForFrame && d->mPlaying) {
+        d->mWaitingForFrame = false;
+        // Do not try to catch up the time we spent waiting
+        d->mNextFrameTime = d->mClock.elapsed();
+        showNextFrame();
+    } else {
+        scheduleDecoding();
+    }
+}
+
+void AnimatedDocumentLoadedImpl::showNextFrame()
+{
+    if (!d->mPlaying) {
+        return;
+    }
+    AnimatedFrame frame;
+    if (!d->takeFrame(&frame)) {
+        d->mWaitingForFrame = true;
+        scheduleDecoding();
+        return;
+    }
+
+    bool skippedFrames = false;
+    const qint64 now = d->mClock.elapsed();
+    if (d->mLoopComplete && d->mQueuedFrames.isEmpty() && d->mShownFrame) {
+        // If we are late, skip frames rather than slowing the animation down.
+        // This is only cheap when frames come from the cache.
+        while (now > d->mNextFrameTime + frame.delay && frame.number != d->mLoopFrames.count() - 1) {
+            d->mNextFrameTime += frame.delay;
+            d->takeFrame(&frame);
+            skippedFrames = true;
+        }
+    }
+
+    if (frame.number == 0 && d->mShownFrame) {
+        ++d->mLoopsDone;
+        if (d->mLoopCount != -1 && d->mLoopsDone > d->mLoopCount) {
+            d->mPlaying = false;
+            d->mHeldFrame = frame;
+            d->mHasHeldFrame = true;
+            return;
+        }
+    }
+
+    setDocumentImage(frame.image);
+    if (!d->mShownFrame || skippedFrames) {
+        emit imageRectUpdated(frame.image.rect());
+    } else if (!frame.dirtyRect.isEmpty()) {
+        emit imageRectUpdated(frame.dirtyRect);
+    }
+    d->mShownFrame = true;
+
+    d->mNextFrameTime += frame.delay;
+    if (d->mNextFrameTime < now) {
+        // We are too late to keep up, restart timing from now
+        d->mNextFrameTime = now + frame.delay;
+    }
+    d->mFrameTimer.start(int(d->mNextFrameTime - now));
+    scheduleDecoding();
 }
 
 bool AnimatedDocumentLoadedImpl::isAnimated() const
@@ -95,18 +367,25 @@ bool AnimatedDocumentLoadedImpl::isAnimated() const
 
 void AnimatedDocumentLoadedImpl::startAnimation()
 {
-    d->mMovie.start();
-    if (d->mMovie.state() == QMovie::NotRunning) {
-        // This is true with qt-copy as of 2008.08.23
-        //qDebug() << "QMovie didn't start. This can happen in some cases when starting for the second time.";
-        //qDebug() << "Trying to start again, it usually fixes the bug.";
-        d->mMovie.start();
+    if (d->mPlaying) {
+        return;
+    }
+    d->mPlaying = true;
+    if (d->mLoopCount != -1 && d->mLoopsDone > d->mLoopCount) {
+        // Animation has already been played, play it again
+        d->mLoopsDone = 0;
+        d->mShownFrame = false;
     }
+    d->mClock.start();
+    d->mNextFrameTime = 0;
+    showNextFrame();
 }
 
 void AnimatedDocumentLoadedImpl::stopAnimation()
 {
-    d->mMovie.stop();
+    d->mPlaying = false;
+    d->mWaitingForFrame = false;
+    d->mFrameTimer.stop();
 }
 
 } // namespace
@@ -32,6 +32,12 @@ namespace Gwenview
 {
 
 struct AnimatedDocumentLoadedImplPrivate;
+/**
+ * Plays animated images. Frames are decoded ahead on a worker thread and, if
+ * the whole animation fits in the frame cache budget, decoded only once.
+ * Only the part of the image which changed between two frames is reported
+ * through imageRectUpdated().
+ */
 class AnimatedDocumentLoadedImpl : public AbstractDocumentImpl
 {
     Q_OBJECT
@@ -47,10 +53,13 @@ public:
     void stopAnimation() override;
 
 private Q_SLOTS:
-    void slotFrameChanged(int frameNumber);
+    void showNextFrame();
+    void slotFramesDecoded();
 
 private:
     AnimatedDocumentLoadedImplPrivate* const d;
+
+    void scheduleDecoding();
 };
 
 } // namespace
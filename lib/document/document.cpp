@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 // Qt
 #include <QApplication>
+#include <QFutureWatcher>
 #include <QImage>
 #include <QUndoStack>
 #include <QUrl>
@@ -32,6 +33,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <KJobUiDelegate>
 
 // Local
+#include "abstractimageoperation.h"
 #include "documentjob.h"
 #include "emptydocumentimpl.h"
 #include "gvdebug.h"
@@ -39,6 +41,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "loadingdocumentimpl.h"
 #include "loadingjob.h"
 #include "savejob.h"
+#include "taskscheduler.h"
+#include "tracer.h"
 
 namespace Gwenview
 {
@@ -122,22 +126,42 @@ void DocumentPrivate::scheduleImageDownSampling(int invertedZoom)
     q->enqueueJob(new DownSamplingJob(invertedZoom));
 }
 
-void DocumentPrivate::downSampleImage(int invertedZoom)
+QImage DocumentPrivate::downSampledImage(const QImage& image, int invertedZoom)
 {
-    mDownSampledImageMap[invertedZoom] = mImage.scaled(mImage.size() / invertedZoom, Qt::KeepAspectRatio, Qt::FastTransformation);
-    if (mDownSampledImageMap[invertedZoom].size().isEmpty()) {
-        mDownSampledImageMap[invertedZoom] = mImage;
-    }
+    GV_TRACE("load", "downSample");
+    const QImage downSampled = image.scaled(image.size() / invertedZoom, Qt::KeepAspectRatio, Qt::FastTransformation);
+    return downSampled.size().isEmpty() ? image : downSampled;
+}
+
+void DocumentPrivate::setDownSampledImage(const QImage& image, int invertedZoom)
+{
+    mDownSampledImageMap[invertedZoom] = image;
     emit q->downSampledImageReady();
 }
 
 //- DownSamplingJob ---------------------------------------
 void DownSamplingJob::doStart()
 {
-    DocumentPrivate* d = document()->d;
-    d->downSampleImage(mInvertedZoom);
-    setError(NoError);
-    emitResult();
+    const QImage image = document()->image();
+    const int invertedZoom = mInvertedZoom;
+    const int generation = document()->d->mImageGeneration;
+    const TaskScheduler::TaskClass taskClass = document()->loadingPriority() == Document::ViewLoadingPriority
+        ? TaskScheduler::ViewClass
+        : TaskScheduler::PreloadClass;
+
+    QFutureWatcher<QImage>* watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, generation]() {
+        if (document()->d->mImageGeneration == generation) {
+            document()->d->setDownSampledImage(watcher->result(), mInvertedZoom);
+        } else {
+            LOG("Image changed while down sampling, dropping result");
+        }
+        setError(NoError);
+        emitResult();
+    });
+    watcher->setFuture(TaskScheduler::instance()->run(taskClass, [image, invertedZoom]() {
+        return DocumentPrivate::downSampledImage(image, invertedZoom);
+    }));
 }
 
 //- Document ----------------------------------------------
@@ -154,6 +178,8 @@ Document::Document(const QUrl &url)
     d->mImpl = nullptr;
     d->mUrl = url;
     d->mKeepRawData = false;
+    d->mLoadingPriority = ViewLoadingPriority;
+    d->mImageGeneration = 0;
 
     reload();
 }
@@ -172,6 +198,7 @@ void Document::reload()
 {
     d->mSize = QSize();
     d->mImage = QImage();
+    ++d->mImageGeneration;
     d->mDownSampledImageMap.clear();
     d->mExiv2Image.reset();
     d->mKind = MimeTypeUtils::KIND_UNKNOWN;
@@ -180,6 +207,7 @@ void Document::reload()
     d->mUndoStack.clear();
     d->mErrorString.clear();
     d->mCmsProfile = nullptr;
+    d->mRegionDecoder.reset();
 
     switchToImpl(new LoadingDocumentImpl(this));
 }
@@ -212,6 +240,9 @@ const QImage& Document::downSampledImageForZoom(qreal zoom) const
     }
 
     if (!d->mDownSampledImageMap.contains(invertedZoom)) {
+        if (!d->mImage.isNull() && isAnimated()) {
+            return d->mImage;
+        }
         if (!d->mImage.isNull()) {
             // Special case: if we have the full image and the down sampled
             // image would be too small, return the original image.
@@ -226,6 +257,23 @@ const QImage& Document::downSampledImageForZoom(qreal zoom) const
     return d->mDownSampledImageMap[invertedZoom];
 }
 
+const QImage& Document::readyImageForZoom(qreal zoom) const
+{
+    static const QImage sNullImage;
+
+    const QImage& image = downSampledImageForZoom(zoom);
+    if (!image.isNull()) {
+        return image;
+    }
+    for (int invertedZoom = invertedZoomForZoom(zoom) / 2; invertedZoom > 1; invertedZoom /= 2) {
+        auto it = d->mDownSampledImageMap.constFind(invertedZoom);
+        if (it != d->mDownSampledImageMap.constEnd()) {
+            return it.value();
+        }
+    }
+    return sNullImage;
+}
+
 Document::LoadingState Document::loadingState() const
 {
     return d->mImpl->loadingState();
@@ -256,7 +304,10 @@ void Document::switchToImpl(AbstractDocumentImpl* impl)
 void Document::setImageInternal(const QImage& image)
 {
     d->mImage = image;
+    ++d->mImageGeneration;
     d->mDownSampledImageMap.clear();
+    // The full image is here, no need to decode parts of it anymore
+    d->mRegionDecoder.reset();
 
     // If we didn't get the image size before decoding the full image, set it
     // now
@@ -360,11 +411,22 @@ bool Document::hasAlphaChannel() const
     }
 }
 
-int Document::memoryUsage() const
+qint64 Document::memoryUsage() const
 {
-    // FIXME: Take undo stack into account
-    int usage = d->mImage.byteCount();
+    qint64 usage = d->mImage.byteCount();
+    for (const QImage& image : qAsConst(d->mDownSampledImageMap)) {
+        // Images too small to be down sampled are the full image
+        if (image.cacheKey() != d->mImage.cacheKey()) {
+            usage += image.byteCount();
+        }
+    }
     usage += rawData().length();
+    if (d->mRegionDecoder) {
+        usage += d->mRegionDecoder->memoryUsage();
+    }
+    for (int idx = 0; idx < d->mUndoStack.count(); ++idx) {
+        usage += AbstractImageOperation::undoCommandMemoryUsage(d->mUndoStack.command(idx));
+    }
     return usage;
 }
 
@@ -434,6 +496,44 @@ void Document::startLoadingFullImage()
     }
 }
 
+void Document::setLoadingPriority(LoadingPriority priority)
+{
+    if (d->mLoadingPriority == priority) {
+        return;
+    }
+    d->mLoadingPriority = priority;
+    LoadingDocumentImpl* impl = qobject_cast<LoadingDocumentImpl*>(d->mImpl);
+    if (impl) {
+        impl->updateLoadingPriority();
+    }
+}
+
+Document::LoadingPriority Document::loadingPriority() const
+{
+    return d->mLoadingPriority;
+}
+
+void Document::cancelPendingImageLoading()
+{
+    LoadingDocumentImpl* impl = qobject_cast<LoadingDocumentImpl*>(d->mImpl);
+    if (!impl || !d->mJobQueue.isEmpty()) {
+        return;
+    }
+    LoadingJob* loadingJob = qobject_cast<LoadingJob*>(d->mCurrentJob.data());
+    if (d->mCurrentJob && !loadingJob) {
+        // Another job waits for the image
+        return;
+    }
+    if (!impl->cancelPendingImageLoading()) {
+        return;
+    }
+    if (loadingJob) {
+        // Nobody waits for it, and it would not finish before the image is
+        // requested again
+        loadingJob->kill(KJob::EmitResult);
+    }
+}
+
 bool Document::prepareDownSampledImageForZoom(qreal zoom)
 {
     if (zoom >= maxDownSampledZoom()) {
@@ -446,6 +546,11 @@ bool Document::prepareDownSampledImageForZoom(qreal zoom)
         LOG("downSampledImageForZoom=" << zoom << "invertedZoom=" << invertedZoom << "ready");
         return true;
     }
+    if (isAnimated() && !d->mImage.isNull()) {
+        // Each frame replaces the image: down sampling it would be wasted
+        // work, scale the frames directly
+        return true;
+    }
 
     LOG("downSampledImageForZoom=" << zoom << "invertedZoom=" << invertedZoom << "not ready");
     if (loadingState() == LoadingFailed) {
@@ -564,6 +669,19 @@ void Document::setCmsProfile(Cms::Profile::Ptr ptr)
     d->mCmsProfile = ptr;
 }
 
+void Document::setRegionDecoder(RegionDecoder* decoder)
+{
+    d->mRegionDecoder.reset(decoder);
+    if (decoder) {
+        connect(decoder, &RegionDecoder::regionReady, this, &Document::regionReady);
+    }
+}
+
+RegionDecoder* Document::regionDecoder() const
+{
+    return d->mRegionDecoder.get();
+}
+
 Cms::Profile::Ptr Document::cmsProfile() const
 {
     return d->mCmsProfile;
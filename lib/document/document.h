@@ -52,6 +52,7 @@ class DocumentJob;
 class DocumentFactory;
 struct DocumentPrivate;
 class ImageMetaInfoModel;
+class RegionDecoder;
 
 /**
  * This class represents an image.
@@ -87,6 +88,11 @@ public:
         LoadingFailed   ///< Image loading has failed
     };
 
+    enum LoadingPriority {
+        ViewLoadingPriority,   ///< Document is being viewed
+        PreloadLoadingPriority ///< Document is preloaded, or not viewed anymore
+    };
+
     typedef QExplicitlySharedDataPointer<Document> Ptr;
     ~Document() override;
 
@@ -111,6 +117,22 @@ public:
 
     LoadingState loadingState() const;
 
+    /**
+     * Decoding of documents with ViewLoadingPriority starts before decoding
+     * of documents with PreloadLoadingPriority. Defaults to
+     * ViewLoadingPriority.
+     */
+    void setLoadingPriority(LoadingPriority);
+
+    LoadingPriority loadingPriority() const;
+
+    /**
+     * Drops the decoding of the image if it has not started yet, unless
+     * jobs are waiting for it. To be called when the document is not shown
+     * anymore. The image is decoded again if it is requested later.
+     */
+    void cancelPendingImageLoading();
+
     MimeTypeUtils::Kind kind() const;
 
     bool isModified() const;
@@ -119,6 +141,23 @@ public:
 
     const QImage& downSampledImageForZoom(qreal zoom) const;
 
+    /**
+     * Returns the smallest image which is ready and big enough to be shown
+     * at @a zoom: the down sampled image for @a zoom or a bigger one, or the
+     * full image if @a zoom does not need down sampling. Unlike
+     * downSampledImageForZoom(), this does not fall back to the full image
+     * when a down sampled image would do. Returns a null image if none is
+     * ready.
+     */
+    const QImage& readyImageForZoom(qreal zoom) const;
+
+    /**
+     * Returns a decoder for parts of the full image if the image is too big
+     * to be decoded at once, nullptr otherwise. Use it instead of
+     * startLoadingFullImage() to show the image at 100% and above.
+     */
+    RegionDecoder* regionDecoder() const;
+
     /**
      * Returns an implementation of AbstractDocumentEditor if this document can
      * be edited.
@@ -156,9 +195,10 @@ public:
     bool keepRawData() const;
 
     /**
-     * Returns how much bytes the document is using
+     * Returns how much bytes the document is using, including the down
+     * sampled images and what the undo stack keeps
      */
-    int memoryUsage() const;
+    qint64 memoryUsage() const;
 
     /**
      * Returns the compressed version of the document, if it is still
@@ -206,6 +246,7 @@ public:
 
 Q_SIGNALS:
     void downSampledImageReady();
+    void regionReady();
     void imageRectUpdated(const QRect&);
     void kindDetermined(const QUrl&);
     void metaInfoLoaded(const QUrl&);
@@ -240,6 +281,7 @@ private:
     void switchToImpl(AbstractDocumentImpl* impl);
     void setErrorString(const QString&);
     void setCmsProfile(Cms::Profile::Ptr);
+    void setRegionDecoder(RegionDecoder*);
 
     Document(const QUrl&);
     DocumentPrivate * const d;
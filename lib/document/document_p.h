@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Local
 #include <imagemetainfomodel.h>
 #include <document/documentjob.h>
+#include <document/regiondecoder.h>
 
 // KDE
 #include <QUrl>
@@ -34,6 +35,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include <QUndoStack>
 #include <QPointer>
 
+// STL
+#include <memory>
+
 namespace Gwenview
 {
 
@@ -44,6 +48,7 @@ struct DocumentPrivate
     AbstractDocumentImpl* mImpl;
     QUrl mUrl;
     bool mKeepRawData;
+    Document::LoadingPriority mLoadingPriority;
     QPointer<DocumentJob> mCurrentJob;
     DocumentJobQueue mJobQueue;
 
@@ -61,11 +66,17 @@ struct DocumentPrivate
     QUndoStack mUndoStack;
     QString mErrorString;
     Cms::Profile::Ptr mCmsProfile;
+    std::unique_ptr<RegionDecoder> mRegionDecoder;
     /** @} */
 
+    // Incremented whenever mImage is replaced, so that down sampled images
+    // computed from a previous image can be dropped
+    int mImageGeneration;
+
     void scheduleImageLoading(int invertedZoom);
     void scheduleImageDownSampling(int invertedZoom);
-    void downSampleImage(int invertedZoom);
+    static QImage downSampledImage(const QImage& image, int invertedZoom);
+    void setDownSampledImage(const QImage& image, int invertedZoom);
 };
 
 
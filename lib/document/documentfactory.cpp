@@ -31,6 +31,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 // Local
 #include <gvdebug.h>
+#include <memoryregistry.h>
 
 namespace Gwenview
 {
@@ -83,9 +84,10 @@ struct DocumentFactoryPrivate
     QUndoGroup mUndoGroup;
 
     /**
-     * Removes items in a map if they are no longer referenced elsewhere
+     * Removes items in a map if they are no longer referenced elsewhere,
+     * keeping the maxUnreferencedImages most recently accessed ones
      */
-    void garbageCollect(DocumentMap& map)
+    void garbageCollect(DocumentMap& map, int maxUnreferencedImages = MAX_UNREFERENCED_IMAGES)
     {
         // Build a map of all unreferenced images. We use a MultiMap because in
         // rare cases documents may get accessed at the same millisecond.
@@ -105,7 +107,7 @@ struct DocumentFactoryPrivate
         // the oldest one is always unreferencedImages.begin().
         for (
             UnreferencedImages::Iterator unreferencedIt = unreferencedImages.begin();
-            unreferencedImages.count() > MAX_UNREFERENCED_IMAGES;
+            unreferencedImages.count() > maxUnreferencedImages;
             unreferencedIt = unreferencedImages.erase(unreferencedIt))
         {
             QUrl url = unreferencedIt.value();
@@ -140,6 +142,17 @@ struct DocumentFactoryPrivate
 DocumentFactory::DocumentFactory()
 : d(new DocumentFactoryPrivate)
 {
+    MemoryRegistry* registry = MemoryRegistry::instance();
+    registry->addCache(QStringLiteral("Documents"), [this](MemoryRegistry::CacheUsage* usage) {
+        for (const DocumentInfo* info : qAsConst(d->mDocumentMap)) {
+            usage->bytes += info->mDocument->memoryUsage();
+        }
+        usage->entries = d->mDocumentMap.count();
+    }, this);
+    connect(registry, &MemoryRegistry::memoryPressure, this, [this]() {
+        LOG("Memory pressure, collecting all unreferenced documents");
+        d->garbageCollect(d->mDocumentMap, 0);
+    });
 }
 
 DocumentFactory::~DocumentFactory()
@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "loadingdocumentimpl.h"
 
 // STL
+#include <functional>
 #include <memory>
 
 // Qt
@@ -29,11 +30,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <QByteArray>
 #include <QFile>
 #include <QFuture>
+#include <QFutureInterface>
 #include <QFutureWatcher>
 #include <QImage>
 #include <QImageReader>
 #include <QPointer>
-#include <QtConcurrent>
+#include <QRunnable>
 #include <QUrl>
 #include <QDebug>
 
@@ -55,11 +57,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "emptydocumentimpl.h"
 #include "exiv2imageloader.h"
 #include "gvdebug.h"
+#include "imageheader.h"
 #include "imageutils.h"
 #include "jpegcontent.h"
 #include "jpegdocumentloadedimpl.h"
 #include "orientation.h"
+#include "regiondecoder.h"
 #include "svgdocumentloadedimpl.h"
+#include "taskscheduler.h"
+#include "tracer.h"
 #include "urlutils.h"
 #include "videodocumentloadedimpl.h"
 #include "gwenviewconfig.h"
@@ -80,13 +86,120 @@ const int MIN_PREV_SIZE = 1000;
 
 const int HEADER_SIZE = 256;
 
+// Returns true if the file extension @p hint names the format found by
+// ImageHeader
+static bool headerFormatMatchesHint(const QByteArray& format, const QByteArray& hint)
+{
+    if (format == hint) {
+        return true;
+    }
+    if (format == "jpeg") {
+        return hint == "jpg" || hint == "jpe";
+    }
+    if (format == "tiff") {
+        return hint == "tif";
+    }
+    return false;
+}
+
+/**
+ * A decoding task which can be canceled, and whose priority can be changed as
+ * long as it has not started.
+ */
+class LoadingTask : public QRunnable
+{
+public:
+    typedef std::function<void(const LoadingTask&)> Function;
+
+    explicit LoadingTask(const Function& function)
+    : mFunction(function)
+    {
+        setAutoDelete(false);
+        mInterface.reportStarted();
+    }
+
+    QFuture<void> future()
+    {
+        return mInterface.future();
+    }
+
+    bool isCanceled() const
+    {
+        return mInterface.isCanceled();
+    }
+
+    /**
+     * Asks the task to stop at its next checkpoint
+     */
+    void cancel()
+    {
+        mInterface.cancel();
+    }
+
+    /**
+     * Must be called if the task has been taken back from the thread pool
+     * before it started
+     */
+    void reportTaken()
+    {
+        mInterface.reportCanceled();
+        mInterface.reportFinished();
+    }
+
+    void run() override
+    {
+        // The task may be deleted as soon as it has reported it is finished,
+        // so keep our own reference to the future state
+        QFutureInterface<void> futureInterface(mInterface);
+        if (!futureInterface.isCanceled()) {
+            mFunction(*this);
+        }
+        futureInterface.reportFinished();
+    }
+
+private:
+    Function mFunction;
+    QFutureInterface<void> mInterface;
+};
+
+/**
+ * A QBuffer which stops providing data once its task has been canceled.
+ *
+ * This only saves what reading the rest of the data costs. Decoders do not
+ * all stop at a failed read: the Qt JPEG handler feeds libjpeg a fake end
+ * of image marker, and libjpeg still runs the IDCT and color conversion of
+ * the remaining rows. QImageReader cannot be driven scanline by scanline, so
+ * the result of a canceled decode is only dropped once read() returns.
+ */
+class LoadingTaskBuffer : public QBuffer
+{
+public:
+    LoadingTaskBuffer(QByteArray* data, const LoadingTask& task)
+    : QBuffer(data)
+    , mTask(task)
+    {}
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override
+    {
+        if (mTask.isCanceled()) {
+            return -1;
+        }
+        return QBuffer::readData(data, maxSize);
+    }
+
+private:
+    const LoadingTask& mTask;
+};
+
 struct LoadingDocumentImplPrivate
 {
     LoadingDocumentImpl* q;
     QPointer<KIO::TransferJob> mTransferJob;
-    QFuture<bool> mMetaInfoFuture;
-    QFutureWatcher<bool> mMetaInfoFutureWatcher;
-    QFuture<void> mImageDataFuture;
+    std::unique_ptr<LoadingTask> mMetaInfoTask;
+    QFutureWatcher<void> mMetaInfoFutureWatcher;
+    bool mMetaInfoLoadedOk;
+    std::unique_ptr<LoadingTask> mImageDataTask;
     QFutureWatcher<void> mImageDataFutureWatcher;
 
     // If != 0, this means we need to load an image at zoom =
@@ -96,6 +209,7 @@ struct LoadingDocumentImplPrivate
     bool mMetaInfoLoaded;
     bool mAnimated;
     bool mDownSampledImageLoaded;
+    bool mRegionDecodingSupported;
     QByteArray mFormatHint;
     QByteArray mData;
     QByteArray mFormat;
@@ -104,6 +218,45 @@ struct LoadingDocumentImplPrivate
     std::unique_ptr<JpegContent> mJpegContent;
     QImage mImage;
     Cms::Profile::Ptr mCmsProfile;
+    // Shown with the trace spans, only set when tracing
+    QString mTraceDetail;
+
+    TaskScheduler::TaskClass taskClass() const
+    {
+        return q->document()->loadingPriority() == Document::ViewLoadingPriority
+            ? TaskScheduler::ViewClass
+            : TaskScheduler::PreloadClass;
+    }
+
+    void startTask(std::unique_ptr<LoadingTask>* task, QFutureWatcher<void>* watcher, const LoadingTask::Function& function)
+    {
+        task->reset(new LoadingTask(function));
+        watcher->setFuture((*task)->future());
+        TaskScheduler::instance()->start(task->get(), taskClass());
+    }
+
+    void updateTaskPriority(LoadingTask* task)
+    {
+        if (task && TaskScheduler::instance()->tryTake(task)) {
+            TaskScheduler::instance()->start(task, taskClass());
+        }
+    }
+
+    /**
+     * Drops the task if it has not started yet, otherwise asks it to stop at
+     * its next checkpoint. In both cases its watcher emits finished().
+     */
+    void cancelTask(LoadingTask* task)
+    {
+        if (!task) {
+            return;
+        }
+        if (TaskScheduler::instance()->tryTake(task)) {
+            task->reportTaken();
+        } else {
+            task->cancel();
+        }
+    }
 
     /**
      * Determine kind of document and switch to an implementation if it is not
@@ -112,6 +265,8 @@ struct LoadingDocumentImplPrivate
      */
     bool determineKind()
     {
+        TraceSpan span("load", "kind");
+        span.setDetail(mTraceDetail);
         QString mimeType;
         const QUrl &url = q->document()->url();
         QMimeDatabase db;
@@ -159,8 +314,9 @@ struct LoadingDocumentImplPrivate
             //
             mFormatHint = q->document()->url().fileName()
                 .section(QLatin1Char('.'), -1).toLocal8Bit().toLower();
-            mMetaInfoFuture = QtConcurrent::run(this, &LoadingDocumentImplPrivate::loadMetaInfo);
-            mMetaInfoFutureWatcher.setFuture(mMetaInfoFuture);
+            startTask(&mMetaInfoTask, &mMetaInfoFutureWatcher, [this](const LoadingTask& task) {
+                mMetaInfoLoadedOk = loadMetaInfo(task);
+            });
             break;
 
         case MimeTypeUtils::KIND_SVG_IMAGE:
@@ -181,17 +337,30 @@ struct LoadingDocumentImplPrivate
         LOG("");
         Q_ASSERT(mMetaInfoLoaded);
         Q_ASSERT(mImageDataInvertedZoom != 0);
-        Q_ASSERT(!mImageDataFuture.isRunning());
-        mImageDataFuture = QtConcurrent::run(this, &LoadingDocumentImplPrivate::loadImageData);
-        mImageDataFutureWatcher.setFuture(mImageDataFuture);
+        Q_ASSERT(!mImageDataTask);
+        const int invertedZoom = mImageDataInvertedZoom;
+        mImage = QImage();
+        mAnimated = false;
+        startTask(&mImageDataTask, &mImageDataFutureWatcher, [this, invertedZoom](const LoadingTask& task) {
+            loadImageData(task, invertedZoom);
+        });
     }
 
-    bool loadMetaInfo()
+    bool loadMetaInfo(const LoadingTask& task)
     {
+        TraceSpan span("load", "metaInfo");
+        span.setDetail(mTraceDetail);
         LOG("mFormatHint" << mFormatHint);
+        // Read once, reused for the format, the size and the color profile
+        ImageHeader header;
         QBuffer buffer;
         buffer.setBuffer(&mData);
         buffer.open(QIODevice::ReadOnly);
+        // Parsed once. For raw images this is the raw file, whose metadata is
+        // kept for the preview which replaces mData.
+        Exiv2ImageLoader loader;
+        bool exiv2Parsed = false;
+        bool exiv2Loaded = false;
 
 #ifdef KDCRAW_FOUND
         if (KDcrawIface::KDcraw::rawFilesList().contains(QString::fromLatin1(mFormatHint))) {
@@ -200,18 +369,34 @@ struct LoadingDocumentImplPrivate
             // if the image is in format supported by dcraw, fetch its embedded preview
             mJpegContent.reset(new JpegContent());
 
-            // use KDcraw for getting the embedded preview
-            // KDcraw functionality cloned locally (temp. solution)
-            bool ret = KDcrawIface::KDcraw::loadEmbeddedPreview(previewData, buffer);
-
-            QImage originalImage;
-            if (!ret || !originalImage.loadFromData(previewData) || qMin(originalImage.width(), originalImage.height()) < MIN_PREV_SIZE) {
-                // if the embedded preview loading failed or gets just a small image, load
-                // half preview instead. That's slower but it works even for images containing
-                // small (160x120px) or none embedded preview.
-                if (!KDcrawIface::KDcraw::loadHalfPreview(previewData, buffer)) {
-                    qWarning() << "unable to get half preview for " << q->document()->url().fileName();
-                    return false;
+            // Use the smallest embedded JPEG preview which is large enough.
+            // Sizes come from the metadata, so nothing is decoded here.
+            exiv2Parsed = true;
+            exiv2Loaded = loader.load(mData);
+            if (exiv2Loaded) {
+                const QList<Exiv2ImageLoader::Preview> previews = loader.previews();
+                for (int idx = 0; idx < previews.count() && previewData.isEmpty(); ++idx) {
+                    const Exiv2ImageLoader::Preview& preview = previews.at(idx);
+                    if (preview.mimeType == QLatin1String("image/jpeg")
+                            && qMin(preview.size.width(), preview.size.height()) >= MIN_PREV_SIZE) {
+                        previewData = loader.previewData(idx);
+                    }
+                }
+            }
+
+            if (previewData.isEmpty()) {
+                // Exiv2 does not know about the previews of some formats,
+                // try KDcraw. KDcraw functionality cloned locally (temp. solution)
+                QImage originalImage;
+                bool ret = KDcrawIface::KDcraw::loadEmbeddedPreview(previewData, buffer);
+                if (!ret || !originalImage.loadFromData(previewData) || qMin(originalImage.width(), originalImage.height()) < MIN_PREV_SIZE) {
+                    // if the embedded preview loading failed or gets just a small image, load
+                    // half preview instead. That's slower but it works even for images containing
+                    // small (160x120px) or none embedded preview.
+                    if (!KDcrawIface::KDcraw::loadHalfPreview(previewData, buffer)) {
+                        qWarning() << "unable to get half preview for " << q->document()->url().fileName();
+                        return false;
+                    }
                 }
             }
 
@@ -219,6 +404,7 @@ struct LoadingDocumentImplPrivate
 
             // now it's safe to replace mData with the jpeg data
             mData = previewData;
+            header.load(mData);
 
             // need to fill mFormat so gwenview can tell the type when trying to save
             mFormat = mFormatHint;
@@ -226,39 +412,55 @@ struct LoadingDocumentImplPrivate
 #else
 {
 #endif
-            QImageReader reader(&buffer, mFormatHint);
-            mImageSize = reader.size();
-
-            if (!reader.canRead()) {
-                qWarning() << "QImageReader::read() using format hint" << mFormatHint << "failed:" << reader.errorString();
-                if (buffer.pos() != 0) {
-                    qWarning() << "A bad Qt image decoder moved the buffer to" << buffer.pos() << "in a call to canRead()! Rewinding.";
-                    buffer.seek(0);
-                }
-                reader.setFormat(QByteArray());
-                // Set buffer again, otherwise QImageReader won't restart from scratch
-                reader.setDevice(&buffer);
+            if (header.load(mData) && headerFormatMatchesHint(header.format(), mFormatHint)
+                    && QImageReader::supportedImageFormats().contains(header.format())) {
+                // The header tells us what QImageReader would, without going
+                // through the image plugins. Files whose extension does not
+                // match their content go through QImageReader, which checks
+                // they can be read.
+                mFormat = header.format();
+                mImageSize = header.size();
+            } else {
+                QImageReader reader(&buffer, mFormatHint);
+                mImageSize = reader.size();
+
                 if (!reader.canRead()) {
-                    qWarning() << "QImageReader::read() without format hint failed:" << reader.errorString();
-                    return false;
+                    qWarning() << "QImageReader::read() using format hint" << mFormatHint << "failed:" << reader.errorString();
+                    if (buffer.pos() != 0) {
+                        qWarning() << "A bad Qt image decoder moved the buffer to" << buffer.pos() << "in a call to canRead()! Rewinding.";
+                        buffer.seek(0);
+                    }
+                    reader.setFormat(QByteArray());
+                    // Set buffer again, otherwise QImageReader won't restart from scratch
+                    reader.setDevice(&buffer);
+                    if (!reader.canRead()) {
+                        qWarning() << "QImageReader::read() without format hint failed:" << reader.errorString();
+                        return false;
+                    }
+                    qWarning() << "Image format is actually" << reader.format() << "not" << mFormatHint;
                 }
-                qWarning() << "Image format is actually" << reader.format() << "not" << mFormatHint;
-            }
 
-            mFormat = reader.format();
+                mFormat = reader.format();
 
-            if (mFormat == "jpg") {
-                // if mFormatHint was "jpg", then mFormat is "jpg", but the rest of
-                // Gwenview code assumes JPEG images have "jpeg" format.
-                mFormat = "jpeg";
+                if (mFormat == "jpg") {
+                    // if mFormatHint was "jpg", then mFormat is "jpg", but the rest of
+                    // Gwenview code assumes JPEG images have "jpeg" format.
+                    mFormat = "jpeg";
+                }
             }
         }
 
         LOG("mFormat" << mFormat);
         GV_RETURN_VALUE_IF_FAIL(!mFormat.isEmpty(), false);
 
-        Exiv2ImageLoader loader;
-        if (loader.load(mData)) {
+        if (task.isCanceled()) {
+            return false;
+        }
+
+        if (!exiv2Parsed) {
+            exiv2Loaded = loader.load(mData);
+        }
+        if (exiv2Loaded) {
             mExiv2Image = loader.popImage();
         }
 
@@ -267,7 +469,8 @@ struct LoadingDocumentImplPrivate
         }
 
         if (mJpegContent.get()) {
-            if (!mJpegContent->loadFromData(mData, mExiv2Image.get()) &&
+            const QSize storedSize = header.format() == "jpeg" ? header.size() : QSize();
+            if ((!mExiv2Image.get() || !mJpegContent->loadFromData(mData, mExiv2Image.get(), storedSize)) &&
                 !mJpegContent->loadFromData(mData)) {
                 qWarning() << "Unable to use preview of " << q->document()->url().fileName();
                 return false;
@@ -282,28 +485,44 @@ struct LoadingDocumentImplPrivate
 
         LOG("mImageSize" << mImageSize);
 
+        if (task.isCanceled()) {
+            return false;
+        }
+
         if (!mCmsProfile) {
-            mCmsProfile = Cms::Profile::loadFromImageData(mData, mFormat);
+            if (header.format() == mFormat) {
+                mCmsProfile = Cms::Profile::loadFromIccData(header.iccProfile());
+            } else {
+                mCmsProfile = Cms::Profile::loadFromImageData(mData, mFormat);
+            }
         }
 
+        // Decoded regions are not rotated, and the size of rotated images may
+        // already be transposed, so only decode by region the images which
+        // are stored as they are shown
+        mRegionDecodingSupported = header.format() == mFormat
+            && header.orientation() <= NORMAL
+            && RegionDecoder::isSupported(mData, mFormat, mImageSize);
+
         return true;
     }
 
-    void loadImageData()
+    void loadImageData(const LoadingTask& task, int invertedZoom)
     {
-        QBuffer buffer;
-        buffer.setBuffer(&mData);
+        TraceSpan span("load", "decode");
+        span.setDetail(mTraceDetail);
+        LoadingTaskBuffer buffer(&mData, task);
         buffer.open(QIODevice::ReadOnly);
         QImageReader reader(&buffer, mFormat);
 
-        LOG("mImageDataInvertedZoom=" << mImageDataInvertedZoom);
+        LOG("invertedZoom=" << invertedZoom);
         if (mImageSize.isValid()
-                && mImageDataInvertedZoom != 1
+                && invertedZoom != 1
                 && reader.supportsOption(QImageIOHandler::ScaledSize)
            ) {
             // Do not use mImageSize here: QImageReader needs a non-transposed
             // image size
-            QSize size = reader.size() / mImageDataInvertedZoom;
+            QSize size = reader.size() / invertedZoom;
             if (!size.isEmpty()) {
                 LOG("Setting scaled size to" << size);
                 reader.setScaledSize(size);
@@ -317,6 +536,12 @@ struct LoadingDocumentImplPrivate
         }
 
         bool ok = reader.read(&mImage);
+        if (task.isCanceled()) {
+            // Decoders may return a truncated image when reading fails
+            LOG("Canceled");
+            mImage = QImage();
+            return;
+        }
         if (!ok) {
             LOG("QImageReader::read() failed");
             return;
@@ -356,6 +581,8 @@ LoadingDocumentImpl::LoadingDocumentImpl(Document* document)
     d->mMetaInfoLoaded = false;
     d->mAnimated = false;
     d->mDownSampledImageLoaded = false;
+    d->mRegionDecodingSupported = false;
+    d->mMetaInfoLoadedOk = false;
     d->mImageDataInvertedZoom = 0;
 
     connect(&d->mMetaInfoFutureWatcher, SIGNAL(finished()),
@@ -372,6 +599,10 @@ LoadingDocumentImpl::~LoadingDocumentImpl()
     d->mMetaInfoFutureWatcher.disconnect();
     d->mImageDataFutureWatcher.disconnect();
 
+    // Drop the decodes which have not started. The running ones stop at
+    // their next checkpoint, so waiting for them is short.
+    d->cancelTask(d->mMetaInfoTask.get());
+    d->cancelTask(d->mImageDataTask.get());
     d->mMetaInfoFutureWatcher.waitForFinished();
     d->mImageDataFutureWatcher.waitForFinished();
 
@@ -384,9 +615,14 @@ LoadingDocumentImpl::~LoadingDocumentImpl()
 void LoadingDocumentImpl::init()
 {
     QUrl url = document()->url();
+    if (Tracer::isEnabled()) {
+        d->mTraceDetail = url.toDisplayString();
+    }
 
     if (UrlUtils::urlIsFastLocalFile(url)) {
         // Load file content directly
+        TraceSpan span("load", "read");
+        span.setDetail(d->mTraceDetail);
         QFile file(url.toLocalFile());
         if (!file.open(QIODevice::ReadOnly)) {
             setDocumentErrorString(i18nc("@info", "Could not open file %1", url.toLocalFile()));
@@ -421,16 +657,50 @@ void LoadingDocumentImpl::loadImage(int invertedZoom)
         LOG("Ignoring request: we are loading a full image");
         return;
     }
-    d->mImageDataFutureWatcher.waitForFinished();
     d->mImageDataInvertedZoom = invertedZoom;
 
+    if (d->mImageDataTask) {
+        // Do not wait for the superseded decode: cancel it,
+        // slotImageLoaded() starts the new one once it has stopped
+        LOG("Canceling image loading");
+        d->cancelTask(d->mImageDataTask.get());
+        return;
+    }
+
     if (d->mMetaInfoLoaded) {
-        // Do not test on mMetaInfoFuture.isRunning() here: it might not have
+        // Do not test on mMetaInfoTask here: it might not have
         // started if we are downloading the image from a remote url
         d->startImageDataLoading();
     }
 }
 
+void LoadingDocumentImpl::updateLoadingPriority()
+{
+    d->updateTaskPriority(d->mMetaInfoTask.get());
+    d->updateTaskPriority(d->mImageDataTask.get());
+}
+
+bool LoadingDocumentImpl::cancelPendingImageLoading()
+{
+    if (d->mImageDataTask) {
+        if (!TaskScheduler::instance()->tryTake(d->mImageDataTask.get())) {
+            // Already running
+            return false;
+        }
+        LOG("Dropping image loading which has not started");
+        // Prevents slotImageLoaded() from starting it again
+        d->mImageDataInvertedZoom = 0;
+        d->mImageDataTask->reportTaken();
+        return true;
+    }
+    if (d->mImageDataInvertedZoom != 0 && !d->mMetaInfoLoaded) {
+        LOG("Dropping image loading which waits for meta info");
+        d->mImageDataInvertedZoom = 0;
+        return true;
+    }
+    return false;
+}
+
 void LoadingDocumentImpl::slotDataReceived(KIO::Job* job, const QByteArray& chunk)
 {
     d->mData.append(chunk);
@@ -474,8 +744,9 @@ Document::LoadingState LoadingDocumentImpl::loadingState() const
 void LoadingDocumentImpl::slotMetaInfoLoaded()
 {
     LOG("");
-    Q_ASSERT(!d->mMetaInfoFuture.isRunning());
-    if (!d->mMetaInfoFuture.result()) {
+    GV_RETURN_IF_FAIL(d->mMetaInfoTask);
+    d->mMetaInfoTask.reset();
+    if (!d->mMetaInfoLoadedOk) {
         setDocumentErrorString(
             i18nc("@info", "Loading meta information failed.")
         );
@@ -488,14 +759,17 @@ void LoadingDocumentImpl::slotMetaInfoLoaded()
     setDocumentImageSize(d->mImageSize);
     setDocumentExiv2Image(d->mExiv2Image);
     setDocumentCmsProfile(d->mCmsProfile);
+    if (d->mRegionDecodingSupported) {
+        setDocumentRegionDecoder(new RegionDecoder(d->mData, d->mFormat, d->mImageSize));
+    }
 
     d->mMetaInfoLoaded = true;
     emit metaInfoLoaded();
 
     // Start image loading if necessary
-    // We test if mImageDataFuture is not already running because code connected to
+    // We test if mImageDataTask is not already running because code connected to
     // metaInfoLoaded() signal could have called loadImage()
-    if (!d->mImageDataFuture.isRunning() && d->mImageDataInvertedZoom != 0) {
+    if (!d->mImageDataTask && d->mImageDataInvertedZoom != 0) {
         d->startImageDataLoading();
     }
 }
@@ -503,6 +777,17 @@ void LoadingDocumentImpl::slotMetaInfoLoaded()
 void LoadingDocumentImpl::slotImageLoaded()
 {
     LOG("");
+    GV_RETURN_IF_FAIL(d->mImageDataTask);
+    const bool canceled = d->mImageDataTask->isCanceled();
+    d->mImageDataTask.reset();
+    if (canceled) {
+        if (d->mImageDataInvertedZoom != 0) {
+            LOG("Superseded, loading again with invertedZoom=" << d->mImageDataInvertedZoom);
+            d->startImageDataLoading();
+        }
+        return;
+    }
+
     if (d->mImage.isNull()) {
         setDocumentErrorString(
             i18nc("@info", "Loading image failed.")
@@ -51,6 +51,18 @@ public:
 
     void loadImage(int invertedZoom);
 
+    /**
+     * Applies Document::loadingPriority() to the decodes which have not
+     * started yet
+     */
+    void updateLoadingPriority();
+
+    /**
+     * Drops the image decoding if it has not started yet. Returns true if
+     * it has been dropped.
+     */
+    bool cancelPendingImageLoading();
+
 private Q_SLOTS:
     void slotMetaInfoLoaded();
     void slotImageLoaded();
@@ -46,6 +46,12 @@ void LoadingJob::doStart()
     }
 }
 
+bool LoadingJob::doKill()
+{
+    // Only waits for the document, there is nothing to stop
+    return true;
+}
+
 void LoadingJob::slotLoaded()
 {
     setError(NoError);
@@ -36,6 +36,7 @@ class LoadingJob : public DocumentJob
     Q_OBJECT
 protected:
     void doStart() override;
+    bool doKill() override;
 
 private Q_SLOTS:
     void slotLoaded();
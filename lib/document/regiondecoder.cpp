@@ -0,0 +1,285 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "regiondecoder.h"
+
+// STL
+#include <cstring>
+
+// Qt
+#include <QBuffer>
+#include <QCache>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QImageReader>
+#include <QVector>
+
+// Local
+#include <lib/gvdebug.h>
+#include <lib/memoryregistry.h>
+#include <lib/taskscheduler.h>
+#include <lib/tracer.h>
+
+namespace Gwenview
+{
+
+static const int TILE_SIZE = 512;
+
+// Smaller images are decoded at once
+static const qint64 MIN_PIXEL_COUNT = 64 * 1024 * 1024;
+
+static const int CACHE_BUDGET_KB = 256 * 1024;
+
+static quint64 keyForTile(const QPoint& tile)
+{
+    return (quint64(tile.x()) << 32) | quint32(tile.y());
+}
+
+struct RegionDecoderResult
+{
+    QVector<QPoint> mTiles;
+    QVector<QImage> mImages;
+    bool mOk = true;
+};
+
+static QRect rectForTile(const QPoint& tile, const QSize& size)
+{
+    return QRect(tile * TILE_SIZE, QSize(TILE_SIZE, TILE_SIZE)) & QRect(QPoint(0, 0), size);
+}
+
+static QVector<QPoint> tilesForRect(const QRect& rect)
+{
+    QVector<QPoint> tiles;
+    if (rect.isEmpty()) {
+        return tiles;
+    }
+    for (int y = rect.top() / TILE_SIZE; y <= rect.bottom() / TILE_SIZE; ++y) {
+        for (int x = rect.left() / TILE_SIZE; x <= rect.right() / TILE_SIZE; ++x) {
+            tiles << QPoint(x, y);
+        }
+    }
+    return tiles;
+}
+
+/**
+ * Decodes tiles in a single pass: decoders read the image from its first
+ * scanline whatever the clip rect is, so decoding each row of tiles on its
+ * own would read the top of the image again for every row. All the tiles of
+ * the bounding rect are returned, including those which were not asked for:
+ * they cost nothing more and panning may need them.
+ */
+static RegionDecoderResult decodeTiles(const QByteArray& data, const QByteArray& format, const QSize& size, const QVector<QPoint>& tiles)
+{
+    GV_TRACE("load", "decodeRegion");
+    RegionDecoderResult result;
+
+    QRect clipRect;
+    for (const QPoint& tile : tiles) {
+        clipRect |= rectForTile(tile, size);
+    }
+
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, format);
+    reader.setClipRect(clipRect);
+    QImage image;
+    if (!reader.read(&image)) {
+        qWarning() << "Could not decode" << clipRect << ":" << reader.errorString();
+        result.mOk = false;
+        return result;
+    }
+    if (image.depth() < 8) {
+        image = image.convertToFormat(QImage::Format_ARGB32);
+    }
+    for (const QPoint& tile : tilesForRect(clipRect)) {
+        result.mTiles << tile;
+        result.mImages << image.copy(rectForTile(tile, size).translated(-clipRect.topLeft()));
+    }
+    return result;
+}
+
+struct RegionDecoderPrivate
+{
+    RegionDecoder* q;
+    QByteArray mData;
+    QByteArray mFormat;
+    QSize mSize;
+    bool mFailed;
+    QCache<quint64, QImage> mTiles;
+    // Tiles needed to show what has been asked for
+    QVector<QPoint> mWantedTiles;
+    // Tiles around them
+    QVector<QPoint> mPrefetchTiles;
+    QFutureWatcher<RegionDecoderResult> mWatcher;
+
+    QVector<QPoint> missingTiles(const QVector<QPoint>& tiles) const
+    {
+        QVector<QPoint> missing;
+        for (const QPoint& tile : tiles) {
+            if (!mTiles.contains(keyForTile(tile))) {
+                missing << tile;
+            }
+        }
+        return missing;
+    }
+
+    void startNextDecode()
+    {
+        if (mFailed || mWatcher.isRunning()) {
+            return;
+        }
+        TaskScheduler::TaskClass taskClass = TaskScheduler::ViewClass;
+        QVector<QPoint> tiles = missingTiles(mWantedTiles);
+        mWantedTiles.clear();
+        if (tiles.isEmpty()) {
+            taskClass = TaskScheduler::PreloadClass;
+            tiles = missingTiles(mPrefetchTiles);
+            mPrefetchTiles.clear();
+        }
+        if (tiles.isEmpty()) {
+            return;
+        }
+        GV_TRACE_EVENT("load", "requestTiles", QStringLiteral("%1 tiles").arg(tiles.count()));
+        const QByteArray data = mData;
+        const QByteArray format = mFormat;
+        const QSize size = mSize;
+        mWatcher.setFuture(TaskScheduler::instance()->run(taskClass, [data, format, size, tiles]() {
+            return decodeTiles(data, format, size, tiles);
+        }));
+    }
+
+    void storeResult()
+    {
+        const RegionDecoderResult result = mWatcher.result();
+        if (!result.mOk) {
+            mFailed = true;
+            return;
+        }
+        for (int idx = 0; idx < result.mTiles.count(); ++idx) {
+            const QImage& image = result.mImages.at(idx);
+            mTiles.insert(keyForTile(result.mTiles.at(idx)), new QImage(image), qMax(1, image.byteCount() / 1024));
+        }
+    }
+};
+
+RegionDecoder::RegionDecoder(const QByteArray& data, const QByteArray& format, const QSize& size)
+: d(new RegionDecoderPrivate)
+{
+    d->q = this;
+    d->mData = data;
+    d->mFormat = format;
+    d->mSize = size;
+    d->mFailed = false;
+    d->mTiles.setMaxCost(CACHE_BUDGET_KB);
+
+    // Do not wait for a running decode when we are deleted: it only works on
+    // copies and its result is dropped with mWatcher
+    connect(&d->mWatcher, &QFutureWatcher<RegionDecoderResult>::finished, this, [this]() {
+        d->storeResult();
+        d->startNextDecode();
+        emit regionReady();
+    });
+    connect(MemoryRegistry::instance(), &MemoryRegistry::memoryPressure, this, [this]() {
+        d->mTiles.clear();
+    });
+}
+
+RegionDecoder::~RegionDecoder()
+{
+    delete d;
+}
+
+bool RegionDecoder::isSupported(const QByteArray& data, const QByteArray& format, const QSize& size)
+{
+    if (qint64(size.width()) * size.height() < MIN_PIXEL_COUNT) {
+        return false;
+    }
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, format);
+    // QImageReader emulates clip rects for the decoders which do not support
+    // them, by decoding the whole image
+    return reader.supportsOption(QImageIOHandler::ClipRect);
+}
+
+bool RegionDecoder::prepareRegion(const QRect& rect)
+{
+    const QRect imageRect(QPoint(0, 0), d->mSize);
+    const QVector<QPoint> missing = d->missingTiles(tilesForRect(rect & imageRect));
+
+    for (const QPoint& tile : missing) {
+        if (!d->mWantedTiles.contains(tile)) {
+            d->mWantedTiles << tile;
+        }
+    }
+    // Only prefetch around the last request: the previous ones were for
+    // what was visible before
+    d->mPrefetchTiles.clear();
+    for (const QPoint& tile : tilesForRect(rect.adjusted(-TILE_SIZE, -TILE_SIZE, TILE_SIZE, TILE_SIZE) & imageRect)) {
+        if (!d->mTiles.contains(keyForTile(tile)) && !missing.contains(tile)) {
+            d->mPrefetchTiles << tile;
+        }
+    }
+    d->startNextDecode();
+    return missing.isEmpty();
+}
+
+QImage RegionDecoder::region(const QRect& rect)
+{
+    GV_RETURN_VALUE_IF_FAIL(QRect(QPoint(0, 0), d->mSize).contains(rect), QImage());
+    QImage result;
+    for (const QPoint& tile : tilesForRect(rect)) {
+        const QImage* image = d->mTiles.object(keyForTile(tile));
+        if (!image) {
+            return QImage();
+        }
+        const QRect tileRect = rectForTile(tile, d->mSize);
+        if (tileRect.contains(rect)) {
+            return image->copy(rect.translated(-tileRect.topLeft()));
+        }
+        if (result.isNull()) {
+            result = QImage(rect.size(), image->format());
+            result.setColorTable(image->colorTable());
+        }
+        const QRect part = tileRect & rect;
+        const int bytesPerPixel = image->depth() / 8;
+        for (int y = part.top(); y <= part.bottom(); ++y) {
+            std::memcpy(result.scanLine(y - rect.top()) + (part.left() - rect.left()) * bytesPerPixel,
+                        image->constScanLine(y - tileRect.top()) + (part.left() - tileRect.left()) * bytesPerPixel,
+                        part.width() * bytesPerPixel);
+        }
+    }
+    return result;
+}
+
+bool RegionDecoder::hasFailed() const
+{
+    return d->mFailed;
+}
+
+qint64 RegionDecoder::memoryUsage() const
+{
+    return qint64(d->mTiles.totalCost()) * 1024;
+}
+
+} // namespace
@@ -0,0 +1,86 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef REGIONDECODER_H
+#define REGIONDECODER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QImage>
+#include <QObject>
+
+namespace Gwenview
+{
+
+struct RegionDecoderPrivate;
+
+/**
+ * Decodes parts of an image at full resolution, for images too big to be
+ * decoded at once. Decoded tiles are kept in a cache of limited size, the
+ * tiles around the requested ones are fetched as well so that panning finds
+ * them ready.
+ *
+ * The image orientation is not applied.
+ */
+class GWENVIEWLIB_EXPORT RegionDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    RegionDecoder(const QByteArray& data, const QByteArray& format, const QSize& size);
+    ~RegionDecoder() override;
+
+    /**
+     * Returns true if @p data is big enough to be worth decoding by region,
+     * and if the decoder of @p format can decode a region without decoding
+     * the whole image.
+     */
+    static bool isSupported(const QByteArray& data, const QByteArray& format, const QSize& size);
+
+    /**
+     * Returns true if the tiles covering @p rect are decoded. If they are not,
+     * decodes them, along with the tiles of the previous calls which are
+     * still missing, and emits regionReady() when done.
+     */
+    bool prepareRegion(const QRect& rect);
+
+    /**
+     * Returns @p rect of the image, or a null image if some of its tiles are
+     * not decoded
+     */
+    QImage region(const QRect& rect);
+
+    /**
+     * True if decoding failed: the whole image must be loaded instead
+     */
+    bool hasFailed() const;
+
+    qint64 memoryUsage() const;
+
+Q_SIGNALS:
+    void regionReady();
+
+private:
+    RegionDecoderPrivate* const d;
+};
+
+} // namespace
+
+#endif /* REGIONDECODER_H */
@@ -25,7 +25,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QScopedPointer>
-#include <QtConcurrentRun>
 #include <QUrl>
 #include <QApplication>
 #include <QTemporaryFile>
@@ -39,6 +38,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Local
 #include "documentloadedimpl.h"
+#include "taskscheduler.h"
+#include "tracer.h"
 
 namespace Gwenview
 {
@@ -74,6 +75,7 @@ SaveJob::~SaveJob()
 
 void SaveJob::saveInternal()
 {
+    GV_TRACE("save", "encode");
     if (!d->mImpl->saveInternal(d->mSaveFile.data(), d->mFormat)) {
         d->mSaveFile->cancelWriting();
         setError(UserDefinedError + 2);
@@ -112,7 +114,9 @@ void SaveJob::doStart()
         return;
     }
 
-    QFuture<void> future = QtConcurrent::run(this, &SaveJob::saveInternal);
+    QFuture<void> future = TaskScheduler::instance()->run(TaskScheduler::BackgroundClass, [this]() {
+        saveInternal();
+    });
     d->mInternalSaveWatcher.reset(new QFutureWatcher<void>(this));
     connect(d->mInternalSaveWatcher.data(), SIGNAL(finished()), SLOT(finishSave()));
     d->mInternalSaveWatcher->setFuture(future);
@@ -517,9 +517,14 @@ void DocumentView::openUrl(const QUrl &url, const DocumentView::Setup& setup)
             return;
         }
         disconnect(d->mDocument.data(), nullptr, this, nullptr);
+        // Let the decoding of the document we are showing now go first, and
+        // do not decode the one we leave if it has not started yet
+        d->mDocument->setLoadingPriority(Document::PreloadLoadingPriority);
+        d->mDocument->cancelPendingImageLoading();
     }
     d->mSetup = setup;
     d->mDocument = DocumentFactory::instance()->load(url);
+    d->mDocument->setLoadingPriority(Document::ViewLoadingPriority);
     connect(d->mDocument.data(), SIGNAL(busyChanged(QUrl,bool)), SLOT(slotBusyChanged(QUrl,bool)));
     connect(d->mDocument.data(), &Document::modified, this, [this]() {
         d->updateZoomSnapValues();
@@ -31,15 +31,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Qt
 #include <QGLWidget>
+#include <QGraphicsPixmapItem>
 #include <QGraphicsScene>
+#include <QPointer>
 #include <QPropertyAnimation>
 #include <QTimer>
+#include <QVariantAnimation>
 #include <QDebug>
 #include <QtMath>
 
 namespace Gwenview
 {
 
+// Above the views, which are at 0, and the view being replaced, at -1
+static const qreal CROSS_FADE_Z_VALUE = 1;
+
 typedef QSet<DocumentView*> DocumentViewSet;
 typedef QHash<QUrl, DocumentView::Setup> SetupForUrl;
 
@@ -53,6 +59,12 @@ struct DocumentViewContainerPrivate
     DocumentViewSet mRemovedViews;
     QTimer* mLayoutUpdateTimer;
 
+    // Software cross fade: a snapshot of what was displayed before the new
+    // view, drawn over it with a decreasing opacity
+    QGraphicsPixmapItem* mCrossFadeItem;
+    QPointer<QVariantAnimation> mCrossFadeAnimation;
+    QPointer<DocumentView> mCrossFadeView;
+
     void scheduleLayoutUpdate()
     {
         mLayoutUpdateTimer->start();
@@ -86,6 +98,7 @@ DocumentViewContainer::DocumentViewContainer(QWidget* parent)
 , d(new DocumentViewContainerPrivate)
 {
     d->q = this;
+    d->mCrossFadeItem = nullptr;
     d->mScene = new QGraphicsScene(this);
     if (GwenviewConfig::animationMethod() == DocumentView::GLAnimation) {
         QGLWidget* glWidget = new QGLWidget;
@@ -147,6 +160,7 @@ void DocumentViewContainer::updateSetup(DocumentView* view)
 
 void DocumentViewContainer::reset()
 {
+    finishCrossFade();
     d->resetSet(&d->mViews);
     d->resetSet(&d->mAddedViews);
     d->resetSet(&d->mRemovedViews);
@@ -160,6 +174,8 @@ void DocumentViewContainer::showEvent(QShowEvent* event)
 
 void DocumentViewContainer::resizeEvent(QResizeEvent* event)
 {
+    // The snapshot no longer matches the views
+    finishCrossFade();
     QWidget::resizeEvent(event);
     d->mScene->setSceneRect(rect());
     updateLayout();
@@ -184,14 +200,46 @@ void DocumentViewContainer::updateLayout()
     if (animated && crossFade) {
         DocumentView* oldView = *d->mRemovedViews.begin();
         DocumentView* newView = *d->mAddedViews.begin();
+        d->mRemovedViews.clear();
 
         newView->setGeometry(rect());
-        QPropertyAnimation* anim = newView->fadeIn();
 
-        oldView->setZValue(-1);
-        connect(anim, &QPropertyAnimation::finished, oldView, &DocumentView::hideAndDeleteLater);
-        d->mRemovedViews.clear();
+        if (qobject_cast<QGLWidget*>(viewport())) {
+            QPropertyAnimation* anim = newView->fadeIn();
+            oldView->setZValue(-1);
+            connect(anim, &QPropertyAnimation::finished, oldView, &DocumentView::hideAndDeleteLater);
+            return;
+        }
 
+        // Without OpenGL, the opacity effect of the new view renders it
+        // offscreen and blends it at each frame. Instead, take a snapshot of
+        // what is displayed once, and draw it over the new view with a
+        // decreasing opacity: the raster engine blends a pixmap with a
+        // constant alpha using SIMD code. The new view is still transparent,
+        // and an unfinished cross fade is part of the snapshot, so there is
+        // no jump.
+        const QPixmap snapshot = viewport()->grab();
+        finishCrossFade();
+
+        oldView->hideAndDeleteLater();
+        newView->setGraphicsEffectOpacity(1);
+        d->mCrossFadeView = newView;
+        d->mCrossFadeItem = d->mScene->addPixmap(snapshot);
+        d->mCrossFadeItem->setZValue(CROSS_FADE_Z_VALUE);
+        d->mCrossFadeItem->setAcceptedMouseButtons(Qt::NoButton);
+
+        QVariantAnimation* anim = new QVariantAnimation(this);
+        anim->setStartValue(qreal(1));
+        anim->setEndValue(qreal(0));
+        anim->setDuration(DocumentView::AnimDuration);
+        connect(anim, &QVariantAnimation::valueChanged, this, [this](const QVariant& value) {
+            if (d->mCrossFadeItem) {
+                d->mCrossFadeItem->setOpacity(value.toReal());
+            }
+        });
+        connect(anim, &QVariantAnimation::finished, this, &DocumentViewContainer::finishCrossFade);
+        d->mCrossFadeAnimation = anim;
+        anim->start(QAbstractAnimation::DeleteWhenStopped);
         return;
     }
 
@@ -302,6 +350,20 @@ void DocumentViewContainer::slotFadeInFinished(DocumentView* view)
     d->mViews.insert(view);
 }
 
+void DocumentViewContainer::finishCrossFade()
+{
+    if (d->mCrossFadeAnimation) {
+        // Does nothing if called because the animation finished
+        d->mCrossFadeAnimation->stop();
+    }
+    delete d->mCrossFadeItem;
+    d->mCrossFadeItem = nullptr;
+    if (d->mCrossFadeView) {
+        slotFadeInFinished(d->mCrossFadeView);
+        d->mCrossFadeView = nullptr;
+    }
+}
+
 void DocumentViewContainer::slotConfigChanged()
 {
     bool currentlyGL = qobject_cast<QGLWidget*>(viewport());
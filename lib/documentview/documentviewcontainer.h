@@ -97,6 +97,7 @@ private Q_SLOTS:
     void slotFadeInFinished(DocumentView*);
     void pretendFadeInFinished();
     void slotConfigChanged();
+    void finishCrossFade();
 };
 
 } // namespace
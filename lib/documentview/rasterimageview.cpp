@@ -23,13 +23,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Local
 #include <lib/documentview/abstractrasterimageviewtool.h>
+#include <lib/documentview/zoombuffercache.h>
 #include <lib/imagescaler.h>
+#include <lib/thumbnailprovider/thumbnailprovider.h>
+#include <lib/cms/cmsdisplaytransform.h>
+#include <lib/cms/cmsmonitorprofilewatcher.h>
 #include <lib/cms/cmsprofile.h>
 #include <lib/gvdebug.h>
+#include <lib/memoryregistry.h>
+#include <lib/taskscheduler.h>
+#include <lib/tracer.h>
 
 // KDE
 
 // Qt
+#include <QFutureWatcher>
 #include <QGraphicsSceneMouseEvent>
 #include <QPainter>
 #include <QTimer>
@@ -40,6 +48,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 namespace Gwenview
 {
 
+// Number of zoom to fit images to keep, so that toggling full screen does not
+// need to scale again
+static const int MAX_FIT_IMAGES = 2;
+
+// Number of buffers rendered at other zoom levels to keep
+static const int MAX_CACHED_BUFFERS = 4;
+
 struct RasterImageViewPrivate
 {
     RasterImageView* q;
@@ -51,6 +66,7 @@ struct RasterImageViewPrivate
     QColor mAlphaBackgroundColor;
     cmsUInt32Number mRenderingIntent;
     bool mEnlargeSmallerImages;
+    ScalingQuality::Enum mScalingQuality;
     // /Config
 
     bool mBufferIsEmpty;
@@ -60,52 +76,291 @@ struct RasterImageViewPrivate
     // QPixmap every time the image is scrolled.
     QPixmap mAlternateBuffer;
 
+    // What mCurrentBuffer contains scaled pixels for, in zoomed image
+    // coordinates, and the zoom and scroll position it has been rendered at.
+    // Used to reuse the buffer when zooming.
+    QRegion mRenderedRegion;
+    qreal mBufferZoom;
+    QPoint mBufferScrollPos;
+
+    // Buffers rendered at other zoom levels, so that zooming back is nearly
+    // free
+    ZoomBufferCache mCachedBuffers{MAX_CACHED_BUFFERS};
+
+    // Upscaled cached thumbnail, painted below the buffer until the scaler
+    // produces real pixels
+    QPixmap mPlaceholder;
+    QFutureWatcher<QImage>* mPlaceholderWatcher;
+
     QTimer* mUpdateTimer;
 
+    // In zoom to fit mode, the whole image scaled to the viewport. Computed
+    // on a worker thread while the view is being resized, so that the buffer
+    // does not need to be stretched until mUpdateTimer fires. Display
+    // transform is not applied.
+    QList<QImage> mFitImages;
+    QFutureWatcher<QImage>* mFitImageWatcher;
+
     QPointer<AbstractRasterImageViewTool> mTool;
 
     bool mApplyDisplayTransform; // Defaults to true. Can be set to false if there is no need or no way to apply color profile
-    cmsHTRANSFORM mDisplayTransform;
+    Cms::DisplayTransform::Ptr mDisplayTransform;
 
     void updateDisplayTransform(QImage::Format format)
     {
         GV_RETURN_IF_FAIL(format != QImage::Format_Invalid);
-        mApplyDisplayTransform = false;
-        if (mDisplayTransform) {
-            cmsDeleteTransform(mDisplayTransform);
-        }
-        mDisplayTransform = nullptr;
-
         Cms::Profile::Ptr profile = q->document()->cmsProfile();
         if (!profile) {
             // The assumption that something unmarked is *probably* sRGB is better than failing to apply any transform when one
             // has a wide-gamut screen.
             profile = Cms::Profile::getSRgbProfile();
         }
-        Cms::Profile::Ptr monitorProfile = Cms::Profile::getMonitorProfile();
-        if (!monitorProfile) {
-            qWarning() << "Could not get monitor color profile";
+        // Transforms are cached, this does not recreate one for each scaled rect
+        mDisplayTransform = Cms::DisplayTransform::get(profile, mRenderingIntent, format);
+        mApplyDisplayTransform = bool(mDisplayTransform);
+    }
+
+    void setupPlaceholderWatcher()
+    {
+        mPlaceholderWatcher = new QFutureWatcher<QImage>(q);
+        QObject::connect(mPlaceholderWatcher, &QFutureWatcher<QImage>::finished, q, [this]() {
+            if (!mPlaceholderWatcher->isCanceled()) {
+                showPlaceholder(mPlaceholderWatcher->result());
+            }
+        });
+    }
+
+    void loadPlaceholder()
+    {
+        // Reading the thumbnail means reading and decoding a PNG file, do it
+        // in a worker thread
+        const QUrl url = q->document()->url();
+        mPlaceholderWatcher->setFuture(TaskScheduler::instance()->run(TaskScheduler::ViewClass, [url]() {
+            return ThumbnailProvider::cachedThumbnail(url);
+        }));
+    }
+
+    void cancelPlaceholder()
+    {
+        mPlaceholderWatcher->cancel();
+        mPlaceholder = QPixmap();
+    }
+
+    void showPlaceholder(const QImage& image)
+    {
+        if (!q->document() || isViewportRendered()) {
+            return;
+        }
+        const QSize documentSize = q->document()->size();
+        if (image.isNull() || image.width() >= documentSize.width()) {
+            // Nothing to gain if the thumbnail is not smaller than the image
+            return;
+        }
+        // Do not show a thumbnail which does not match the image orientation
+        const qreal documentRatio = qreal(documentSize.width()) / documentSize.height();
+        const qreal imageRatio = qreal(image.width()) / image.height();
+        if (qAbs(documentRatio - imageRatio) > documentRatio * 0.05) {
             return;
         }
+        mPlaceholder = QPixmap::fromImage(image);
+        q->update();
+    }
+
+    /**
+     * Returns true if the scaler has rendered all of the image which is
+     * visible in the buffer
+     */
+    bool isViewportRendered() const
+    {
+        const QRect imageRect(QPoint(0, 0), (q->documentSize() * q->zoom()).toSize());
+        return !mBufferIsEmpty && (QRegion(bufferRect() & imageRect) - mRenderedRegion).isEmpty();
+    }
 
-        cmsUInt32Number cmsFormat = 0;
-        switch (format) {
-        case QImage::Format_RGB32:
-        case QImage::Format_ARGB32:
-            cmsFormat = TYPE_BGRA_8;
-            break;
-        case QImage::Format_Grayscale8:
-            cmsFormat = TYPE_GRAY_8;
-            break;
-        default:
-            qWarning() << "Gwenview can only apply color profile on RGB32 or ARGB32 images";
+    QSize fitImageSize() const
+    {
+        return (q->documentSize() * q->zoom()).toSize();
+    }
+
+    void setupFitImageWatcher()
+    {
+        mFitImageWatcher = new QFutureWatcher<QImage>(q);
+        QObject::connect(mFitImageWatcher, &QFutureWatcher<QImage>::finished, q, [this]() {
+            if (!mFitImageWatcher->isCanceled()) {
+                const QImage image = mFitImageWatcher->result();
+                mFitImages.prepend(image);
+                while (mFitImages.count() > MAX_FIT_IMAGES) {
+                    mFitImages.removeLast();
+                }
+                if (image.size() != fitImageSize() && q->zoomToFit() && mUpdateTimer->isActive()) {
+                    // The view has been resized again, this is still closer
+                    // to the final result than the stretched buffer
+                    showFitImage(image);
+                }
+            }
+            updateFitImage();
+        });
+    }
+
+    QRect bufferRect() const
+    {
+        return QRect(q->scrollPos().toPoint(), mCurrentBuffer.size());
+    }
+
+    void clearCachedBuffers()
+    {
+        mCachedBuffers.clear();
+        mRenderedRegion = QRegion();
+        mBufferZoom = 0;
+    }
+
+    /**
+     * Called when the zoom changes: draws the buffer rendered at the previous
+     * zoom, scaled, and what has been rendered at the new zoom before. Only
+     * what is still missing is then scaled.
+     */
+    void zoomBuffer()
+    {
+        const qreal zoom = q->zoom();
+        const QPoint scrollPos = q->scrollPos().toPoint();
+        mCachedBuffers.store(mBufferZoom, mBufferScrollPos, mCurrentBuffer, mRenderedRegion);
+
+        const QSize size = q->visibleImageSize().toSize();
+        if (!size.isValid()) {
+            mCurrentBuffer = QPixmap();
+            mRenderedRegion = QRegion();
             return;
         }
+        QPixmap buffer(size);
+        buffer.fill(Qt::transparent);
+        {
+            QPainter painter(&buffer);
+            const qreal ratio = zoom / mBufferZoom;
+            const QRectF target(QPointF(mBufferScrollPos) * ratio - QPointF(scrollPos),
+                                QSizeF(mCurrentBuffer.size()) * ratio);
+            painter.drawPixmap(target, mCurrentBuffer, QRectF(mCurrentBuffer.rect()));
+
+            mRenderedRegion = mCachedBuffers.restore(zoom, QRect(scrollPos, size), &painter);
+        }
+        mCurrentBuffer = buffer;
+
+        const QRegion missingRegion = QRegion(QRect(scrollPos, size)) - mRenderedRegion;
+        if (!missingRegion.isEmpty()) {
+            mScaler->setDestinationRegion(missingRegion);
+        }
+    }
 
-        mDisplayTransform = cmsCreateTransform(profile->handle(), cmsFormat,
-                                               monitorProfile->handle(), cmsFormat,
-                                               mRenderingIntent, cmsFLAGS_BLACKPOINTCOMPENSATION);
-        mApplyDisplayTransform = true;
+    void setupMemoryRegistry()
+    {
+        MemoryRegistry* registry = MemoryRegistry::instance();
+        registry->addCache(QStringLiteral("Image view zoom buffers"), [this](MemoryRegistry::CacheUsage* usage) {
+            usage->bytes = mCachedBuffers.byteCount();
+            usage->entries = mCachedBuffers.count();
+        }, q);
+        registry->addCache(QStringLiteral("Image view fit images"), [this](MemoryRegistry::CacheUsage* usage) {
+            for (const QImage& image : qAsConst(mFitImages)) {
+                usage->bytes += image.byteCount();
+            }
+            usage->entries = mFitImages.count();
+        }, q);
+        QObject::connect(registry, &MemoryRegistry::memoryPressure, q, [this]() {
+            mCachedBuffers.clear();
+            mFitImages.clear();
+        });
+    }
+
+    void clearFitImages()
+    {
+        mFitImages.clear();
+        mFitImageWatcher->cancel();
+    }
+
+    /**
+     * Shows the zoom to fit image for the current size, starting its
+     * computation if it is not available
+     */
+    void updateFitImage()
+    {
+        if (!q->document() || !q->zoomToFit()) {
+            return;
+        }
+        const qreal zoom = q->zoom();
+        const QSize size = fitImageSize();
+        if (size.isEmpty() || zoom >= 1.) {
+            return;
+        }
+        for (const QImage& image : qAsConst(mFitImages)) {
+            if (image.size() == size) {
+                showFitImage(image);
+                return;
+            }
+        }
+        if (mFitImageWatcher->isRunning()) {
+            // We are called again when it finishes
+            return;
+        }
+
+        // Start from the nearest down sampled image which is ready. Scaling
+        // the full image of a big document would keep a worker busy for
+        // longer than the update timer delay: if no down sampled image is
+        // ready, keep showing the stretched buffer until the scaler runs.
+        const QImage source = q->document()->readyImageForZoom(zoom);
+        if (source.isNull()) {
+            return;
+        }
+        const ImageResampler::Filter filter = ImageScaler::filterForZoom(mScalingQuality, zoom);
+        mFitImageWatcher->setFuture(TaskScheduler::instance()->run(TaskScheduler::ViewClass, [source, size, filter]() {
+            GV_TRACE("scale", "fitImage");
+            return ImageResampler::scale(source, source.rect(), size, filter);
+        }));
+    }
+
+    void showFitImage(const QImage& fitImage)
+    {
+        // Do not let the display transform modify the cached image
+        QImage image = fitImage;
+        QPixmap buffer(image.size());
+        buffer.fill(Qt::transparent);
+        {
+            QPainter painter(&buffer);
+            drawImage(&painter, QPoint(0, 0), QPoint(0, 0), &image);
+        }
+        mCurrentBuffer = buffer;
+        mBufferIsEmpty = false;
+        cancelPlaceholder();
+        mRenderedRegion = QRegion();
+        if (image.size() == fitImageSize()) {
+            // As good as what the scaler would produce, no need to wait for it
+            mUpdateTimer->stop();
+            mRenderedRegion = QRect(q->scrollPos().toPoint(), image.size());
+            mBufferZoom = q->zoom();
+            mBufferScrollPos = q->scrollPos().toPoint();
+        }
+        q->update();
+    }
+
+    /**
+     * Draws the scaled @p image, applying the display transform to it
+     */
+    void drawImage(QPainter* painter, const QPoint& viewportPos, const QPoint& zoomedImagePos, QImage* image)
+    {
+        if (mApplyDisplayTransform) {
+            updateDisplayTransform(image->format());
+            if (mDisplayTransform) {
+                mDisplayTransform->apply(image);
+            }
+        }
+
+        painter->setCompositionMode(QPainter::CompositionMode_Source);
+        if (q->document()->hasAlphaChannel()) {
+            drawAlphaBackground(
+                painter, QRect(viewportPos, image->size()),
+                zoomedImagePos,
+                q->alphaBackgroundTexture()
+            );
+            // This is required so transparent pixels don't replace our background
+            painter->setCompositionMode(QPainter::CompositionMode_SourceOver);
+        }
+        painter->drawImage(viewportPos, *image);
     }
 
     void setupUpdateTimer()
@@ -137,6 +392,16 @@ struct RasterImageViewPrivate
         mScaler->setDestinationRegion(QRegion(rect.toRect()));
     }
 
+    void setScalerRegionToImageRect(const QRect& imageRect)
+    {
+        const QRect zoomedRect = ZoomBufferCache::zoomedRect(imageRect, q->zoom());
+        const QRect visibleRect = mapViewportToZoomedImage(q->boundingRect()).toRect();
+        const QRect rect = zoomedRect & visibleRect;
+        if (!rect.isEmpty()) {
+            mScaler->setDestinationRegion(QRegion(rect));
+        }
+    }
+
     void resizeBuffer()
     {
         QSize size = q->visibleImageSize().toSize();
@@ -146,6 +411,7 @@ struct RasterImageViewPrivate
         if (!size.isValid()) {
             mAlternateBuffer = QPixmap();
             mCurrentBuffer = QPixmap();
+            mRenderedRegion = QRegion();
             return;
         }
 
@@ -158,6 +424,7 @@ struct RasterImageViewPrivate
         qSwap(mAlternateBuffer, mCurrentBuffer);
 
         mAlternateBuffer = QPixmap();
+        mRenderedRegion &= bufferRect();
     }
 
     void drawAlphaBackground(QPainter* painter, const QRect& viewportRect, const QPoint& zoomedImageTopLeft, QPixmap texture)
@@ -193,18 +460,33 @@ RasterImageView::RasterImageView(QGraphicsItem* parent)
     d->q = this;
     d->mEmittedCompleted = false;
     d->mApplyDisplayTransform = true;
-    d->mDisplayTransform = nullptr;
 
     d->mAlphaBackgroundMode = AlphaBackgroundNone;
     d->mAlphaBackgroundColor = Qt::black;
     d->mRenderingIntent = INTENT_PERCEPTUAL;
     d->mEnlargeSmallerImages = false;
+    d->mScalingQuality = ScalingQuality::Normal;
 
     d->mBufferIsEmpty = true;
+    d->mBufferZoom = 0;
     d->mScaler = new ImageScaler(this);
+    // Scale in parallel, and in compare mode scale all views together so
+    // that they are painted in the same frame
+    d->mScaler->setSharedRendering(true);
     connect(d->mScaler, &ImageScaler::scaledRect, this, &RasterImageView::updateFromScaler);
 
+    // Rendered buffers went through the transform to the previous profile
+    connect(Cms::MonitorProfileWatcher::instance(), &Cms::MonitorProfileWatcher::monitorProfileChanged, this, [this]() {
+        d->mApplyDisplayTransform = true;
+        d->mDisplayTransform.reset();
+        d->clearCachedBuffers();
+        updateBuffer();
+    });
+
     d->setupUpdateTimer();
+    d->setupFitImageWatcher();
+    d->setupPlaceholderWatcher();
+    d->setupMemoryRegistry();
 }
 
 RasterImageView::~RasterImageView()
@@ -212,9 +494,6 @@ RasterImageView::~RasterImageView()
     if (d->mTool) {
         d->mTool.data()->toolDeactivated();
     }
-    if (d->mDisplayTransform) {
-        cmsDeleteTransform(d->mDisplayTransform);
-    }
     delete d;
 }
 
@@ -223,6 +502,7 @@ void RasterImageView::setAlphaBackgroundMode(AlphaBackgroundMode mode)
     d->mAlphaBackgroundMode = mode;
     if (document() && document()->hasAlphaChannel()) {
         d->mCurrentBuffer = QPixmap();
+        d->clearCachedBuffers();
         updateBuffer();
     }
 }
@@ -232,6 +512,7 @@ void RasterImageView::setAlphaBackgroundColor(const QColor& color)
     d->mAlphaBackgroundColor = color;
     if (document() && document()->hasAlphaChannel()) {
         d->mCurrentBuffer = QPixmap();
+        d->clearCachedBuffers();
         updateBuffer();
     }
 }
@@ -240,12 +521,28 @@ void RasterImageView::setRenderingIntent(const RenderingIntent::Enum& renderingI
 {
     if (d->mRenderingIntent != renderingIntent) {
         d->mRenderingIntent = renderingIntent;
+        d->clearCachedBuffers();
+        updateBuffer();
+    }
+}
+
+void RasterImageView::setScalingQuality(ScalingQuality::Enum quality)
+{
+    if (d->mScalingQuality != quality) {
+        d->mScalingQuality = quality;
+        d->mScaler->setScalingQuality(quality);
+        d->clearFitImages();
+        d->clearCachedBuffers();
         updateBuffer();
     }
 }
 
 void RasterImageView::loadFromDocument()
 {
+    d->cancelPlaceholder();
+    d->clearFitImages();
+    // Do not zoom the buffer of the previous document
+    d->clearCachedBuffers();
     Document::Ptr doc = document();
     if (!doc) {
         return;
@@ -281,6 +578,9 @@ void RasterImageView::finishSetDocument()
 
     d->mScaler->setDocument(document());
     d->resizeBuffer();
+    if (d->mBufferIsEmpty) {
+        d->loadPlaceholder();
+    }
     applyPendingScrollPos();
 
     connect(document().data(), SIGNAL(imageRectUpdated(QRect)),
@@ -304,6 +604,14 @@ void RasterImageView::finishSetDocument()
 
 void RasterImageView::updateImageRect(const QRect& imageRect)
 {
+    d->clearFitImages();
+    // The buffers must not be reused for the changed rect: if the zoom
+    // changes before the scaler runs, the scaler forgets the rect and only
+    // what is missing from the buffers is scaled again
+    d->mCachedBuffers.invalidate(imageRect);
+    if (d->mBufferZoom > 0) {
+        d->mRenderedRegion -= ZoomBufferCache::zoomedRect(imageRect, d->mBufferZoom);
+    }
     QRectF viewRect = mapToView(imageRect);
     if (!viewRect.intersects(boundingRect())) {
         return;
@@ -317,7 +625,13 @@ void RasterImageView::updateImageRect(const QRect& imageRect)
         applyPendingScrollPos();
     }
 
-    d->setScalerRegionToVisibleRect();
+    if (imageRect.contains(QRect(QPoint(0, 0), document()->size())) || d->mBufferIsEmpty) {
+        d->setScalerRegionToVisibleRect();
+    } else {
+        // Only part of the image changed, for example between two frames of
+        // an animation: do not rescale the rest
+        d->setScalerRegionToImageRect(imageRect);
+    }
     update();
     emit imageRectUpdated();
 }
@@ -329,31 +643,22 @@ void RasterImageView::slotDocumentIsAnimatedUpdated()
 
 void RasterImageView::updateFromScaler(int zoomedImageLeft, int zoomedImageTop, const QImage& image)
 {
-    if (d->mApplyDisplayTransform) {
-        d->updateDisplayTransform(image.format());
-        if (d->mDisplayTransform) {
-            quint8 *bytes = const_cast<quint8*>(image.bits());
-            cmsDoTransform(d->mDisplayTransform, bytes, bytes, image.width() * image.height());
-        }
-    }
-
     d->resizeBuffer();
     int viewportLeft = zoomedImageLeft - scrollPos().x();
     int viewportTop = zoomedImageTop - scrollPos().y();
     d->mBufferIsEmpty = false;
+    d->mRenderedRegion |= QRect(zoomedImageLeft, zoomedImageTop, image.width(), image.height()) & d->bufferRect();
+    // Keep the placeholder until the scaler has filled all of the viewport,
+    // otherwise it flashes
+    if (!d->mPlaceholder.isNull() && d->isViewportRendered()) {
+        d->mPlaceholder = QPixmap();
+    }
     {
         QPainter painter(&d->mCurrentBuffer);
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        if (document()->hasAlphaChannel()) {
-            d->drawAlphaBackground(
-                &painter, QRect(viewportLeft, viewportTop, image.width(), image.height()),
-                QPoint(zoomedImageLeft, zoomedImageTop),
-                alphaBackgroundTexture()
-            );
-            // This is required so transparent pixels don't replace our background
-            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        }
-        painter.drawImage(viewportLeft, viewportTop, image);
+        // Only detached from the scaler result if the display transform
+        // modifies it
+        QImage transformedImage = image;
+        d->drawImage(&painter, QPoint(viewportLeft, viewportTop), QPoint(zoomedImageLeft, zoomedImageTop), &transformedImage);
     }
     update();
 
@@ -366,7 +671,17 @@ void RasterImageView::updateFromScaler(int zoomedImageLeft, int zoomedImageTop,
 void RasterImageView::onZoomChanged()
 {
     d->mScaler->setZoom(zoom());
-    if (!d->mUpdateTimer->isActive()) {
+    if (d->mUpdateTimer->isActive()) {
+        // Being resized
+        d->updateFitImage();
+        return;
+    }
+    if (!d->mBufferIsEmpty && d->mBufferZoom > 0 && !qFuzzyCompare(d->mBufferZoom, zoom())) {
+        d->zoomBuffer();
+        d->mBufferZoom = zoom();
+        d->mBufferScrollPos = scrollPos().toPoint();
+        update();
+    } else {
         updateBuffer();
     }
 }
@@ -390,6 +705,8 @@ void RasterImageView::onScrollPosChanged(const QPointF& oldPos)
         painter.drawPixmap(-delta, d->mCurrentBuffer);
     }
     qSwap(d->mCurrentBuffer, d->mAlternateBuffer);
+    d->mRenderedRegion &= d->bufferRect();
+    d->mBufferScrollPos = scrollPos().toPoint();
 
     // Scale missing parts
     QRegion bufferRegion = QRegion(d->mCurrentBuffer.rect().translated(scrollPos().toPoint()));
@@ -401,13 +718,23 @@ void RasterImageView::onScrollPosChanged(const QPointF& oldPos)
 void RasterImageView::paint(QPainter* painter, const QStyleOptionGraphicsItem* /*option*/, QWidget* /*widget*/)
 {
     QPointF topLeft = imageOffset();
+    if (!d->mPlaceholder.isNull()) {
+        const QRectF rect(topLeft - scrollPos(), documentSize() * zoom());
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawPixmap(rect, d->mPlaceholder, QRectF(d->mPlaceholder.rect()));
+        painter->restore();
+    }
     if (zoomToFit()) {
-        // In zoomToFit mode, scale crudely the buffer to fit the screen. This
-        // provide an approximate rendered which will be replaced when the scheduled
-        // proper scale is ready.
+        // In zoomToFit mode, scale the buffer to fit the screen. While the view
+        // is being resized the buffer is replaced with fit images as soon as
+        // they are ready, and with the proper scale once resizing is done.
         // Round point and size independently, to keep consistency with the below (non zoomToFit) painting
         const QRect rect = QRect(topLeft.toPoint(), (documentSize() * zoom()).toSize());
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
         painter->drawPixmap(rect, d->mCurrentBuffer);
+        painter->restore();
     } else {
         painter->drawPixmap(topLeft.toPoint(), d->mCurrentBuffer);
     }
@@ -440,7 +767,7 @@ void RasterImageView::resizeEvent(QGraphicsSceneResizeEvent* event)
         d->mUpdateTimer->start();
     }
     AbstractImageView::resizeEvent(event);
-    if (!zoomToFit() || !zoomToFill()) {
+    if (!zoomToFit() && !zoomToFill()) {
         // Only update buffer if we are not in zoomToFit mode: if we are
         // onZoomChanged() will have already updated the buffer.
         updateBuffer();
@@ -450,6 +777,12 @@ void RasterImageView::resizeEvent(QGraphicsSceneResizeEvent* event)
 void RasterImageView::updateBuffer(const QRegion& region)
 {
     d->mUpdateTimer->stop();
+    if (!qFuzzyCompare(d->mBufferZoom, zoom())) {
+        // The buffer is going to be rendered again at the new zoom
+        d->mRenderedRegion = QRegion();
+        d->mBufferZoom = zoom();
+        d->mBufferScrollPos = scrollPos().toPoint();
+    }
     if (region.isEmpty()) {
         d->setScalerRegionToVisibleRect();
     } else {
@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Local
 #include <lib/documentview/abstractimageview.h>
 #include <lib/renderingintent.h>
+#include <lib/scalingquality.h>
 
 // KDE
 
@@ -52,6 +53,7 @@ public:
     void setAlphaBackgroundMode(AlphaBackgroundMode mode) override;
     void setAlphaBackgroundColor(const QColor& color) override;
     void setRenderingIntent(const RenderingIntent::Enum& renderingIntent);
+    void setScalingQuality(ScalingQuality::Enum quality);
 
 Q_SIGNALS:
     void currentToolChanged(AbstractRasterImageViewTool*);
@@ -82,6 +84,7 @@ private Q_SLOTS:
 
 private:
     RasterImageViewPrivate* const d;
+    friend struct RasterImageViewPrivate;
 };
 
 } // namespace
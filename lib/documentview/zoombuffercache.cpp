@@ -0,0 +1,116 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "zoombuffercache.h"
+
+// Qt
+#include <QPainter>
+
+namespace Gwenview
+{
+
+ZoomBufferCache::ZoomBufferCache(int maxCount)
+: mMaxCount(maxCount)
+{
+}
+
+void ZoomBufferCache::store(qreal zoom, const QPoint& pos, const QPixmap& pixmap, const QRegion& renderedRegion)
+{
+    if (renderedRegion.isEmpty()) {
+        return;
+    }
+    for (auto it = mBuffers.begin(); it != mBuffers.end();) {
+        if (qFuzzyCompare(it->mZoom, zoom)) {
+            it = mBuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    Buffer buffer;
+    buffer.mZoom = zoom;
+    buffer.mPos = pos;
+    buffer.mPixmap = pixmap;
+    buffer.mRenderedRegion = renderedRegion & QRect(pos, pixmap.size());
+    mBuffers.prepend(buffer);
+    while (mBuffers.count() > mMaxCount) {
+        mBuffers.removeLast();
+    }
+}
+
+QRegion ZoomBufferCache::restore(qreal zoom, const QRect& rect, QPainter* painter)
+{
+    for (auto it = mBuffers.begin(); it != mBuffers.end(); ++it) {
+        if (!qFuzzyCompare(it->mZoom, zoom)) {
+            continue;
+        }
+        const QRegion region = it->mRenderedRegion & rect;
+        if (!region.isEmpty()) {
+            painter->save();
+            painter->setCompositionMode(QPainter::CompositionMode_Source);
+            painter->setClipRegion(region.translated(-rect.topLeft()));
+            painter->drawPixmap(it->mPos - rect.topLeft(), it->mPixmap);
+            painter->restore();
+        }
+        mBuffers.erase(it);
+        return region;
+    }
+    return QRegion();
+}
+
+void ZoomBufferCache::invalidate(const QRect& imageRect)
+{
+    for (auto it = mBuffers.begin(); it != mBuffers.end();) {
+        it->mRenderedRegion -= zoomedRect(imageRect, it->mZoom);
+        if (it->mRenderedRegion.isEmpty()) {
+            it = mBuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ZoomBufferCache::clear()
+{
+    mBuffers.clear();
+}
+
+int ZoomBufferCache::count() const
+{
+    return mBuffers.count();
+}
+
+qint64 ZoomBufferCache::byteCount() const
+{
+    qint64 count = 0;
+    for (const Buffer& buffer : mBuffers) {
+        count += qint64(buffer.mPixmap.width()) * buffer.mPixmap.height() * buffer.mPixmap.depth() / 8;
+    }
+    return count;
+}
+
+QRect ZoomBufferCache::zoomedRect(const QRect& imageRect, qreal zoom)
+{
+    return QRectF(imageRect.left() * zoom, imageRect.top() * zoom,
+                  imageRect.width() * zoom, imageRect.height() * zoom)
+           .toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+} // namespace
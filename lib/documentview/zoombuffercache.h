@@ -0,0 +1,98 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef ZOOMBUFFERCACHE_H
+#define ZOOMBUFFERCACHE_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QList>
+#include <QPixmap>
+#include <QPoint>
+#include <QRegion>
+
+class QPainter;
+
+namespace Gwenview
+{
+
+/**
+ * Keeps the buffers an image view rendered at other zoom levels, with the
+ * region of each buffer which holds scaled pixels. Zooming back then only
+ * requires scaling what was never visible at that zoom.
+ *
+ * Positions and regions are in zoomed image coordinates.
+ */
+class GWENVIEWLIB_EXPORT ZoomBufferCache
+{
+public:
+    explicit ZoomBufferCache(int maxCount);
+
+    /**
+     * Stores @p pixmap, whose top left corner is at @p pos and which has
+     * been rendered at @p zoom. Only @p renderedRegion holds scaled pixels.
+     * Replaces the buffer stored for the same zoom, and forgets the oldest
+     * buffer if there are too many.
+     */
+    void store(qreal zoom, const QPoint& pos, const QPixmap& pixmap, const QRegion& renderedRegion);
+
+    /**
+     * Draws with @p painter what has been rendered at @p zoom inside
+     * @p rect, the painter origin being the top left corner of @p rect. The
+     * buffer is then forgotten: the caller keeps it up to date.
+     * Returns the region which has been drawn.
+     */
+    QRegion restore(qreal zoom, const QRect& rect, QPainter* painter);
+
+    /**
+     * Forgets what has been rendered from @p imageRect, in image coordinates,
+     * in all buffers
+     */
+    void invalidate(const QRect& imageRect);
+
+    void clear();
+
+    int count() const;
+
+    qint64 byteCount() const;
+
+    /**
+     * Returns the rect, in zoomed image coordinates, which pixels depend on
+     * @p imageRect once scaled by @p zoom. Grown by one pixel to account for
+     * rounding.
+     */
+    static QRect zoomedRect(const QRect& imageRect, qreal zoom);
+
+private:
+    struct Buffer {
+        qreal mZoom;
+        QPoint mPos;
+        QPixmap mPixmap;
+        QRegion mRenderedRegion;
+    };
+    // Most recent first
+    QList<Buffer> mBuffers;
+    const int mMaxCount;
+};
+
+} // namespace
+
+#endif /* ZOOMBUFFERCACHE_H */
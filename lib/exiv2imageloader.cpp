@@ -21,6 +21,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 // Self
 #include "exiv2imageloader.h"
 
+// Std
+#include <memory>
+
 // Qt
 #include <QByteArray>
 #include <QString>
@@ -30,6 +33,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 // Exiv2
 #include <exiv2/error.hpp>
+#include <exiv2/preview.hpp>
 #include <exiv2/types.hpp>
 
 // Local
@@ -41,6 +45,28 @@ struct Exiv2ImageLoaderPrivate
 {
     Exiv2::Image::AutoPtr mImage;
     QString mErrorMessage;
+    std::unique_ptr<Exiv2::PreviewManager> mPreviewManager;
+    Exiv2::PreviewPropertiesList mPreviewProperties;
+
+    bool initPreviewManager()
+    {
+        if (mPreviewManager) {
+            return true;
+        }
+        if (!mImage.get()) {
+            return false;
+        }
+        try {
+            mPreviewManager.reset(new Exiv2::PreviewManager(*mImage));
+            // Sorted by number of pixels
+            mPreviewProperties = mPreviewManager->getPreviewProperties();
+        } catch (const Exiv2::Error& error) {
+            mErrorMessage = QString::fromUtf8(error.what());
+            mPreviewManager.reset();
+            return false;
+        }
+        return true;
+    }
 };
 
 Exiv2ImageLoader::Exiv2ImageLoader()
@@ -55,6 +81,7 @@ Exiv2ImageLoader::~Exiv2ImageLoader()
 
 bool Exiv2ImageLoader::load(const QString& filePath)
 {
+    d->mPreviewManager.reset();
     QByteArray filePathByteArray = QFile::encodeName(filePath);
     try {
         d->mImage = Exiv2::ImageFactory::open(filePathByteArray.constData());
@@ -68,6 +95,7 @@ bool Exiv2ImageLoader::load(const QString& filePath)
 
 bool Exiv2ImageLoader::load(const QByteArray& data)
 {
+    d->mPreviewManager.reset();
     try {
         d->mImage = Exiv2::ImageFactory::open((unsigned char*)data.constData(), data.size());
         d->mImage->readMetadata();
@@ -85,7 +113,53 @@ QString Exiv2ImageLoader::errorMessage() const
 
 Exiv2::Image::AutoPtr Exiv2ImageLoader::popImage()
 {
+    // The preview manager refers to the image
+    d->mPreviewManager.reset();
     return d->mImage;
 }
 
+QSize Exiv2ImageLoader::imageSize()
+{
+    if (!d->mImage.get()) {
+        return QSize();
+    }
+    QSize size;
+    try {
+        size = QSize(d->mImage->pixelWidth(), d->mImage->pixelHeight());
+    } catch (const Exiv2::Error& error) {
+        d->mErrorMessage = QString::fromUtf8(error.what());
+        return QSize();
+    }
+    return size.isEmpty() ? QSize() : size;
+}
+
+QList<Exiv2ImageLoader::Preview> Exiv2ImageLoader::previews()
+{
+    QList<Preview> list;
+    if (!d->initPreviewManager()) {
+        return list;
+    }
+    for (const Exiv2::PreviewProperties& properties : d->mPreviewProperties) {
+        Preview preview;
+        preview.size = QSize(properties.width_, properties.height_);
+        preview.mimeType = QString::fromStdString(properties.mimeType_);
+        list << preview;
+    }
+    return list;
+}
+
+QByteArray Exiv2ImageLoader::previewData(int index)
+{
+    if (!d->initPreviewManager() || index < 0 || index >= int(d->mPreviewProperties.size())) {
+        return QByteArray();
+    }
+    try {
+        const Exiv2::PreviewImage image = d->mPreviewManager->getPreviewImage(d->mPreviewProperties[index]);
+        return QByteArray(reinterpret_cast<const char*>(image.pData()), image.size());
+    } catch (const Exiv2::Error& error) {
+        d->mErrorMessage = QString::fromUtf8(error.what());
+        return QByteArray();
+    }
+}
+
 } // namespace
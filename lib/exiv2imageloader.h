@@ -24,6 +24,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <lib/gwenviewlib_export.h>
 
 // Qt
+#include <QList>
+#include <QSize>
+#include <QString>
 
 // KDE
 
@@ -34,7 +37,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 // Local
 
 class QByteArray;
-class QString;
 
 namespace Gwenview
 {
@@ -56,6 +58,31 @@ public:
     QString errorMessage() const;
     Exiv2::Image::AutoPtr popImage();
 
+    /**
+     * Returns the size of the loaded image, which for raw files is the size
+     * of the sensor data rather than the one of a preview. Returns an
+     * invalid size if it is not known.
+     */
+    QSize imageSize();
+
+    struct Preview {
+        QSize size;
+        QString mimeType;
+    };
+
+    /**
+     * Returns the previews embedded in the loaded image, from the smallest
+     * to the largest. Nothing is decoded: sizes come from the metadata, so
+     * this is cheap enough to pick the right preview before reading it.
+     */
+    QList<Preview> previews();
+
+    /**
+     * Returns the encoded data of the preview at @p index in previews(), or
+     * an empty array if it cannot be read
+     */
+    QByteArray previewData(int index);
+
 private:
     Exiv2ImageLoaderPrivate* const d;
 };
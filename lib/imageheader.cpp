@@ -0,0 +1,411 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "imageheader.h"
+
+// STL
+#include <cstring>
+
+// Qt
+#include <QMap>
+#include <QtEndian>
+
+// Local
+#include "tracer.h"
+
+namespace Gwenview
+{
+
+// TIFF tags
+static const quint16 TAG_IMAGE_WIDTH = 256;
+static const quint16 TAG_IMAGE_LENGTH = 257;
+static const quint16 TAG_COMPRESSION = 259;
+static const quint16 TAG_ORIENTATION = 274;
+static const quint16 TAG_JPEG_OFFSET = 513;
+static const quint16 TAG_JPEG_LENGTH = 514;
+static const quint16 TAG_ICC_PROFILE = 34675;
+
+// Compression of JPEG thumbnails referenced by the second directory
+static const quint16 COMPRESSION_OLD_JPEG = 6;
+
+// TIFF types
+static const quint16 TYPE_SHORT = 3;
+static const quint16 TYPE_LONG = 4;
+
+/**
+ * Bound-checked access to a range of the data
+ */
+struct ByteRange
+{
+    const uchar* mData;
+    int mOffset;
+    int mLength;
+
+    bool contains(int pos, int length) const
+    {
+        return pos >= 0 && length >= 0 && pos <= mLength - length;
+    }
+
+    quint16 u16(int pos, bool bigEndian) const
+    {
+        return bigEndian ? qFromBigEndian<quint16>(mData + mOffset + pos)
+                         : qFromLittleEndian<quint16>(mData + mOffset + pos);
+    }
+
+    quint32 u32(int pos, bool bigEndian) const
+    {
+        return bigEndian ? qFromBigEndian<quint32>(mData + mOffset + pos)
+                         : qFromLittleEndian<quint32>(mData + mOffset + pos);
+    }
+
+    bool startsWith(int pos, const char* magic, int length) const
+    {
+        return contains(pos, length) && memcmp(mData + mOffset + pos, magic, length) == 0;
+    }
+};
+
+struct ImageHeaderPrivate
+{
+    QByteArray mFormat;
+    QSize mSize;
+    Orientation mOrientation;
+    QByteArray mIccProfile;
+    int mExifOffset;
+    int mExifLength;
+    int mThumbnailOffset;
+    int mThumbnailLength;
+
+    void reset()
+    {
+        mFormat.clear();
+        mSize = QSize();
+        mOrientation = NOT_AVAILABLE;
+        mIccProfile.clear();
+        mExifOffset = -1;
+        mExifLength = -1;
+        mThumbnailOffset = -1;
+        mThumbnailLength = -1;
+    }
+
+    /**
+     * Reads the first two directories of the TIFF structure in @p range.
+     * The size and the profile are only read when @p isImage is true: in
+     * EXIF blocks they describe the thumbnail, if anything.
+     */
+    void readTiff(const ByteRange& range, bool isImage)
+    {
+        if (!range.contains(0, 8)) {
+            return;
+        }
+        bool bigEndian;
+        if (range.startsWith(0, "II*\0", 4)) {
+            bigEndian = false;
+        } else if (range.startsWith(0, "MM\0*", 4)) {
+            bigEndian = true;
+        } else {
+            return;
+        }
+        if (!isImage) {
+            mExifOffset = range.mOffset;
+            mExifLength = range.mLength;
+        }
+
+        quint32 ifdOffset = range.u32(4, bigEndian);
+        for (int ifd = 0; ifd < 2 && ifdOffset > 0 && range.contains(ifdOffset, 2); ++ifd) {
+            const int count = range.u16(ifdOffset, bigEndian);
+            const int entries = ifdOffset + 2;
+            if (!range.contains(entries, count * 12 + 4)) {
+                return;
+            }
+            int jpegOffset = -1;
+            int jpegLength = -1;
+            quint32 compression = 0;
+            for (int idx = 0; idx < count; ++idx) {
+                const int entry = entries + idx * 12;
+                const quint16 tag = range.u16(entry, bigEndian);
+                const quint16 type = range.u16(entry + 2, bigEndian);
+                const quint32 valueCount = range.u32(entry + 4, bigEndian);
+                const quint32 value = type == TYPE_SHORT
+                    ? range.u16(entry + 8, bigEndian)
+                    : range.u32(entry + 8, bigEndian);
+                if (ifd == 0) {
+                    if (tag == TAG_ORIENTATION && type == TYPE_SHORT) {
+                        mOrientation = value <= ROT_270 ? Orientation(value) : NOT_AVAILABLE;
+                    } else if (isImage && tag == TAG_IMAGE_WIDTH && (type == TYPE_SHORT || type == TYPE_LONG)) {
+                        mSize.setWidth(value);
+                    } else if (isImage && tag == TAG_IMAGE_LENGTH && (type == TYPE_SHORT || type == TYPE_LONG)) {
+                        mSize.setHeight(value);
+                    } else if (isImage && tag == TAG_ICC_PROFILE && valueCount > 4 && range.contains(value, valueCount)) {
+                        mIccProfile = QByteArray(reinterpret_cast<const char*>(range.mData + range.mOffset + value), valueCount);
+                    }
+                } else {
+                    if (tag == TAG_COMPRESSION && type == TYPE_SHORT) {
+                        compression = value;
+                    } else if (tag == TAG_JPEG_OFFSET) {
+                        jpegOffset = value;
+                    } else if (tag == TAG_JPEG_LENGTH) {
+                        jpegLength = value;
+                    }
+                }
+            }
+            // In TIFF files, the second directory is usually another page,
+            // only trust its JPEG tags if it says it is a JPEG thumbnail
+            const bool isThumbnail = !isImage || compression == COMPRESSION_OLD_JPEG;
+            if (ifd == 1 && isThumbnail && jpegLength > 0 && range.contains(jpegOffset, jpegLength)) {
+                mThumbnailOffset = range.mOffset + jpegOffset;
+                mThumbnailLength = jpegLength;
+            }
+            const quint32 nextOffset = range.u32(entries + count * 12, bigEndian);
+            if (nextOffset <= ifdOffset) {
+                // Avoid looping on corrupted files
+                return;
+            }
+            ifdOffset = nextOffset;
+        }
+    }
+
+    bool readJpeg(const ByteRange& data)
+    {
+        QMap<int, QByteArray> iccChunks;
+        int iccChunkCount = 0;
+        int pos = 2;
+        while (data.contains(pos, 4)) {
+            if (data.mData[pos] != 0xFF) {
+                GV_TRACE_EVENT("load", "invalidJpegMarker", QString::number(pos));
+                break;
+            }
+            const uchar marker = data.mData[pos + 1];
+            if (marker == 0xFF) {
+                // Fill byte
+                ++pos;
+                continue;
+            }
+            if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+                // No payload
+                pos += 2;
+                continue;
+            }
+            if (marker == 0xD9 || marker == 0xDA) {
+                // End of image or start of scan: no more metadata
+                break;
+            }
+            const int length = data.u16(pos + 2, true);
+            const ByteRange segment = { data.mData, pos + 4, length - 2 };
+            if (length < 2 || !data.contains(segment.mOffset, 0)) {
+                break;
+            }
+            // The last segment may be truncated if data contains only the
+            // beginning of the file
+            const ByteRange available = { data.mData, segment.mOffset, qMin(segment.mLength, data.mLength - segment.mOffset) };
+
+            if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                // Start of frame
+                if (available.contains(0, 5)) {
+                    mSize = QSize(available.u16(3, true), available.u16(1, true));
+                }
+            } else if (marker == 0xE1 && available.startsWith(0, "Exif\0\0", 6) && mExifOffset < 0) {
+                const ByteRange tiff = { data.mData, available.mOffset + 6, available.mLength - 6 };
+                readTiff(tiff, false);
+            } else if (marker == 0xE2 && available.mLength == segment.mLength
+                       && available.startsWith(0, "ICC_PROFILE\0", 12) && available.contains(12, 2)) {
+                // A truncated chunk would give a corrupted profile
+                const int sequence = available.mData[available.mOffset + 12];
+                iccChunkCount = available.mData[available.mOffset + 13];
+                iccChunks.insert(sequence, QByteArray(reinterpret_cast<const char*>(available.mData + available.mOffset + 14), available.mLength - 14));
+            }
+            pos = segment.mOffset + segment.mLength;
+        }
+
+        // ICC profiles are split over numbered APP2 segments, starting at 1
+        if (iccChunkCount > 0 && iccChunks.count() == iccChunkCount
+                && iccChunks.firstKey() == 1 && iccChunks.lastKey() == iccChunkCount) {
+            for (const QByteArray& chunk : qAsConst(iccChunks)) {
+                mIccProfile += chunk;
+            }
+        }
+        return mSize.isValid();
+    }
+
+    bool readPng(const ByteRange& data)
+    {
+        int pos = 8;
+        while (data.contains(pos, 8)) {
+            const int length = data.u32(pos, true);
+            const ByteRange chunk = { data.mData, pos + 8, length };
+            if (length < 0 || !data.contains(chunk.mOffset, chunk.mLength)) {
+                break;
+            }
+            if (data.startsWith(pos + 4, "IHDR", 4) && chunk.contains(0, 8)) {
+                mSize = QSize(chunk.u32(0, true), chunk.u32(4, true));
+            } else if (data.startsWith(pos + 4, "iCCP", 4)) {
+                // Profile name, null byte, compression method, zlib stream
+                const char* begin = reinterpret_cast<const char*>(chunk.mData + chunk.mOffset);
+                const int nameLength = qstrnlen(begin, chunk.mLength);
+                if (nameLength + 2 < chunk.mLength) {
+                    const int streamOffset = nameLength + 2;
+                    // qUncompress() wants the expected size first, it grows
+                    // its buffer if this is too small
+                    QByteArray compressed(4, '\0');
+                    qToBigEndian<quint32>((chunk.mLength - streamOffset) * 4, reinterpret_cast<uchar*>(compressed.data()));
+                    compressed.append(begin + streamOffset, chunk.mLength - streamOffset);
+                    mIccProfile = qUncompress(compressed);
+                }
+            } else if (data.startsWith(pos + 4, "eXIf", 4)) {
+                readTiff(chunk, false);
+            } else if (data.startsWith(pos + 4, "IDAT", 4) || data.startsWith(pos + 4, "IEND", 4)) {
+                break;
+            }
+            // Length, type, data and CRC
+            pos = chunk.mOffset + chunk.mLength + 4;
+        }
+        return mSize.isValid();
+    }
+
+    bool readWebP(const ByteRange& data)
+    {
+        int pos = 12;
+        while (data.contains(pos, 8)) {
+            const int length = data.u32(pos + 4, false);
+            const ByteRange chunk = { data.mData, pos + 8, length };
+            if (length < 0) {
+                break;
+            }
+            // Keep the size of the image chunk, but read what is available
+            // of the others
+            const ByteRange available = { data.mData, chunk.mOffset, qMin(chunk.mLength, data.mLength - chunk.mOffset) };
+
+            if (data.startsWith(pos, "VP8X", 4) && available.contains(0, 10)) {
+                const uchar* canvas = available.mData + available.mOffset + 4;
+                const int width = (canvas[0] | canvas[1] << 8 | canvas[2] << 16) + 1;
+                const int height = (canvas[3] | canvas[4] << 8 | canvas[5] << 16) + 1;
+                mSize = QSize(width, height);
+            } else if (data.startsWith(pos, "VP8 ", 4) && available.contains(0, 10) && !mSize.isValid()) {
+                // Lossy: frame tag, start code, 14 bit dimensions
+                if (available.startsWith(3, "\x9d\x01\x2a", 3)) {
+                    mSize = QSize(available.u16(6, false) & 0x3fff, available.u16(8, false) & 0x3fff);
+                }
+            } else if (data.startsWith(pos, "VP8L", 4) && available.contains(0, 5) && !mSize.isValid()) {
+                // Lossless: signature byte, 14 bit dimensions minus one
+                if (available.mData[available.mOffset] == 0x2f) {
+                    const quint32 bits = available.u32(1, false);
+                    mSize = QSize((bits & 0x3fff) + 1, ((bits >> 14) & 0x3fff) + 1);
+                }
+            } else if (data.startsWith(pos, "ICCP", 4) && available.mLength == chunk.mLength) {
+                mIccProfile = QByteArray(reinterpret_cast<const char*>(chunk.mData + chunk.mOffset), chunk.mLength);
+            } else if (data.startsWith(pos, "EXIF", 4)) {
+                // Some writers keep the JPEG APP1 prefix
+                const int skip = available.startsWith(0, "Exif\0\0", 6) ? 6 : 0;
+                const ByteRange tiff = { data.mData, available.mOffset + skip, available.mLength - skip };
+                readTiff(tiff, false);
+            }
+            // Chunks are padded to an even size. The length comes from the
+            // file, do not let a bogus one overflow
+            const qint64 next = qint64(chunk.mOffset) + chunk.mLength + (chunk.mLength & 1);
+            if (next > data.mLength) {
+                break;
+            }
+            pos = int(next);
+        }
+        return mSize.isValid();
+    }
+};
+
+ImageHeader::ImageHeader()
+: d(new ImageHeaderPrivate)
+{
+    d->reset();
+}
+
+ImageHeader::~ImageHeader()
+{
+    delete d;
+}
+
+bool ImageHeader::load(const QByteArray& data)
+{
+    d->reset();
+    const ByteRange range = { reinterpret_cast<const uchar*>(data.constData()), 0, data.size() };
+
+    bool ok = false;
+    if (range.startsWith(0, "\xFF\xD8\xFF", 3)) {
+        d->mFormat = "jpeg";
+        ok = d->readJpeg(range);
+    } else if (range.startsWith(0, "\x89PNG\r\n\x1a\n", 8)) {
+        d->mFormat = "png";
+        ok = d->readPng(range);
+    } else if (range.startsWith(0, "II*\0", 4) || range.startsWith(0, "MM\0*", 4)) {
+        d->mFormat = "tiff";
+        d->readTiff(range, true);
+        // The whole file is the EXIF block
+        d->mExifOffset = 0;
+        d->mExifLength = data.size();
+        ok = d->mSize.isValid();
+    } else if (range.startsWith(0, "RIFF", 4) && range.startsWith(8, "WEBP", 4)) {
+        d->mFormat = "webp";
+        ok = d->readWebP(range);
+    }
+    if (!ok) {
+        d->reset();
+    }
+    return ok;
+}
+
+QByteArray ImageHeader::format() const
+{
+    return d->mFormat;
+}
+
+QSize ImageHeader::size() const
+{
+    return d->mSize;
+}
+
+Orientation ImageHeader::orientation() const
+{
+    return d->mOrientation;
+}
+
+QByteArray ImageHeader::iccProfile() const
+{
+    return d->mIccProfile;
+}
+
+int ImageHeader::exifOffset() const
+{
+    return d->mExifOffset;
+}
+
+int ImageHeader::exifLength() const
+{
+    return d->mExifLength;
+}
+
+int ImageHeader::thumbnailOffset() const
+{
+    return d->mThumbnailOffset;
+}
+
+int ImageHeader::thumbnailLength() const
+{
+    return d->mThumbnailLength;
+}
+
+} // namespace
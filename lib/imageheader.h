@@ -0,0 +1,91 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef IMAGEHEADER_H
+#define IMAGEHEADER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QByteArray>
+#include <QSize>
+
+// Local
+#include <lib/orientation.h>
+
+namespace Gwenview
+{
+
+struct ImageHeaderPrivate;
+
+/**
+ * Reads what Gwenview needs to know about an image before decoding it, in a
+ * single pass over the JPEG markers, PNG chunks, TIFF directories or WebP
+ * chunks. Pixels are never decoded.
+ */
+class GWENVIEWLIB_EXPORT ImageHeader
+{
+public:
+    ImageHeader();
+    ~ImageHeader();
+
+    /**
+     * Returns true if the format has been recognized and the size found.
+     * @p data can contain only the beginning of the file, in which case the
+     * information stored after it is missing.
+     */
+    bool load(const QByteArray& data);
+
+    /**
+     * The format, as named by QImageReader: "jpeg", "png", "tiff" or "webp"
+     */
+    QByteArray format() const;
+
+    /**
+     * The size of the stored image: the orientation is not applied
+     */
+    QSize size() const;
+
+    Orientation orientation() const;
+
+    /**
+     * The embedded ICC profile, uncompressed
+     */
+    QByteArray iccProfile() const;
+
+    /**
+     * The position of the EXIF block, which starts with a TIFF header, or -1
+     */
+    int exifOffset() const;
+    int exifLength() const;
+
+    /**
+     * The position of the JPEG thumbnail referenced by the EXIF block, or -1
+     */
+    int thumbnailOffset() const;
+    int thumbnailLength() const;
+
+private:
+    ImageHeaderPrivate* const d;
+};
+
+} // namespace
+
+#endif /* IMAGEHEADER_H */
@@ -0,0 +1,317 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "imageresampler.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Qt
+#include <QDebug>
+#include <QtMath>
+
+// Local
+#include <lib/tracer.h>
+
+namespace Gwenview
+{
+
+namespace ImageResampler
+{
+
+// Weights are fixed point numbers with this many bits after the point. This
+// leaves enough room to sum 8 bit channels, including negative lobes, in 32
+// bit integers.
+static const int PRECISION_BITS = 14;
+static const int ONE = 1 << PRECISION_BITS;
+
+// Margin used by Qt::SmoothTransformation
+static const int BILINEAR_MARGIN = 3;
+
+static qreal filterSupport(Filter filter)
+{
+    switch (filter) {
+    case BoxFilter:
+        return 0.5;
+    case MitchellFilter:
+        return 2.;
+    case Lanczos3Filter:
+        return 3.;
+    default:
+        return 1.;
+    }
+}
+
+static qreal sinc(qreal x)
+{
+    if (x == 0.) {
+        return 1.;
+    }
+    x *= M_PI;
+    return std::sin(x) / x;
+}
+
+static qreal filterValue(Filter filter, qreal x)
+{
+    x = std::abs(x);
+    switch (filter) {
+    case BoxFilter:
+        return x <= 0.5 ? 1. : 0.;
+    case MitchellFilter: {
+        const qreal B = 1. / 3.;
+        const qreal C = 1. / 3.;
+        if (x < 1.) {
+            return ((12. - 9. * B - 6. * C) * x * x * x
+                    + (-18. + 12. * B + 6. * C) * x * x
+                    + (6. - 2. * B)) / 6.;
+        }
+        if (x < 2.) {
+            return ((-B - 6. * C) * x * x * x
+                    + (6. * B + 30. * C) * x * x
+                    + (-12. * B - 48. * C) * x
+                    + (8. * B + 24. * C)) / 6.;
+        }
+        return 0.;
+    }
+    case Lanczos3Filter:
+        return x < 3. ? sinc(x) * sinc(x / 3.) : 0.;
+    default:
+        return 0.;
+    }
+}
+
+/**
+ * The source pixels and weights used for each destination pixel along one
+ * axis. Weights are stored in rows of taps items, so that the loops do not
+ * need to look anything else up.
+ */
+struct Contributions
+{
+    int taps;
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<qint32> weights;
+};
+
+static void computeContributions(int sourceSize, int destSize, Filter filter, Contributions* contributions)
+{
+    const qreal scale = qreal(destSize) / sourceSize;
+    // When downscaling, stretch the filter so that it covers all the source
+    // pixels of each destination pixel
+    const qreal filterScale = qMin(scale, qreal(1.));
+    const qreal support = filterSupport(filter) / filterScale;
+
+    const int taps = int(std::ceil(support)) * 2 + 1;
+    contributions->taps = taps;
+    contributions->first.resize(destSize);
+    contributions->count.resize(destSize);
+    contributions->weights.assign(size_t(destSize) * taps, 0);
+
+    std::vector<qreal> realWeights(taps);
+    for (int dst = 0; dst < destSize; ++dst) {
+        const qreal center = (dst + 0.5) / scale;
+        int first = qMax(0, int(center - support + 0.5));
+        const int last = qMin(sourceSize, int(center + support + 0.5));
+        int count = qMin(last - first, taps);
+
+        qreal sum = 0;
+        for (int idx = 0; idx < count; ++idx) {
+            const qreal weight = filterValue(filter, (first + idx + 0.5 - center) * filterScale);
+            realWeights[idx] = weight;
+            sum += weight;
+        }
+        if (sum == 0.) {
+            // Can only happen with degenerate sizes, use the nearest pixel
+            first = qBound(0, int(center), sourceSize - 1);
+            count = 1;
+            realWeights[0] = sum = 1.;
+        }
+
+        // Make sure rounding does not change the sum of the weights, or flat
+        // areas would get lighter or darker: put the error on the biggest one
+        qint32* weights = contributions->weights.data() + size_t(dst) * taps;
+        qint32 total = 0;
+        int biggest = 0;
+        for (int idx = 0; idx < count; ++idx) {
+            weights[idx] = qRound(realWeights[idx] / sum * ONE);
+            total += weights[idx];
+            if (realWeights[idx] > realWeights[biggest]) {
+                biggest = idx;
+            }
+        }
+        weights[biggest] += ONE - total;
+
+        contributions->first[dst] = first;
+        contributions->count[dst] = count;
+    }
+}
+
+static inline quint32 clampChannel(qint32 value)
+{
+    value >>= PRECISION_BITS;
+    return quint32(qBound(0, value, 255));
+}
+
+static inline QRgb filterPixel(const QRgb* pixels, const qint32* weights, int count)
+{
+    // Start at one half for rounding
+    qint32 a = ONE / 2, r = ONE / 2, g = ONE / 2, b = ONE / 2;
+    for (int idx = 0; idx < count; ++idx) {
+        const QRgb pixel = pixels[idx];
+        const qint32 weight = weights[idx];
+        a += qint32(qAlpha(pixel)) * weight;
+        r += qint32(qRed(pixel)) * weight;
+        g += qint32(qGreen(pixel)) * weight;
+        b += qint32(qBlue(pixel)) * weight;
+    }
+    return qRgba(clampChannel(r), clampChannel(g), clampChannel(b), clampChannel(a));
+}
+
+/**
+ * image must be Format_RGB32, Format_ARGB32_Premultiplied or Format_ARGB32.
+ * Format_ARGB32 rows are premultiplied as they are read, and the result is
+ * then Format_ARGB32_Premultiplied.
+ */
+static QImage resample(const QImage& image, const QRect& sourceRect, const QSize& destSize, Filter filter)
+{
+    const int sourceWidth = sourceRect.width();
+    const int sourceHeight = sourceRect.height();
+    const int destWidth = destSize.width();
+    const int destHeight = destSize.height();
+
+    Contributions horizontal;
+    computeContributions(sourceWidth, destWidth, filter, &horizontal);
+    Contributions vertical;
+    computeContributions(sourceHeight, destHeight, filter, &vertical);
+
+    // Only the source rows used by the vertical pass need a horizontal pass
+    int firstRow = sourceHeight;
+    int lastRow = 0;
+    for (int y = 0; y < destHeight; ++y) {
+        firstRow = qMin(firstRow, vertical.first[y]);
+        lastRow = qMax(lastRow, vertical.first[y] + vertical.count[y]);
+    }
+
+    // Horizontal pass, reading straight from the source rect
+    const bool premultiply = image.format() == QImage::Format_ARGB32;
+    std::vector<QRgb> premultipliedRow(premultiply ? sourceWidth : 0);
+    std::vector<QRgb> buffer(size_t(destWidth) * (lastRow - firstRow));
+    for (int row = firstRow; row < lastRow; ++row) {
+        const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(sourceRect.top() + row)) + sourceRect.left();
+        if (premultiply) {
+            // Filtering colors which are not premultiplied would make the
+            // colors of transparent pixels bleed
+            for (int x = 0; x < sourceWidth; ++x) {
+                premultipliedRow[x] = qPremultiply(src[x]);
+            }
+            src = premultipliedRow.data();
+        }
+        QRgb* dst = buffer.data() + size_t(row - firstRow) * destWidth;
+        const qint32* weights = horizontal.weights.data();
+        for (int x = 0; x < destWidth; ++x, weights += horizontal.taps) {
+            dst[x] = filterPixel(src + horizontal.first[x], weights, horizontal.count[x]);
+        }
+    }
+
+    // Vertical pass. Rows are accumulated one after the other, so that memory
+    // is read sequentially
+    QImage result(destSize, premultiply ? QImage::Format_ARGB32_Premultiplied : image.format());
+    if (result.isNull()) {
+        qWarning() << "Could not allocate a" << destSize << "image";
+        return QImage();
+    }
+    const bool opaque = image.format() == QImage::Format_RGB32;
+    std::vector<qint32> sums(size_t(destWidth) * 4);
+    const qint32* weights = vertical.weights.data();
+    for (int y = 0; y < destHeight; ++y, weights += vertical.taps) {
+        // Start at one half for rounding
+        std::fill(sums.begin(), sums.end(), ONE / 2);
+        for (int idx = 0; idx < vertical.count[y]; ++idx) {
+            const QRgb* src = buffer.data() + size_t(vertical.first[y] + idx - firstRow) * destWidth;
+            const qint32 weight = weights[idx];
+            qint32* sum = sums.data();
+            for (int x = 0; x < destWidth; ++x, sum += 4) {
+                sum[0] += qint32(qAlpha(src[x])) * weight;
+                sum[1] += qint32(qRed(src[x])) * weight;
+                sum[2] += qint32(qGreen(src[x])) * weight;
+                sum[3] += qint32(qBlue(src[x])) * weight;
+            }
+        }
+
+        QRgb* dst = reinterpret_cast<QRgb*>(result.scanLine(y));
+        const qint32* sum = sums.data();
+        for (int x = 0; x < destWidth; ++x, sum += 4) {
+            if (opaque) {
+                dst[x] = qRgb(clampChannel(sum[1]), clampChannel(sum[2]), clampChannel(sum[3]));
+            } else {
+                // Negative lobes can make colors brighter than alpha allows
+                const quint32 alpha = clampChannel(sum[0]);
+                dst[x] = qRgba(qMin(clampChannel(sum[1]), alpha),
+                               qMin(clampChannel(sum[2]), alpha),
+                               qMin(clampChannel(sum[3]), alpha),
+                               alpha);
+            }
+        }
+    }
+    return result;
+}
+
+QImage scale(const QImage& image, const QRect& rect, const QSize& destSize, Filter filter)
+{
+    const QRect sourceRect = rect & image.rect();
+    if (sourceRect.isEmpty() || destSize.isEmpty()) {
+        return QImage();
+    }
+    GV_TRACE("scale", "resample");
+
+    if (filter == NearestFilter || filter == BilinearFilter) {
+        return image.copy(sourceRect).scaled(destSize, Qt::IgnoreAspectRatio,
+                                             filter == NearestFilter ? Qt::FastTransformation : Qt::SmoothTransformation);
+    }
+
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return resample(image, sourceRect, destSize, filter);
+    case QImage::Format_ARGB32:
+        return resample(image, sourceRect, destSize, filter).convertToFormat(QImage::Format_ARGB32);
+    default:
+        return image.copy(sourceRect).scaled(destSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+}
+
+int sourceMargin(Filter filter, qreal zoom)
+{
+    switch (filter) {
+    case NearestFilter:
+        return 0;
+    case BilinearFilter:
+        return BILINEAR_MARGIN;
+    default:
+        return int(std::ceil(filterSupport(filter) / qMin(zoom, qreal(1.)))) + 1;
+    }
+}
+
+} // namespace ImageResampler
+
+} // namespace Gwenview
@@ -0,0 +1,64 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef IMAGERESAMPLER_H
+#define IMAGERESAMPLER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QImage>
+
+namespace Gwenview
+{
+
+/**
+ * Scales images with separable filters. 32 bit images are filtered directly
+ * from the source rect, other formats are handed to QImage::scaled().
+ */
+namespace ImageResampler
+{
+
+enum Filter {
+    NearestFilter,  ///< Qt::FastTransformation
+    BilinearFilter, ///< Qt::SmoothTransformation
+    BoxFilter,      ///< Averages covered pixels, fast and good for downscaling
+    MitchellFilter, ///< Bicubic, B = C = 1/3
+    Lanczos3Filter  ///< Sharpest, may show a little ringing
+};
+
+/**
+ * Returns @p sourceRect of @p image scaled to @p destSize. The rect is
+ * considered on its own: pixels outside of it are not used.
+ */
+GWENVIEWLIB_EXPORT QImage scale(const QImage& image, const QRect& sourceRect, const QSize& destSize, Filter filter);
+
+/**
+ * Number of source pixels around a rect which influence the result of
+ * scaling it by @p zoom. Scaling a rect with such a margin, then cropping the
+ * margin, gives the same pixels as scaling the whole image.
+ */
+GWENVIEWLIB_EXPORT int sourceMargin(Filter filter, qreal zoom);
+
+} // namespace ImageResampler
+
+} // namespace Gwenview
+
+#endif /* IMAGERESAMPLER_H */
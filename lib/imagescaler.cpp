@@ -20,49 +20,176 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "imagescaler.h"
 
 // Qt
+#include <QCoreApplication>
+#include <QEvent>
+#include <QHash>
 #include <QImage>
+#include <QPointer>
 #include <QRegion>
-#include <QDebug>
 
 // KDE
 
 // Local
 #include <lib/document/document.h>
+#include <lib/document/regiondecoder.h>
+#include <lib/imageresampler.h>
 #include <lib/paintutils.h>
-
-#undef ENABLE_LOG
-#undef LOG
-//#define ENABLE_LOG
-#ifdef ENABLE_LOG
-#define LOG(x) qDebug() << x
-#else
-#define LOG(x) ;
-#endif
+#include <lib/taskscheduler.h>
+#include <lib/tracer.h>
 
 namespace Gwenview
 {
 
-// Amount of pixels to keep so that smooth scale is correct
-static const int SMOOTH_MARGIN = 3;
+// With shared rendering, rects are split in stripes of this height so that
+// a single view is scaled in parallel too
+static const int TILE_HEIGHT = 128;
+
+/**
+ * Everything needed to scale a rect, so that it can be done in any thread
+ */
+struct ImageScalerTask
+{
+    QPointer<ImageScaler> mScaler;
+    QImage mImage;
+    QRect mSourceRect;
+    QSize mDestSize;
+    // Part of the scaled image to keep, null to keep all of it
+    QRect mCropRect;
+    QPoint mDestPos;
+    ImageResampler::Filter mFilter;
+    QImage mResult;
+
+    void run()
+    {
+        GV_TRACE("scale", "scaleRect");
+        QImage tmp;
+        if (mSourceRect.size() == mDestSize) {
+            tmp = mImage.copy(mSourceRect);
+        } else {
+            tmp = ImageResampler::scale(mImage, mSourceRect, mDestSize, mFilter);
+        }
+        if (!mCropRect.isNull()) {
+            tmp = tmp.copy(mCropRect);
+        }
+        mResult = tmp;
+    }
+};
 
 struct ImageScalerPrivate
 {
-    Qt::TransformationMode mTransformationMode;
+    ScalingQuality::Enum mScalingQuality;
+    ImageResampler::Filter mFilter;
     Document::Ptr mDocument;
     qreal mZoom;
     QRegion mRegion;
+    // Rects waiting for the region decoder
+    QRegion mWaitingRegion;
+    bool mSharedRendering;
+
+    RegionDecoder* regionDecoder() const
+    {
+        RegionDecoder* decoder = mDocument->regionDecoder();
+        return decoder && !decoder->hasFailed() ? decoder : nullptr;
+    }
+
+    bool prepareTask(const QRect& rect, ImageScalerTask* task);
 };
 
+/**
+ * Gathers the requests of the ImageScalers using shared rendering and scales
+ * them in parallel
+ */
+class ImageScalerScheduler : public QObject
+{
+public:
+    void request(ImageScaler* scaler, const QRegion& region)
+    {
+        mPendingRegions[scaler] |= region;
+        if (!mFlushPosted) {
+            mFlushPosted = true;
+            // Unlike a timer, a posted event is processed before the paint
+            // events caused by the views updates
+            QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+        }
+    }
+
+    void forget(ImageScaler* scaler)
+    {
+        mPendingRegions.remove(scaler);
+    }
+
+protected:
+    void customEvent(QEvent*) override
+    {
+        mFlushPosted = false;
+        flush();
+    }
+
+private:
+    QHash<ImageScaler*, QRegion> mPendingRegions;
+    bool mFlushPosted = false;
+
+    void flush();
+};
+
+Q_GLOBAL_STATIC(ImageScalerScheduler, sImageScalerScheduler)
+
+void ImageScalerScheduler::flush()
+{
+    QVector<ImageScalerTask> tasks;
+    for (auto it = mPendingRegions.constBegin(), end = mPendingRegions.constEnd(); it != end; ++it) {
+        ImageScaler* scaler = it.key();
+        for (const QRect& rect : it.value().rects()) {
+            for (int top = rect.top(); top <= rect.bottom(); top += TILE_HEIGHT) {
+                const QRect tile(rect.left(), top, rect.width(), qMin(TILE_HEIGHT, rect.bottom() + 1 - top));
+                ImageScalerTask task;
+                if (scaler->d->prepareTask(tile, &task)) {
+                    task.mScaler = scaler;
+                    tasks << task;
+                }
+            }
+        }
+    }
+    mPendingRegions.clear();
+    if (tasks.isEmpty()) {
+        return;
+    }
+
+    // The GUI thread scales too, so that it never waits for a task which
+    // could not start because the pool is busy
+    TraceSpan span("scale", "flush");
+    if (Tracer::isEnabled()) {
+        span.setDetail(QStringLiteral("%1 tasks").arg(tasks.count()));
+    }
+    ImageScalerTask* taskData = tasks.data();
+    TaskScheduler::instance()->runAndWait(TaskScheduler::ViewClass, tasks.count(), [taskData](int idx) {
+        taskData[idx].run();
+    });
+
+    // Emit all results in one go, so that views are painted together
+    for (const ImageScalerTask& task : qAsConst(tasks)) {
+        // A slot may have deleted a scaler
+        if (task.mScaler) {
+            emit task.mScaler->scaledRect(task.mDestPos.x(), task.mDestPos.y(), task.mResult);
+        }
+    }
+}
+
 ImageScaler::ImageScaler(QObject* parent)
 : QObject(parent)
 , d(new ImageScalerPrivate)
 {
-    d->mTransformationMode = Qt::FastTransformation;
+    d->mScalingQuality = ScalingQuality::Normal;
+    d->mFilter = ImageResampler::NearestFilter;
     d->mZoom = 0;
+    d->mSharedRendering = false;
 }
 
 ImageScaler::~ImageScaler()
 {
+    if (sImageScalerScheduler.exists()) {
+        sImageScalerScheduler->forget(this);
+    }
     delete d;
 }
 
@@ -72,27 +199,72 @@ void ImageScaler::setDocument(Document::Ptr document)
         disconnect(d->mDocument.data(), nullptr, this, nullptr);
     }
     d->mDocument = document;
+    if (sImageScalerScheduler.exists()) {
+        sImageScalerScheduler->forget(this);
+    }
     // Used when scaler asked for a down-sampled image
     connect(d->mDocument.data(), SIGNAL(downSampledImageReady()),
             SLOT(doScale()));
     // Used when scaler asked for a full image
     connect(d->mDocument.data(), SIGNAL(loaded(QUrl)),
             SLOT(doScale()));
+    // Used when scaler asked for regions of a huge image
+    connect(d->mDocument.data(), &Document::regionReady, this, [this]() {
+        if (!d->mWaitingRegion.isEmpty()) {
+            d->mRegion = d->mWaitingRegion;
+            d->mWaitingRegion = QRegion();
+            doScale();
+        }
+    });
+    d->mWaitingRegion = QRegion();
 }
 
 void ImageScaler::setZoom(qreal zoom)
 {
-    // If we zoom to 400% or more, then assume the user wants to see the real
-    // pixels, for example to fine tune a crop operation
-    d->mTransformationMode = zoom < 4. ? Qt::SmoothTransformation
-                                       : Qt::FastTransformation;
-
+    d->mFilter = filterForZoom(d->mScalingQuality, zoom);
     d->mZoom = zoom;
+    d->mWaitingRegion = QRegion();
+    // Queued regions are in the coordinates of the previous zoom
+    if (sImageScalerScheduler.exists()) {
+        sImageScalerScheduler->forget(this);
+    }
+}
+
+void ImageScaler::setScalingQuality(ScalingQuality::Enum quality)
+{
+    d->mScalingQuality = quality;
+    d->mFilter = filterForZoom(quality, d->mZoom);
+}
+
+ImageResampler::Filter ImageScaler::filterForZoom(ScalingQuality::Enum quality, qreal zoom)
+{
+    if (zoom < 1.) {
+        switch (quality) {
+        case ScalingQuality::Fast:
+            return ImageResampler::BoxFilter;
+        case ScalingQuality::Normal:
+            // Qt smooth scaling has SIMD code paths, keep it on the default
+            // path. The filters of ImageResampler are plain C++.
+            return ImageResampler::BilinearFilter;
+        case ScalingQuality::High:
+            return ImageResampler::Lanczos3Filter;
+        }
+    }
+    // When zooming in enough, assume the user wants to see the real pixels,
+    // for example to fine tune a crop operation
+    switch (quality) {
+    case ScalingQuality::Fast:
+        return ImageResampler::NearestFilter;
+    case ScalingQuality::Normal:
+        return zoom < 4. ? ImageResampler::BilinearFilter : ImageResampler::NearestFilter;
+    case ScalingQuality::High:
+        return zoom < 8. ? ImageResampler::MitchellFilter : ImageResampler::NearestFilter;
+    }
+    return ImageResampler::NearestFilter;
 }
 
 void ImageScaler::setDestinationRegion(const QRegion& region)
 {
-    LOG(region);
     d->mRegion = region;
     if (d->mRegion.isEmpty()) {
         return;
@@ -103,46 +275,94 @@ void ImageScaler::setDestinationRegion(const QRegion& region)
     }
 }
 
+void ImageScaler::setSharedRendering(bool shared)
+{
+    d->mSharedRendering = shared;
+    if (!shared && sImageScalerScheduler.exists()) {
+        sImageScalerScheduler->forget(this);
+    }
+}
+
 void ImageScaler::doScale()
 {
     if (d->mZoom < Document::maxDownSampledZoom()) {
         if (!d->mDocument->prepareDownSampledImageForZoom(d->mZoom)) {
-            LOG("Asked for a down sampled image");
+            GV_TRACE_EVENT("scale", "waitDownSampledImage", QString());
             return;
         }
-    } else if (d->mDocument->image().isNull()) {
-        LOG("Asked for the full image");
+    } else if (d->mDocument->image().isNull() && !d->regionDecoder()) {
+        GV_TRACE_EVENT("scale", "waitFullImage", QString());
         d->mDocument->startLoadingFullImage();
         return;
     }
 
-    LOG("Starting");
+    if (d->mSharedRendering) {
+        sImageScalerScheduler->request(this, d->mRegion);
+        return;
+    }
+
     Q_FOREACH(const QRect & rect, d->mRegion.rects()) {
-        LOG(rect);
         scaleRect(rect);
     }
-    LOG("Done");
 }
 
-void ImageScaler::scaleRect(const QRect& rect)
+bool ImageScalerPrivate::prepareTask(const QRect& rect, ImageScalerTask* task)
 {
-    const qreal REAL_DELTA = 0.001;
-    if (qAbs(d->mZoom - 1.0) < REAL_DELTA) {
-        QImage tmp = d->mDocument->image().copy(rect);
-        emit scaledRect(rect.left(), rect.top(), tmp);
-        return;
-    }
+    task->mFilter = mFilter;
 
     QImage image;
+    RegionDecoder* decoder = nullptr;
+    QRect imageRect;
     qreal zoom;
-    if (d->mZoom < Document::maxDownSampledZoom()) {
-        image = d->mDocument->downSampledImageForZoom(d->mZoom);
+    if (mZoom < Document::maxDownSampledZoom()) {
+        image = mDocument->downSampledImageForZoom(mZoom);
         Q_ASSERT(!image.isNull());
-        qreal zoom1 = qreal(image.width()) / d->mDocument->width();
-        zoom = d->mZoom / zoom1;
+        qreal zoom1 = qreal(image.width()) / mDocument->width();
+        zoom = mZoom / zoom1;
+        imageRect = image.rect();
     } else {
-        image = d->mDocument->image();
-        zoom = d->mZoom;
+        image = mDocument->image();
+        zoom = mZoom;
+        if (image.isNull()) {
+            decoder = regionDecoder();
+            imageRect = QRect(QPoint(0, 0), mDocument->size());
+        } else {
+            imageRect = image.rect();
+        }
+    }
+    if (image.isNull() && !decoder) {
+        return false;
+    }
+
+    // Only the part of the image around sourceRect is decoded, translate
+    // sourceRect to it
+    auto setTaskImage = [this, &image, decoder, &rect, task](const QRect& sourceRect) {
+        if (!decoder) {
+            task->mImage = image;
+            task->mSourceRect = sourceRect;
+            return true;
+        }
+        task->mImage = decoder->region(sourceRect);
+        if (task->mImage.isNull()) {
+            GV_TRACE_EVENT("scale", "waitRegion", QStringLiteral("%1x%2+%3+%4")
+                           .arg(sourceRect.width()).arg(sourceRect.height()).arg(sourceRect.x()).arg(sourceRect.y()));
+            decoder->prepareRegion(sourceRect);
+            mWaitingRegion |= rect;
+            return false;
+        }
+        task->mSourceRect = task->mImage.rect();
+        return true;
+    };
+
+    const qreal REAL_DELTA = 0.001;
+    if (qAbs(mZoom - 1.0) < REAL_DELTA) {
+        const QRect sourceRect = rect & imageRect;
+        if (sourceRect.isEmpty() || !setTaskImage(sourceRect)) {
+            return false;
+        }
+        task->mDestSize = sourceRect.size();
+        task->mDestPos = sourceRect.topLeft();
+        return true;
     }
     // If rect contains "half" pixels, make sure sourceRect includes them
     QRectF sourceRectF(
@@ -151,22 +371,23 @@ void ImageScaler::scaleRect(const QRect& rect)
         rect.width() / zoom,
         rect.height() / zoom);
 
-    sourceRectF = sourceRectF.intersected(image.rect());
+    sourceRectF = sourceRectF.intersected(imageRect);
     QRect sourceRect = PaintUtils::containingRect(sourceRectF);
     if (sourceRect.isEmpty()) {
-        return;
+        return false;
     }
 
     // Compute smooth margin
-    bool needsSmoothMargins = d->mTransformationMode == Qt::SmoothTransformation;
+    const int margin = ImageResampler::sourceMargin(mFilter, zoom);
+    bool needsSmoothMargins = margin > 0;
 
     int sourceLeftMargin, sourceRightMargin, sourceTopMargin, sourceBottomMargin;
     int destLeftMargin, destRightMargin, destTopMargin, destBottomMargin;
     if (needsSmoothMargins) {
-        sourceLeftMargin = qMin(sourceRect.left(), SMOOTH_MARGIN);
-        sourceTopMargin = qMin(sourceRect.top(), SMOOTH_MARGIN);
-        sourceRightMargin = qMin(image.rect().right() - sourceRect.right(), SMOOTH_MARGIN);
-        sourceBottomMargin = qMin(image.rect().bottom() - sourceRect.bottom(), SMOOTH_MARGIN);
+        sourceLeftMargin = qMin(sourceRect.left(), margin);
+        sourceTopMargin = qMin(sourceRect.top(), margin);
+        sourceRightMargin = qMin(imageRect.right() - sourceRect.right(), margin);
+        sourceBottomMargin = qMin(imageRect.bottom() - sourceRect.bottom(), margin);
         sourceRect.adjust(
             -sourceLeftMargin,
             -sourceTopMargin,
@@ -190,23 +411,28 @@ void ImageScaler::scaleRect(const QRect& rect)
                        );
     QRect destRect = PaintUtils::containingRect(destRectF);
 
-    QImage tmp;
-    tmp = image.copy(sourceRect);
-    tmp = tmp.scaled(
-              destRect.width(),
-              destRect.height(),
-              Qt::IgnoreAspectRatio, // Do not use KeepAspectRatio, it can lead to skipped rows or columns
-              d->mTransformationMode);
-
+    if (!setTaskImage(sourceRect)) {
+        return false;
+    }
+    task->mDestSize = destRect.size();
     if (needsSmoothMargins) {
-        tmp = tmp.copy(
-                  destLeftMargin, destTopMargin,
-                  destRect.width() - (destLeftMargin + destRightMargin),
-                  destRect.height() - (destTopMargin + destBottomMargin)
-              );
+        task->mCropRect = QRect(
+                              destLeftMargin, destTopMargin,
+                              destRect.width() - (destLeftMargin + destRightMargin),
+                              destRect.height() - (destTopMargin + destBottomMargin)
+                          );
     }
+    task->mDestPos = QPoint(destRect.left() + destLeftMargin, destRect.top() + destTopMargin);
+    return true;
+}
 
-    emit scaledRect(destRect.left() + destLeftMargin, destRect.top() + destTopMargin, tmp);
+void ImageScaler::scaleRect(const QRect& rect)
+{
+    ImageScalerTask task;
+    if (d->prepareTask(rect, &task)) {
+        task.run();
+        emit scaledRect(task.mDestPos.x(), task.mDestPos.y(), task.mResult);
+    }
 }
 
 } // namespace
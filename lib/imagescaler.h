@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 // local
 #include <lib/gwenviewlib_export.h>
+#include <lib/imageresampler.h>
+#include <lib/scalingquality.h>
 #include <document/document.h>
 
 class QImage;
@@ -39,6 +41,7 @@ namespace Gwenview
 class Document;
 
 struct ImageScalerPrivate;
+class ImageScalerScheduler;
 class GWENVIEWLIB_EXPORT ImageScaler : public QObject
 {
     Q_OBJECT
@@ -49,12 +52,32 @@ public:
     void setZoom(qreal);
     void setDestinationRegion(const QRegion&);
 
+    /**
+     * Defaults to ScalingQuality::Normal
+     */
+    void setScalingQuality(ScalingQuality::Enum);
+
+    /**
+     * The filter used to show an image at @p zoom
+     */
+    static ImageResampler::Filter filterForZoom(ScalingQuality::Enum quality, qreal zoom);
+
+    /**
+     * When enabled, rects are not scaled as soon as they are requested. The
+     * requests of all scalers are gathered until the event loop runs, split
+     * into tiles, scaled in parallel, and scaledRect() is emitted for all of
+     * them before the views are painted. This keeps views showing several
+     * images at once, like in compare mode, in sync. Defaults to false.
+     */
+    void setSharedRendering(bool);
+
 Q_SIGNALS:
     void scaledRect(int left, int top, const QImage&);
 
 private:
     ImageScalerPrivate * const d;
     void scaleRect(const QRect&);
+    friend class ImageScalerScheduler;
 
 private Q_SLOTS:
     void doScale();
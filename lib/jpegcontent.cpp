@@ -226,7 +226,7 @@ bool JpegContent::loadFromData(const QByteArray& data)
     return loadFromData(data, image.get());
 }
 
-bool JpegContent::loadFromData(const QByteArray& data, Exiv2::Image* exiv2Image)
+bool JpegContent::loadFromData(const QByteArray& data, Exiv2::Image* exiv2Image, const QSize& size)
 {
     d->mPendingTransformation = false;
     d->mTransformMatrix.reset();
@@ -237,7 +237,11 @@ bool JpegContent::loadFromData(const QByteArray& data, Exiv2::Image* exiv2Image)
         return false;
     }
 
-    if (!d->readSize()) return false;
+    if (size.isValid()) {
+        d->mSize = size;
+    } else if (!d->readSize()) {
+        return false;
+    }
 
     d->mExifData = exiv2Image->exifData();
     d->mComment = QString::fromUtf8(exiv2Image->comment().c_str());
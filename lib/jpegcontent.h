@@ -25,8 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <lib/orientation.h>
 #include <lib/gwenviewlib_export.h>
 #include <QByteArray>
+#include <QSize>
 class QImage;
-class QSize;
 class QString;
 class QIODevice;
 
@@ -67,9 +67,12 @@ public:
     bool load(const QString& file);
     bool loadFromData(const QByteArray& rawData);
     /**
-     * Use this version of loadFromData if you already have an Exiv2::Image*
+     * Use this version of loadFromData if you already have an Exiv2::Image*.
+     * If @p size is valid, it is used instead of reading the JPEG header
+     * again. It must be the size of the stored image, as returned by
+     * ImageHeader::size().
      */
-    bool loadFromData(const QByteArray& rawData, Exiv2::Image*);
+    bool loadFromData(const QByteArray& rawData, Exiv2::Image*, const QSize& size = QSize());
     bool save(const QString& file);
     bool save(QIODevice*);
 
@@ -0,0 +1,178 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "memoryregistry.h"
+
+// STL
+#include <algorithm>
+
+// Qt
+#include <QCoreApplication>
+#include <QDebug>
+#include <QLocale>
+#include <QPointer>
+#include <QStringList>
+#include <QTimer>
+
+// Local
+#include "memoryutils.h"
+#include "tracer.h"
+
+namespace Gwenview
+{
+
+// How often the free memory is checked
+static const int CHECK_INTERVAL = 5000;
+
+// Memory is low when less than 1/LOW_MEMORY_RATIO of it is free, and is back
+// to normal when more than 1/NORMAL_MEMORY_RATIO of it is free. The gap keeps
+// memoryPressure() from being emitted again and again around the limit.
+static const qulonglong LOW_MEMORY_RATIO = 10;
+static const qulonglong NORMAL_MEMORY_RATIO = 8;
+
+struct MemoryRegistryPrivate
+{
+    struct Cache {
+        QString mName;
+        MemoryRegistry::Reporter mReporter;
+        QPointer<QObject> mOwner;
+        bool mHasOwner;
+    };
+
+    MemoryRegistry* q;
+    QList<Cache> mCaches;
+    // Owned by the application: the registry itself is only destroyed after
+    // it, too late for a timer
+    QPointer<QTimer> mCheckTimer;
+    bool mMemoryIsLow = false;
+
+    void checkFreeMemory()
+    {
+        const qulonglong total = MemoryUtils::getTotalMemory();
+        const qulonglong free = MemoryUtils::getFreeMemory();
+        if (total == 0 || free == 0) {
+            // Not supported on this platform
+            return;
+        }
+        if (mMemoryIsLow) {
+            mMemoryIsLow = free * NORMAL_MEMORY_RATIO < total;
+            return;
+        }
+        if (free * LOW_MEMORY_RATIO < total) {
+            GV_TRACE_EVENT("memory", "memoryPressure",
+                           QStringLiteral("%1 MB free, caches use %2 MB").arg(free / (1024 * 1024)).arg(q->totalBytes() / (1024 * 1024)));
+            mMemoryIsLow = true;
+            emit q->memoryPressure();
+        }
+    }
+};
+
+MemoryRegistry::MemoryRegistry()
+: d(new MemoryRegistryPrivate)
+{
+    d->q = this;
+    if (!QCoreApplication::instance()) {
+        qWarning() << "MemoryRegistry created without an application, free memory will not be checked";
+        return;
+    }
+    d->mCheckTimer = new QTimer(QCoreApplication::instance());
+    d->mCheckTimer->setInterval(CHECK_INTERVAL);
+    connect(d->mCheckTimer, &QTimer::timeout, this, [this]() {
+        d->checkFreeMemory();
+    });
+    d->mCheckTimer->start();
+}
+
+MemoryRegistry::~MemoryRegistry()
+{
+    delete d->mCheckTimer;
+    delete d;
+}
+
+MemoryRegistry* MemoryRegistry::instance()
+{
+    static MemoryRegistry registry;
+    return &registry;
+}
+
+void MemoryRegistry::addCache(const QString& name, const Reporter& reporter, QObject* owner)
+{
+    MemoryRegistryPrivate::Cache cache;
+    cache.mName = name;
+    cache.mReporter = reporter;
+    cache.mOwner = owner;
+    cache.mHasOwner = owner != nullptr;
+    d->mCaches << cache;
+}
+
+QList<MemoryRegistry::CacheUsage> MemoryRegistry::cacheUsages() const
+{
+    // Forget the caches whose owner is gone
+    auto it = std::remove_if(d->mCaches.begin(), d->mCaches.end(), [](const MemoryRegistryPrivate::Cache& cache) {
+        return cache.mHasOwner && !cache.mOwner;
+    });
+    d->mCaches.erase(it, d->mCaches.end());
+
+    QList<CacheUsage> list;
+    for (const MemoryRegistryPrivate::Cache& cache : qAsConst(d->mCaches)) {
+        CacheUsage usage;
+        usage.name = cache.mName;
+        cache.mReporter(&usage);
+        list << usage;
+    }
+    return list;
+}
+
+qlonglong MemoryRegistry::totalBytes() const
+{
+    qlonglong total = 0;
+    const QList<CacheUsage> usages = cacheUsages();
+    for (const CacheUsage& usage : usages) {
+        total += usage.bytes;
+    }
+    return total;
+}
+
+QString MemoryRegistry::report() const
+{
+    const QLocale locale = QLocale::c();
+    QStringList lines;
+    const QList<CacheUsage> usages = cacheUsages();
+    for (const CacheUsage& usage : usages) {
+        QString line = QStringLiteral("%1: %2 entries, %3 KB")
+            .arg(usage.name)
+            .arg(usage.entries)
+            .arg(locale.toString(usage.bytes / 1024));
+        if (usage.hits + usage.misses > 0) {
+            line += QStringLiteral(", %1 hits, %2 misses").arg(usage.hits).arg(usage.misses);
+        }
+        lines << line;
+    }
+    lines << QStringLiteral("Free memory: %1 KB").arg(locale.toString(MemoryUtils::getFreeMemory() / 1024));
+    return lines.join(QLatin1Char('\n'));
+}
+
+void MemoryRegistry::releaseMemory()
+{
+    emit memoryPressure();
+}
+
+} // namespace
@@ -0,0 +1,110 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef MEMORYREGISTRY_H
+#define MEMORYREGISTRY_H
+
+#include <lib/gwenviewlib_export.h>
+
+// STL
+#include <functional>
+
+// Qt
+#include <QList>
+#include <QObject>
+#include <QString>
+
+namespace Gwenview
+{
+
+struct MemoryRegistryPrivate;
+/**
+ * Keeps track of the memory used by the caches of Gwenview.
+ *
+ * Each cache registers a function reporting its size. The registry also
+ * watches the free memory of the system and emits memoryPressure() when it
+ * gets low, so that caches can release what they can reload.
+ *
+ * Must only be used from the main thread.
+ */
+class GWENVIEWLIB_EXPORT MemoryRegistry : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.gwenview.MemoryUsage")
+public:
+    struct CacheUsage {
+        QString name;
+        qint64 bytes = 0;
+        int entries = 0;
+        // Lookups which found or did not find their entry, for the caches
+        // which count them
+        qint64 hits = 0;
+        qint64 misses = 0;
+    };
+
+    /**
+     * Fills the bytes and entries fields of a CacheUsage, and the hits and
+     * misses fields if the cache counts them
+     */
+    typedef std::function<void(CacheUsage*)> Reporter;
+
+    static MemoryRegistry* instance();
+
+    /**
+     * Registers a cache. If @p owner is set, the cache is unregistered when
+     * @p owner is destroyed.
+     */
+    void addCache(const QString& name, const Reporter& reporter, QObject* owner = nullptr);
+
+    QList<CacheUsage> cacheUsages() const;
+
+    ~MemoryRegistry() override;
+
+public Q_SLOTS:
+    /**
+     * Sum of the bytes used by all caches
+     */
+    Q_SCRIPTABLE qlonglong totalBytes() const;
+
+    /**
+     * One line per cache, for debugging
+     */
+    Q_SCRIPTABLE QString report() const;
+
+    /**
+     * Emits memoryPressure(), as if memory was low
+     */
+    Q_SCRIPTABLE void releaseMemory();
+
+Q_SIGNALS:
+    /**
+     * Emitted when the free memory of the system gets low. Caches should
+     * release what they can reload.
+     */
+    Q_SCRIPTABLE void memoryPressure();
+
+private:
+    MemoryRegistry();
+    MemoryRegistryPrivate* const d;
+};
+
+} // namespace
+
+#endif /* MEMORYREGISTRY_H */
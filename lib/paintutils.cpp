@@ -20,8 +20,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "paintutils.h"
 
 #include <math.h>
+#include <string.h>
 
 // Qt
+#include <QImage>
 #include <QPainter>
 #include <QPainterPath>
 #include <QPixmap>
@@ -152,5 +154,49 @@ QRect containingRect(const QRectF& rectF)
     // Note: QRect::right = left + width - 1, while QRectF::right = left + width
 }
 
+QRect changedRect(const QImage& previous, const QImage& image)
+{
+    if (previous.isNull() || previous.size() != image.size() || previous.format() != image.format()
+            || previous.colorTable() != image.colorTable()) {
+        return image.rect();
+    }
+    const int height = image.height();
+    const int lineLength = (image.width() * image.depth() + 7) / 8;
+    int top = 0;
+    while (top < height && memcmp(previous.constScanLine(top), image.constScanLine(top), lineLength) == 0) {
+        ++top;
+    }
+    if (top == height) {
+        return QRect();
+    }
+    int bottom = height - 1;
+    while (bottom > top && memcmp(previous.constScanLine(bottom), image.constScanLine(bottom), lineLength) == 0) {
+        --bottom;
+    }
+    if (image.depth() != 32) {
+        return QRect(0, top, image.width(), bottom - top + 1);
+    }
+
+    int left = image.width();
+    int right = -1;
+    for (int y = top; y <= bottom; ++y) {
+        const QRgb* previousLine = reinterpret_cast<const QRgb*>(previous.constScanLine(y));
+        const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < left; ++x) {
+            if (previousLine[x] != line[x]) {
+                left = x;
+                break;
+            }
+        }
+        for (int x = image.width() - 1; x > right; --x) {
+            if (previousLine[x] != line[x]) {
+                right = x;
+                break;
+            }
+        }
+    }
+    return QRect(left, top, right - left + 1, bottom - top + 1);
+}
+
 } // namespace
 } // namespace
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <lib/gwenviewlib_export.h>
 #include <QtGlobal>
 class QColor;
+class QImage;
 class QPainterPath;
 class QPixmap;
 class QRect;
@@ -67,6 +68,13 @@ GWENVIEWLIB_EXPORT QColor alphaAdjustedF(const QColor& color, qreal alphaF);
  */
 GWENVIEWLIB_EXPORT QRect containingRect(const QRectF& rectF);
 
+/**
+ * Returns the bounding rect of the pixels which differ between @p previous
+ * and @p image, or the whole rect of @p image if they cannot be compared.
+ * For images which are not 32 bits per pixel, only rows are compared.
+ */
+GWENVIEWLIB_EXPORT QRect changedRect(const QImage& previous, const QImage& image);
+
 } // namespace
 
 } // namespace
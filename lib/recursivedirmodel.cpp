@@ -30,54 +30,101 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Qt
 #include <QDebug>
+#include <QQueue>
+#include <QSet>
+
+// STL
+#include <algorithm>
 
 namespace Gwenview
 {
 
+/**
+ * Maximum number of sub dirs we list at the same time. Listing more does not
+ * make things faster, especially on network shares, and starves the GUI.
+ */
+static const int MAX_CONCURRENT_DIR_LISTINGS = 4;
+
 struct RecursiveDirModelPrivate {
     KDirLister* mDirLister;
 
-    int rowForUrl(const QUrl &url) const
+    QQueue<QUrl> mPendingDirUrls;
+    QSet<QUrl> mListingDirUrls;
+    // Union of mPendingDirUrls and mListingDirUrls, for fast lookups
+    QSet<QUrl> mScheduledDirUrls;
+
+    RecursiveDirModelPrivate()
+    : mDirLister(nullptr)
+    , mFirstDirtyRow(0)
+    {}
+
+    bool contains(const QUrl &url) const
     {
-        return mRowForUrl.value(url, -1);
+        return mRowForUrl.contains(url);
     }
 
-    void removeAt(int row)
+    int rowForUrl(const QUrl &url) const
     {
-        KFileItem item = mList.takeAt(row);
-        mRowForUrl.remove(item.url());
+        int row = mRowForUrl.value(url, -1);
+        if (row >= mFirstDirtyRow) {
+            updateRowForUrl();
+            row = mRowForUrl.value(url, -1);
+        }
+        return row;
+    }
 
-        // Decrease row value for all urls after the one we removed
-        // ("row" now points to the item after the one we removed since we used takeAt)
-        const int count = mList.count();
-        for (; row < count; ++row) {
-            QUrl url = mList.at(row).url();
-            mRowForUrl[url]--;
+    /**
+     * Remove items from first to last, inclusive. Row values of the following
+     * items are not updated right away: they are recomputed the next time
+     * they are needed, so that removing a batch of items costs a single pass.
+     */
+    void removeRange(int first, int last)
+    {
+        for (int row = first; row <= last; ++row) {
+            mRowForUrl.remove(mList.at(row).url());
         }
+        mList.erase(mList.begin() + first, mList.begin() + last + 1);
+        mFirstDirtyRow = qMin(mFirstDirtyRow, first);
     }
 
     void addItem(const KFileItem& item)
     {
         mRowForUrl.insert(item.url(), mList.count());
         mList.append(item);
+        if (mFirstDirtyRow == mList.count() - 1) {
+            // Nothing is dirty, keep it that way
+            mFirstDirtyRow = mList.count();
+        }
     }
 
     void clear()
     {
         mRowForUrl.clear();
         mList.clear();
+        mFirstDirtyRow = 0;
     }
 
     // RecursiveDirModel can only access mList through this read-only getter.
     // This ensures it cannot introduce inconsistencies between mList and mRowForUrl.
-    const KFileItemList& list() const
+    const QVector<KFileItem>& list() const
     {
         return mList;
     }
 
 private:
-    KFileItemList mList;
-    QHash<QUrl, int> mRowForUrl;
+    QVector<KFileItem> mList;
+    // Row values are only valid for rows < mFirstDirtyRow
+    mutable QHash<QUrl, int> mRowForUrl;
+    mutable int mFirstDirtyRow;
+
+    void updateRowForUrl() const
+    {
+        const int count = mList.count();
+        for (int row = mFirstDirtyRow; row < count; ++row) {
+            mRowForUrl[mList.at(row).url()] = row;
+        }
+        mFirstDirtyRow = count;
+    }
 };
 
 RecursiveDirModel::RecursiveDirModel(QObject* parent)
@@ -87,7 +134,9 @@ RecursiveDirModel::RecursiveDirModel(QObject* parent)
     d->mDirLister = new KDirLister(this);
     connect(d->mDirLister, &KDirLister::itemsAdded, this, &RecursiveDirModel::slotItemsAdded);
     connect(d->mDirLister, &KDirLister::itemsDeleted, this, &RecursiveDirModel::slotItemsDeleted);
-    connect(d->mDirLister, QOverload<>::of(&KDirLister::completed), this, &RecursiveDirModel::completed);
+    connect(d->mDirLister, QOverload<>::of(&KDirLister::completed), this, &RecursiveDirModel::slotListerCompleted);
+    connect(d->mDirLister, QOverload<const QUrl &>::of(&KDirLister::completed), this, &RecursiveDirModel::slotDirCompleted);
+    connect(d->mDirLister, QOverload<const QUrl &>::of(&KDirLister::canceled), this, &RecursiveDirModel::slotDirCompleted);
     connect(d->mDirLister, QOverload<>::of(&KDirLister::clear), this, &RecursiveDirModel::slotCleared);
     connect(d->mDirLister, QOverload<const QUrl &>::of(&KDirLister::clear), this, &RecursiveDirModel::slotDirCleared);
 }
@@ -107,6 +156,9 @@ void RecursiveDirModel::setUrl(const QUrl &url)
     beginResetModel();
     d->clear();
     endResetModel();
+    d->mPendingDirUrls.clear();
+    d->mListingDirUrls.clear();
+    d->mScheduledDirUrls.clear();
     d->mDirLister->openUrl(url);
 }
 
@@ -149,7 +201,7 @@ void RecursiveDirModel::slotItemsAdded(const QUrl&, const KFileItemList& newList
     KFileItemList fileList;
     Q_FOREACH(const KFileItem& item, newList) {
         if (item.isFile()) {
-            if (d->rowForUrl(item.url()) == -1) {
+            if (!d->contains(item.url())) {
                 fileList << item;
             }
         } else {
@@ -158,7 +210,7 @@ void RecursiveDirModel::slotItemsAdded(const QUrl&, const KFileItemList& newList
     }
 
     if (!fileList.isEmpty()) {
-        beginInsertRows(QModelIndex(), d->list().count(), d->list().count() + fileList.count());
+        beginInsertRows(QModelIndex(), d->list().count(), d->list().count() + fileList.count() - 1);
         Q_FOREACH(const KFileItem& item, fileList) {
             d->addItem(item);
         }
@@ -166,12 +218,14 @@ void RecursiveDirModel::slotItemsAdded(const QUrl&, const KFileItemList& newList
     }
 
     Q_FOREACH(const QUrl &url, dirUrls) {
-        d->mDirLister->openUrl(url, KDirLister::Keep);
+        scheduleDirListing(url);
     }
 }
 
 void RecursiveDirModel::slotItemsDeleted(const KFileItemList& list)
 {
+    QVector<int> rows;
+    rows.reserve(list.count());
     Q_FOREACH(const KFileItem& item, list) {
         if (item.isDir()) {
             continue;
@@ -182,10 +236,9 @@ void RecursiveDirModel::slotItemsDeleted(const KFileItemList& list)
             GV_FATAL_FAILS;
             continue;
         }
-        beginRemoveRows(QModelIndex(), row, row);
-        d->removeAt(row);
-        endRemoveRows();
+        rows << row;
     }
+    removeRowList(rows);
 }
 
 void RecursiveDirModel::slotCleared()
@@ -200,15 +253,77 @@ void RecursiveDirModel::slotCleared()
 
 void RecursiveDirModel::slotDirCleared(const QUrl &dirUrl)
 {
-    int row;
-    for (row = d->list().count() - 1; row >= 0; --row) {
+    QVector<int> rows;
+    const int count = d->list().count();
+    for (int row = 0; row < count; ++row) {
         const QUrl url = d->list().at(row).url();
         if (dirUrl.isParentOf(url)) {
-            beginRemoveRows(QModelIndex(), row, row);
-            d->removeAt(row);
-            endRemoveRows();
+            rows << row;
+        }
+    }
+    removeRowList(rows);
+}
+
+void RecursiveDirModel::removeRowList(QVector<int> rows)
+{
+    if (rows.isEmpty()) {
+        return;
+    }
+    std::sort(rows.begin(), rows.end());
+
+    // Remove contiguous ranges, starting from the end so that the rows of the
+    // ranges we have not removed yet remain valid
+    int last = rows.count() - 1;
+    while (last >= 0) {
+        int first = last;
+        while (first > 0 && rows.at(first - 1) >= rows.at(first) - 1) {
+            --first;
         }
+        const int firstRow = rows.at(first);
+        const int lastRow = rows.at(last);
+        beginRemoveRows(QModelIndex(), firstRow, lastRow);
+        d->removeRange(firstRow, lastRow);
+        endRemoveRows();
+        last = first - 1;
+    }
+}
+
+void RecursiveDirModel::scheduleDirListing(const QUrl &url)
+{
+    if (d->mScheduledDirUrls.contains(url)) {
+        return;
+    }
+    d->mScheduledDirUrls.insert(url);
+    d->mPendingDirUrls.enqueue(url);
+    startPendingDirListings();
+}
+
+void RecursiveDirModel::startPendingDirListings()
+{
+    while (!d->mPendingDirUrls.isEmpty() && d->mListingDirUrls.count() < MAX_CONCURRENT_DIR_LISTINGS) {
+        const QUrl url = d->mPendingDirUrls.dequeue();
+        d->mListingDirUrls.insert(url);
+        d->mDirLister->openUrl(url, KDirLister::Keep);
+    }
+}
+
+void RecursiveDirModel::slotDirCompleted(const QUrl &url)
+{
+    if (d->mListingDirUrls.remove(url)) {
+        d->mScheduledDirUrls.remove(url);
+        startPendingDirListings();
+    }
+}
+
+void RecursiveDirModel::slotListerCompleted()
+{
+    // The dir lister has nothing left to do, but we may still have sub dirs
+    // waiting for a free listing slot
+    if (!d->mPendingDirUrls.isEmpty()) {
+        startPendingDirListings();
+        return;
     }
+    emit completed();
 }
 
 } // namespace
@@ -29,6 +29,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Qt
 #include <QAbstractListModel>
+#include <QVector>
 
 class QUrl;
 
@@ -38,6 +39,9 @@ namespace Gwenview
 struct RecursiveDirModelPrivate;
 /**
  * Recursively list content of a dir
+ *
+ * Sub dirs are listed through a bounded queue so that recursing into a large
+ * tree does not flood KIO with hundreds of simultaneous listing jobs.
  */
 class GWENVIEWLIB_EXPORT RecursiveDirModel : public QAbstractListModel
 {
@@ -60,8 +64,14 @@ private Q_SLOTS:
     void slotItemsDeleted(const KFileItemList&);
     void slotDirCleared(const QUrl&);
     void slotCleared();
+    void slotDirCompleted(const QUrl&);
+    void slotListerCompleted();
 private:
     RecursiveDirModelPrivate* const d;
+
+    void scheduleDirListing(const QUrl&);
+    void startPendingDirListings();
+    void removeRowList(QVector<int> rows);
 };
 
 } // namespace
@@ -107,6 +107,11 @@ void RedEyeReductionImageOperation::undo()
     finish(true);
 }
 
+qint64 RedEyeReductionImageOperation::memoryUsage() const
+{
+    return d->mOriginalImage.byteCount();
+}
+
 /**
  * This code is inspired from code found in a Paint.net plugin:
  * http://paintdotnet.forumer.com/viewtopic.php?f=27&t=26193&p=205954&hilit=red+eye#p205954
@@ -44,6 +44,7 @@ public:
 
     void redo() override;
     void undo() override;
+    qint64 memoryUsage() const override;
 
     static void apply(QImage* img, const QRectF& rectF);
 
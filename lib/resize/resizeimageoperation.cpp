@@ -92,4 +92,9 @@ void ResizeImageOperation::undo()
     finish(true);
 }
 
+qint64 ResizeImageOperation::memoryUsage() const
+{
+    return d->mOriginalImage.byteCount();
+}
+
 } // namespace
@@ -42,6 +42,7 @@ public:
 
     void redo() override;
     void undo() override;
+    qint64 memoryUsage() const override;
 
 private:
     ResizeImageOperationPrivate* const d;
@@ -31,6 +31,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 // Local
 #include "abstractsemanticinfobackend.h"
 #include "../archiveutils.h"
+#include "../memoryregistry.h"
 
 #ifdef GWENVIEW_SEMANTICINFO_BACKEND_FAKE
 #include "fakesemanticinfobackend.h"
@@ -80,6 +81,16 @@ SemanticInfoDirModel::SemanticInfoDirModel(QObject* parent)
     connect(this, &SemanticInfoDirModel::modelAboutToBeReset, this, &SemanticInfoDirModel::slotModelAboutToBeReset);
 
     connect(this, &SemanticInfoDirModel::rowsAboutToBeRemoved, this, &SemanticInfoDirModel::slotRowsAboutToBeRemoved);
+
+    // Entries are dropped with their rows, there is nothing to release
+    MemoryRegistry::instance()->addCache(QStringLiteral("Semantic info"), [this](MemoryRegistry::CacheUsage* usage) {
+        for (const SemanticInfoCacheItem& item : qAsConst(d->mSemanticInfoCache)) {
+            usage->bytes += sizeof(QUrl) + sizeof(SemanticInfoCacheItem)
+                + item.mInfo.mDescription.size() * sizeof(QChar)
+                + item.mInfo.mTags.count() * sizeof(QString);
+        }
+        usage->entries = d->mSemanticInfoCache.count();
+    }, this);
 }
 
 SemanticInfoDirModel::~SemanticInfoDirModel()
@@ -203,7 +214,7 @@ bool SemanticInfoDirModel::setData(const QModelIndex& index, const QVariant& dat
             // We should never reach this part
             Q_ASSERT(0);
         }
-        emit dataChanged(index, index);
+        emit dataChanged(index, index, {role});
 
         d->mBackEnd->storeSemanticInfo(url, semanticInfo);
         return true;
@@ -226,7 +237,7 @@ void SemanticInfoDirModel::slotSemanticInfoRetrieved(const QUrl &url, const Sema
     }
     cacheItem.mInfo = semanticInfo;
     cacheItem.mValid = true;
-    emit dataChanged(cacheItem.mIndex, cacheItem.mIndex);
+    emit dataChanged(cacheItem.mIndex, cacheItem.mIndex, {RatingRole, DescriptionRole, TagsRole});
 }
 
 void SemanticInfoDirModel::slotRowsAboutToBeRemoved(const QModelIndex& parent, int start, int end)
@@ -21,16 +21,28 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <config-gwenview.h>
 
 // Qt
+#include <QCollator>
+#include <QDateTime>
+#include <QHash>
+#include <QSet>
 #include <QTimer>
 #include <QDebug>
 #include <QUrl>
+#include <QVector>
+
+// STL
+#include <algorithm>
+#include <vector>
 
 // KDE
+#include <KConfigGroup>
 #include <KDirLister>
+#include <KSharedConfig>
 
 
 // Local
 #include <lib/archiveutils.h>
+#include <lib/taskscheduler.h>
 #include <lib/timeutils.h>
 #ifdef GWENVIEW_SEMANTICINFO_BACKEND_NONE
 #include <KDirModel>
@@ -59,6 +71,117 @@ AbstractSortedDirModelFilter::~AbstractSortedDirModelFilter()
     }
 }
 
+/**
+ * What we need to know about an item to filter and sort it. Computed once per
+ * item, since it requires looking at the item mime type.
+ */
+struct SortedDirModelItemInfo
+{
+    MimeTypeUtils::Kind kind;
+    bool isDirOrArchive;
+    int extensionId;
+    bool dateTimeValid;
+    QDateTime dateTime;
+};
+
+/**
+ * Below this number of documents, sorting through lessThan() is fast enough
+ */
+static const int MIN_DOCUMENTS_FOR_SORT_KEYS = 1000;
+
+/**
+ * What the sort done by SortedDirModel::lessThan() depends on
+ */
+struct SortedDirModelSortSettings
+{
+    bool sortByDate;
+    bool sortByRating;
+    bool ascending;
+    Qt::CaseSensitivity caseSensitivity;
+};
+
+struct SortedDirModelSortInput
+{
+    int row;
+    QUrl url;
+    QString text;
+    QString name;
+    QDateTime dateTime;
+    int rating;
+    bool hidden;
+    QDateTime modifiedTime;
+};
+
+struct SortedDirModelSortEntry
+{
+    SortedDirModelSortEntry(const SortedDirModelSortInput* input_, const QCollatorSortKey& textKey_, const QCollatorSortKey& nameKey_)
+    : input(input_)
+    , textKey(textKey_)
+    , nameKey(nameKey_)
+    {}
+
+    const SortedDirModelSortInput* input;
+    QCollatorSortKey textKey;
+    QCollatorSortKey nameKey;
+};
+
+typedef std::vector<SortedDirModelSortEntry> SortedDirModelSortEntries;
+
+/**
+ * Like KDirSortFilterProxyModel, fall back to a case sensitive comparison
+ * for strings which only differ by case
+ */
+static int compareStrings(int collatorResult, const QString& left, const QString& right, Qt::CaseSensitivity caseSensitivity)
+{
+    if (caseSensitivity == Qt::CaseSensitive || collatorResult != 0) {
+        return collatorResult;
+    }
+    return QString::compare(left, right, Qt::CaseSensitive);
+}
+
+/**
+ * Must order documents the same way SortedDirModel::lessThan() does, which
+ * ends with KDirSortFilterProxyModel::lessThan() using natural sorting.
+ * Returns 0 for documents lessThan() considers equivalent.
+ */
+static int compareSortEntries(const SortedDirModelSortSettings& settings, const SortedDirModelSortEntry& left, const SortedDirModelSortEntry& right)
+{
+    const SortedDirModelSortInput* leftInput = left.input;
+    const SortedDirModelSortInput* rightInput = right.input;
+    if (settings.sortByDate && leftInput->dateTime != rightInput->dateTime) {
+        return leftInput->dateTime < rightInput->dateTime ? -1 : 1;
+    }
+    if (settings.sortByRating && leftInput->rating != rightInput->rating) {
+        return leftInput->rating < rightInput->rating ? -1 : 1;
+    }
+    // KDirSortFilterProxyModel puts hidden items first, whatever the order
+    if (leftInput->hidden != rightInput->hidden) {
+        return leftInput->hidden == settings.ascending ? -1 : 1;
+    }
+    const Qt::CaseSensitivity caseSensitivity = settings.caseSensitivity;
+    if (settings.sortByDate) {
+        if (leftInput->modifiedTime != rightInput->modifiedTime) {
+            return leftInput->modifiedTime < rightInput->modifiedTime ? -1 : 1;
+        }
+        return compareStrings(left.textKey.compare(right.textKey), leftInput->text, rightInput->text, caseSensitivity);
+    }
+    int result = compareStrings(left.textKey.compare(right.textKey), leftInput->text, rightInput->text, caseSensitivity);
+    if (result == 0) {
+        result = compareStrings(left.nameKey.compare(right.nameKey), leftInput->name, rightInput->name, caseSensitivity);
+    }
+    if (result == 0) {
+        // Only happens for search results showing files with the same name
+        // from different folders, not worth computing keys for
+        QCollator collator;
+        collator.setNumericMode(true);
+        collator.setCaseSensitivity(caseSensitivity);
+        const QString leftUrl = leftInput->url.toString();
+        const QString rightUrl = rightInput->url.toString();
+        result = compareStrings(collator.compare(leftUrl, rightUrl), leftUrl, rightUrl, caseSensitivity);
+    }
+    return result;
+}
+
 struct SortedDirModelPrivate
 {
 #ifdef GWENVIEW_SEMANTICINFO_BACKEND_NONE
@@ -66,12 +189,277 @@ struct SortedDirModelPrivate
 #else
     SemanticInfoDirModel* mSourceModel;
 #endif
-    QStringList mBlackListedExtensions;
+    QSet<int> mBlackListedExtensionIds;
     QList<AbstractSortedDirModelFilter*> mFilters;
     QTimer mDelayedApplyFiltersTimer;
     MimeTypeUtils::Kinds mKindFilter;
+
+    QHash<QUrl, SortedDirModelItemInfo> mItemInfoForUrl;
+    QHash<QString, int> mExtensionIds;
+
+    // Position of the documents in the last sort done by
+    // SortedDirModel::sort(), by source row. -1 for folders, archives and
+    // documents whose rank is not known.
+    QVector<int> mSortRanks;
+    // Sort parameters the sort ranks have been computed for
+    int mRankedSortColumn;
+    int mRankedSortRole;
+    Qt::SortOrder mRankedSortOrder;
+    Qt::CaseSensitivity mRankedSortCaseSensitivity;
+
+    SortedDirModelPrivate()
+    : mRankedSortColumn(-1)
+    , mRankedSortRole(-1)
+    , mRankedSortOrder(Qt::AscendingOrder)
+    , mRankedSortCaseSensitivity(Qt::CaseSensitive)
+    {}
+
+    int extensionId(const QString& extension)
+    {
+        QHash<QString, int>::ConstIterator it = mExtensionIds.constFind(extension);
+        if (it != mExtensionIds.constEnd()) {
+            return it.value();
+        }
+        const int id = mExtensionIds.count();
+        mExtensionIds.insert(extension, id);
+        return id;
+    }
+
+    SortedDirModelItemInfo& itemInfo(const KFileItem& item)
+    {
+        QHash<QUrl, SortedDirModelItemInfo>::Iterator it = mItemInfoForUrl.find(item.url());
+        if (it != mItemInfoForUrl.end()) {
+            return it.value();
+        }
+
+        SortedDirModelItemInfo info;
+        info.kind = MimeTypeUtils::fileItemKind(item);
+        info.isDirOrArchive = ArchiveUtils::fileItemIsDirOrArchive(item);
+        info.extensionId = -1;
+        if (info.kind != MimeTypeUtils::KIND_DIR && info.kind != MimeTypeUtils::KIND_ARCHIVE) {
+            const QString name = item.name();
+            const int dotPos = name.lastIndexOf(QLatin1Char('.'));
+            if (dotPos >= 1) {
+                info.extensionId = extensionId(name.mid(dotPos + 1).toLower());
+            }
+        }
+        info.dateTimeValid = false;
+        return mItemInfoForUrl.insert(item.url(), info).value();
+    }
+
+    bool sortRanksMatch(const SortedDirModel* q) const
+    {
+        return mRankedSortColumn == q->sortColumn()
+            && mRankedSortRole == q->sortRole()
+            && mRankedSortOrder == q->sortOrder()
+            && mRankedSortCaseSensitivity == q->sortCaseSensitivity();
+    }
+
+    /**
+     * Returns the sort rank of the document at source index, or -1 if it is
+     * not known
+     */
+    int sortRank(const QModelIndex& index) const
+    {
+        if (index.parent().isValid()) {
+            return -1;
+        }
+        return mSortRanks.value(index.row(), -1);
+    }
+
+    void forgetSortRanks(const QModelIndex& parent, int first, int last)
+    {
+        if (parent.isValid()) {
+            return;
+        }
+        for (int row = first; row <= qMin(last, mSortRanks.count() - 1); ++row) {
+            mSortRanks[row] = -1;
+        }
+    }
+
+    void updateSortRanks(int column, int role, Qt::SortOrder order, Qt::CaseSensitivity caseSensitivity);
+
+    QDateTime dateTime(const KFileItem& item)
+    {
+        SortedDirModelItemInfo& info = itemInfo(item);
+        if (!info.dateTimeValid) {
+            info.dateTime = TimeUtils::dateTimeForFileItem(item);
+            info.dateTimeValid = true;
+        }
+        return info.dateTime;
+    }
+
+    void forgetItemInfo(const QModelIndex& parent, int first, int last)
+    {
+        forgetSortRanks(parent, first, last);
+        if (mItemInfoForUrl.isEmpty()) {
+            return;
+        }
+        for (int row = first; row <= last; ++row) {
+            const QModelIndex index = mSourceModel->index(row, 0, parent);
+            const KFileItem item = mSourceModel->itemForIndex(index);
+            if (!item.isNull()) {
+                mItemInfoForUrl.remove(item.url());
+            }
+        }
+    }
+
+    /**
+     * Semantic info does not change what is cached, except the sort rank when
+     * sorting by rating
+     */
+    void semanticInfoChanged(const QModelIndex& parent, int first, int last)
+    {
+#ifndef GWENVIEW_SEMANTICINFO_BACKEND_NONE
+        if (mRankedSortRole == SemanticInfoDirModel::RatingRole) {
+            forgetSortRanks(parent, first, last);
+        }
+#else
+        Q_UNUSED(parent);
+        Q_UNUSED(first);
+        Q_UNUSED(last);
+#endif
+    }
+
+    static bool isSemanticInfoRole(int role)
+    {
+#ifndef GWENVIEW_SEMANTICINFO_BACKEND_NONE
+        return role == SemanticInfoDirModel::RatingRole
+            || role == SemanticInfoDirModel::DescriptionRole
+            || role == SemanticInfoDirModel::TagsRole;
+#else
+        Q_UNUSED(role);
+        return false;
+#endif
+    }
 };
 
+static void mergeSortEntries(const SortedDirModelSortSettings& settings, const SortedDirModelSortEntries& first, const SortedDirModelSortEntries& second, SortedDirModelSortEntries* out)
+{
+    out->reserve(first.size() + second.size());
+    std::merge(first.begin(), first.end(), second.begin(), second.end(), std::back_inserter(*out),
+        [&settings](const SortedDirModelSortEntry& left, const SortedDirModelSortEntry& right) {
+            return compareSortEntries(settings, left, right) < 0;
+        });
+}
+
+void SortedDirModelPrivate::updateSortRanks(int column, int role, Qt::SortOrder order, Qt::CaseSensitivity caseSensitivity)
+{
+    mSortRanks.clear();
+    mRankedSortColumn = -1;
+
+    const bool sortByDate = column == KDirModel::ModifiedTime;
+#ifndef GWENVIEW_SEMANTICINFO_BACKEND_NONE
+    const bool sortByRating = role == SemanticInfoDirModel::RatingRole;
+#else
+    const bool sortByRating = false;
+#endif
+    if (column != KDirModel::Name && !sortByDate) {
+        return;
+    }
+    // Without natural sorting, KDirSortFilterProxyModel compares names with
+    // QString::compare(), which is fast enough
+    if (!KConfigGroup(KSharedConfig::openConfig(), "KDE").readEntry("NaturalSorting", true)) {
+        return;
+    }
+    SortedDirModelSortSettings settings;
+    settings.sortByDate = sortByDate;
+    settings.sortByRating = sortByRating;
+    settings.ascending = order == Qt::AscendingOrder;
+    settings.caseSensitivity = caseSensitivity;
+
+    // Gather what we need from the items. This must happen in the GUI thread.
+    QVector<SortedDirModelSortInput> inputs;
+    const int rowCount = mSourceModel->rowCount();
+    inputs.reserve(rowCount);
+    for (int row = 0; row < rowCount; ++row) {
+        const QModelIndex index = mSourceModel->index(row, 0);
+        const KFileItem item = mSourceModel->itemForIndex(index);
+        if (item.isNull() || itemInfo(item).isDirOrArchive) {
+            continue;
+        }
+        SortedDirModelSortInput input;
+        input.row = row;
+        input.url = item.url();
+        input.text = item.text();
+        input.name = item.name(caseSensitivity == Qt::CaseInsensitive);
+        if (sortByDate) {
+            input.dateTime = dateTime(item);
+            input.modifiedTime = item.time(KFileItem::ModificationTime).toLocalTime();
+        }
+#ifndef GWENVIEW_SEMANTICINFO_BACKEND_NONE
+        input.rating = sortByRating ? mSourceModel->data(index, SemanticInfoDirModel::RatingRole).toInt() : 0;
+#else
+        input.rating = 0;
+#endif
+        input.hidden = item.isHidden();
+        inputs << input;
+    }
+    if (inputs.count() < MIN_DOCUMENTS_FOR_SORT_KEYS) {
+        return;
+    }
+
+    // Compute collation keys and sort each chunk on worker threads. QCollator
+    // is not thread-safe, so each chunk gets its own. sort() must return with
+    // the rows sorted, so the GUI thread works on the chunks too and only
+    // waits for the helpers which started.
+    const auto lessThan = [&settings](const SortedDirModelSortEntry& left, const SortedDirModelSortEntry& right) {
+        return compareSortEntries(settings, left, right) < 0;
+    };
+    TaskScheduler* scheduler = TaskScheduler::instance();
+    const int chunkCount = scheduler->threadCount();
+    const int chunkSize = (inputs.count() + chunkCount - 1) / chunkCount;
+    QVector<SortedDirModelSortEntries> chunks(chunkCount);
+    const SortedDirModelSortInput* inputData = inputs.constData();
+    const int inputCount = inputs.count();
+    scheduler->runAndWait(TaskScheduler::ViewClass, chunkCount, [&](int chunk) {
+        QCollator collator;
+        collator.setNumericMode(true);
+        collator.setCaseSensitivity(caseSensitivity);
+        SortedDirModelSortEntries& entries = chunks[chunk];
+        const int begin = chunk * chunkSize;
+        const int end = qMin(begin + chunkSize, inputCount);
+        entries.reserve(qMax(0, end - begin));
+        for (int idx = begin; idx < end; ++idx) {
+            const SortedDirModelSortInput& input = inputData[idx];
+            const QCollatorSortKey textKey = collator.sortKey(input.text);
+            const bool needsNameKey = !sortByDate && input.name != input.text;
+            entries.emplace_back(&input, textKey, needsNameKey ? collator.sortKey(input.name) : textKey);
+        }
+        std::sort(entries.begin(), entries.end(), lessThan);
+    });
+
+    // Merge sorted chunks, two by two
+    while (chunks.count() > 1) {
+        QVector<SortedDirModelSortEntries> merged((chunks.count() + 1) / 2);
+        scheduler->runAndWait(TaskScheduler::ViewClass, merged.count(), [&](int idx) {
+            const int first = idx * 2;
+            if (first + 1 < chunks.count()) {
+                mergeSortEntries(settings, chunks.at(first), chunks.at(first + 1), &merged[idx]);
+            } else {
+                merged[idx] = chunks.at(first);
+            }
+        });
+        chunks = merged;
+    }
+
+    // Equivalent documents get the same rank, so that comparing ranks gives
+    // the same result as lessThan() even for documents without a rank
+    const SortedDirModelSortEntries& entries = chunks.first();
+    mSortRanks.fill(-1, rowCount);
+    int rank = 0;
+    for (int idx = 0; idx < int(entries.size()); ++idx) {
+        if (idx > 0 && compareSortEntries(settings, entries[idx - 1], entries[idx]) != 0) {
+            rank = idx;
+        }
+        mSortRanks[entries[idx].input->row] = rank;
+    }
+    mRankedSortColumn = column;
+    mRankedSortRole = role;
+    mRankedSortOrder = order;
+    mRankedSortCaseSensitivity = caseSensitivity;
+}
+
 SortedDirModel::SortedDirModel(QObject* parent)
 : KDirSortFilterProxyModel(parent)
 , d(new SortedDirModelPrivate)
@@ -81,6 +469,44 @@ SortedDirModel::SortedDirModel(QObject* parent)
 #else
     d->mSourceModel = new SemanticInfoDirModel(this);
 #endif
+    // Connect before setSourceModel(), so that what we cache is up to date
+    // when QSortFilterProxyModel sorts the changed rows
+    connect(d->mSourceModel, &QAbstractItemModel::rowsAboutToBeRemoved, this,
+        [this](const QModelIndex& parent, int first, int last) {
+            d->forgetItemInfo(parent, first, last);
+        });
+    // Sort ranks are stored by source row: follow the rows
+    connect(d->mSourceModel, &QAbstractItemModel::rowsInserted, this,
+        [this](const QModelIndex& parent, int first, int last) {
+            if (!parent.isValid() && first <= d->mSortRanks.count()) {
+                d->mSortRanks.insert(first, last - first + 1, -1);
+            }
+        });
+    connect(d->mSourceModel, &QAbstractItemModel::rowsRemoved, this,
+        [this](const QModelIndex& parent, int first, int last) {
+            if (!parent.isValid() && first < d->mSortRanks.count()) {
+                d->mSortRanks.remove(first, qMin(last, d->mSortRanks.count() - 1) - first + 1);
+            }
+        });
+    const auto forgetAllSortRanks = [this]() {
+        d->mSortRanks.clear();
+    };
+    connect(d->mSourceModel, &QAbstractItemModel::rowsAboutToBeMoved, this, forgetAllSortRanks);
+    connect(d->mSourceModel, &QAbstractItemModel::layoutAboutToBeChanged, this, forgetAllSortRanks);
+    connect(d->mSourceModel, &QAbstractItemModel::dataChanged, this,
+        [this](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles) {
+            if (!roles.isEmpty() && std::all_of(roles.begin(), roles.end(), &SortedDirModelPrivate::isSemanticInfoRole)) {
+                d->semanticInfoChanged(topLeft.parent(), topLeft.row(), bottomRight.row());
+                return;
+            }
+            // Items get refreshed when they change on disk: their mime type
+            // or date may have changed
+            d->forgetItemInfo(topLeft.parent(), topLeft.row(), bottomRight.row());
+        });
+    connect(d->mSourceModel, &QAbstractItemModel::modelAboutToBeReset, this, [this]() {
+        d->mItemInfoForUrl.clear();
+        d->mSortRanks.clear();
+    });
     setSourceModel(d->mSourceModel);
     d->mDelayedApplyFiltersTimer.setInterval(0);
     d->mDelayedApplyFiltersTimer.setSingleShot(true);
@@ -144,7 +570,10 @@ void SortedDirModel::reload()
 
 void SortedDirModel::setBlackListedExtensions(const QStringList& list)
 {
-    d->mBlackListedExtensions = list;
+    d->mBlackListedExtensionIds.clear();
+    Q_FOREACH(const QString& extension, list) {
+        d->mBlackListedExtensionIds.insert(d->extensionId(extension));
+    }
 }
 
 KFileItem SortedDirModel::itemForIndex(const QModelIndex& index) const
@@ -194,19 +623,19 @@ bool SortedDirModel::filterAcceptsRow(int row, const QModelIndex& parent) const
 {
     QModelIndex index = d->mSourceModel->index(row, 0, parent);
     KFileItem fileItem = d->mSourceModel->itemForIndex(index);
+    if (fileItem.isNull()) {
+        return KDirSortFilterProxyModel::filterAcceptsRow(row, parent);
+    }
+    const SortedDirModelItemInfo& info = d->itemInfo(fileItem);
 
-    MimeTypeUtils::Kinds kind = MimeTypeUtils::fileItemKind(fileItem);
+    MimeTypeUtils::Kind kind = info.kind;
     if (d->mKindFilter != MimeTypeUtils::Kinds() && !(d->mKindFilter & kind)) {
         return false;
     }
 
     if (kind != MimeTypeUtils::KIND_DIR && kind != MimeTypeUtils::KIND_ARCHIVE) {
-        int dotPos = fileItem.name().lastIndexOf(QLatin1Char('.'));
-        if (dotPos >= 1) {
-            QString extension = fileItem.name().mid(dotPos + 1).toLower();
-            if (d->mBlackListedExtensions.contains(extension)) {
-                return false;
-            }
+        if (info.extensionId != -1 && d->mBlackListedExtensionIds.contains(info.extensionId)) {
+            return false;
         }
 #ifndef GWENVIEW_SEMANTICINFO_BACKEND_NONE
         if (!d->mSourceModel->semanticInfoAvailableForIndex(index)) {
@@ -259,11 +688,24 @@ void SortedDirModel::doApplyFilters()
 
 bool SortedDirModel::lessThan(const QModelIndex& left, const QModelIndex& right) const
 {
+    // Documents ranked by sort(): no need to look at the items
+    if (!d->mSortRanks.isEmpty() && d->sortRanksMatch(this)) {
+        const int leftRank = d->sortRank(left);
+        const int rightRank = d->sortRank(right);
+        if (leftRank != -1 && rightRank != -1) {
+            return leftRank < rightRank;
+        }
+    }
+
     const KFileItem leftItem = itemForSourceIndex(left);
     const KFileItem rightItem = itemForSourceIndex(right);
 
-    const bool leftIsDirOrArchive = ArchiveUtils::fileItemIsDirOrArchive(leftItem);
-    const bool rightIsDirOrArchive = ArchiveUtils::fileItemIsDirOrArchive(rightItem);
+    if (leftItem.isNull() || rightItem.isNull()) {
+        return KDirSortFilterProxyModel::lessThan(left, right);
+    }
+
+    const bool leftIsDirOrArchive = d->itemInfo(leftItem).isDirOrArchive;
+    const bool rightIsDirOrArchive = d->itemInfo(rightItem).isDirOrArchive;
 
     if (leftIsDirOrArchive != rightIsDirOrArchive) {
         return sortOrder() == Qt::AscendingOrder ? leftIsDirOrArchive : rightIsDirOrArchive;
@@ -273,8 +715,8 @@ bool SortedDirModel::lessThan(const QModelIndex& left, const QModelIndex& right)
     // a secondary criterion is needed, delegate sorting to the parent class.
     if (!leftIsDirOrArchive) {
         if (sortColumn() == KDirModel::ModifiedTime) {
-            const QDateTime leftDate = TimeUtils::dateTimeForFileItem(leftItem);
-            const QDateTime rightDate = TimeUtils::dateTimeForFileItem(rightItem);
+            const QDateTime leftDate = d->dateTime(leftItem);
+            const QDateTime rightDate = d->dateTime(rightItem);
 
             if (leftDate != rightDate) {
                 return leftDate < rightDate;
@@ -295,6 +737,12 @@ bool SortedDirModel::lessThan(const QModelIndex& left, const QModelIndex& right)
     return KDirSortFilterProxyModel::lessThan(left, right);
 }
 
+void SortedDirModel::sort(int column, Qt::SortOrder order)
+{
+    d->updateSortRanks(column, sortRole(), order, sortCaseSensitivity());
+    KDirSortFilterProxyModel::sort(column, order);
+}
+
 bool SortedDirModel::hasDocuments() const
 {
     const int count = rowCount();
@@ -304,7 +752,7 @@ bool SortedDirModel::hasDocuments() const
     for (int row = 0; row < count; ++row) {
         const QModelIndex idx = index(row, 0);
         const KFileItem item = itemForIndex(idx);
-        if (!ArchiveUtils::fileItemIsDirOrArchive(item)) {
+        if (!item.isNull() && !d->itemInfo(item).isDirOrArchive) {
             return true;
         }
     }
@@ -113,6 +113,13 @@ public:
 
     bool hasDocuments() const;
 
+    /**
+     * Sorts documents using collation keys computed once per item and sorted
+     * on worker threads, instead of comparing names with the locale for
+     * every comparison.
+     */
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
 public Q_SLOTS:
     void applyFilters();
 
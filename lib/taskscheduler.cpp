@@ -0,0 +1,319 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "taskscheduler.h"
+
+// STL
+#include <memory>
+#include <vector>
+
+// Qt
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QQueue>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+// Local
+#include "gvdebug.h"
+#include "tracer.h"
+
+namespace Gwenview
+{
+
+Q_GLOBAL_STATIC(TaskScheduler, sTaskScheduler)
+
+struct TaskSchedulerPrivate
+{
+    struct Entry {
+        QRunnable* mRunnable;
+        QElapsedTimer mQueuedTimer;
+    };
+
+    struct ClassState {
+        QQueue<Entry> mQueue;
+        TaskScheduler::Stats mStats;
+    };
+
+    QThreadPool mPool;
+    mutable QMutex mMutex;
+    QWaitCondition mSlotReleased;
+    ClassState mClasses[TaskScheduler::TaskClassCount];
+    // Number of tasks handed to mPool
+    int mDispatchedTasks = 0;
+    // Number of slots held by threads outside of mPool
+    int mAcquiredSlots = 0;
+    bool mShuttingDown = false;
+
+    bool hasIdleThread() const
+    {
+        return mDispatchedTasks + mAcquiredSlots < mPool.maxThreadCount();
+    }
+
+    bool canRun(int taskClass) const
+    {
+        if (mShuttingDown) {
+            return true;
+        }
+        if (mClasses[taskClass].mStats.running >= mClasses[taskClass].mStats.quota) {
+            return false;
+        }
+        if (taskClass == TaskScheduler::ViewClass) {
+            return true;
+        }
+        // Keep a thread for the image being viewed
+        int running = 0;
+        for (int idx = TaskScheduler::ViewClass + 1; idx < TaskScheduler::TaskClassCount; ++idx) {
+            running += mClasses[idx].mStats.running;
+        }
+        return running < mPool.maxThreadCount() - 1;
+    }
+
+    // Must be called with mMutex locked
+    void dispatch();
+
+    void finish(TaskScheduler::TaskClass taskClass)
+    {
+        QMutexLocker locker(&mMutex);
+        --mClasses[taskClass].mStats.running;
+        --mDispatchedTasks;
+        mSlotReleased.wakeAll();
+        dispatch();
+    }
+};
+
+/**
+ * Runs a queued runnable, then lets the scheduler pick the next one
+ */
+class DispatchedTask : public QRunnable
+{
+public:
+    DispatchedTask(TaskSchedulerPrivate* d, QRunnable* runnable, TaskScheduler::TaskClass taskClass)
+    : d(d)
+    , mRunnable(runnable)
+    , mTaskClass(taskClass)
+    {}
+
+    void run() override
+    {
+        // Runnables which are not auto-deleted may be deleted by their owner
+        // as soon as they are done, do not touch them after run()
+        const bool autoDelete = mRunnable->autoDelete();
+        mRunnable->run();
+        if (autoDelete) {
+            delete mRunnable;
+        }
+        d->finish(mTaskClass);
+    }
+
+private:
+    TaskSchedulerPrivate* const d;
+    QRunnable* const mRunnable;
+    const TaskScheduler::TaskClass mTaskClass;
+};
+
+/**
+ * Calls a function with indexes until there are none left. Several helpers
+ * share the same indexes.
+ */
+class IndexRunner : public QRunnable
+{
+public:
+    IndexRunner(const std::function<void(int)>* function, int count, QAtomicInt* next, QSemaphore* done)
+    : mFunction(function)
+    , mCount(count)
+    , mNext(next)
+    , mDone(done)
+    {
+        setAutoDelete(false);
+    }
+
+    void runIndexes()
+    {
+        for (int idx = mNext->fetchAndAddRelaxed(1); idx < mCount; idx = mNext->fetchAndAddRelaxed(1)) {
+            (*mFunction)(idx);
+        }
+    }
+
+    void run() override
+    {
+        runIndexes();
+        mDone->release();
+    }
+
+private:
+    const std::function<void(int)>* const mFunction;
+    const int mCount;
+    QAtomicInt* const mNext;
+    QSemaphore* const mDone;
+};
+
+void TaskSchedulerPrivate::dispatch()
+{
+    while (hasIdleThread()) {
+        int taskClass = 0;
+        for (; taskClass < TaskScheduler::TaskClassCount; ++taskClass) {
+            if (!mClasses[taskClass].mQueue.isEmpty() && canRun(taskClass)) {
+                break;
+            }
+        }
+        if (taskClass == TaskScheduler::TaskClassCount) {
+            return;
+        }
+        ClassState& state = mClasses[taskClass];
+        const Entry entry = state.mQueue.dequeue();
+        const qint64 waitMs = entry.mQueuedTimer.elapsed();
+        --state.mStats.queued;
+        ++state.mStats.running;
+        ++state.mStats.started;
+        state.mStats.totalWaitMs += waitMs;
+        state.mStats.maxWaitMs = qMax(state.mStats.maxWaitMs, waitMs);
+        ++mDispatchedTasks;
+        if (Tracer::isEnabled()) {
+            const qint64 waitUs = entry.mQueuedTimer.nsecsElapsed() / 1000;
+            Tracer::addSpan("scheduler", "queued", Tracer::now() - waitUs, waitUs,
+                            QStringLiteral("class %1, %2 still queued").arg(taskClass).arg(state.mStats.queued));
+        }
+        mPool.start(new DispatchedTask(this, entry.mRunnable, TaskScheduler::TaskClass(taskClass)));
+    }
+}
+
+TaskScheduler::TaskScheduler()
+: d(new TaskSchedulerPrivate)
+{
+    // Keep a second thread on single core machines, so that a long task
+    // cannot hold back the image being viewed
+    const int threadCount = qMax(2, QThread::idealThreadCount());
+    d->mPool.setMaxThreadCount(threadCount);
+
+    d->mClasses[ViewClass].mStats.quota = threadCount;
+    d->mClasses[PreloadClass].mStats.quota = qMax(1, threadCount / 2);
+    d->mClasses[ThumbnailClass].mStats.quota = qMax(1, threadCount / 2);
+    d->mClasses[BackgroundClass].mStats.quota = qMax(1, threadCount / 4);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    // Queued tasks may be waited for by their owners, run them all
+    {
+        QMutexLocker locker(&d->mMutex);
+        d->mShuttingDown = true;
+        d->dispatch();
+    }
+    d->mPool.waitForDone();
+    delete d;
+}
+
+TaskScheduler* TaskScheduler::instance()
+{
+    return sTaskScheduler;
+}
+
+void TaskScheduler::start(QRunnable* runnable, TaskClass taskClass)
+{
+    GV_RETURN_IF_FAIL(runnable);
+    QMutexLocker locker(&d->mMutex);
+    TaskSchedulerPrivate::Entry entry;
+    entry.mRunnable = runnable;
+    entry.mQueuedTimer.start();
+    d->mClasses[taskClass].mQueue.enqueue(entry);
+    ++d->mClasses[taskClass].mStats.queued;
+    d->dispatch();
+}
+
+bool TaskScheduler::tryTake(QRunnable* runnable)
+{
+    QMutexLocker locker(&d->mMutex);
+    for (TaskSchedulerPrivate::ClassState& state : d->mClasses) {
+        for (auto it = state.mQueue.begin(), end = state.mQueue.end(); it != end; ++it) {
+            if (it->mRunnable == runnable) {
+                state.mQueue.erase(it);
+                --state.mStats.queued;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::runAndWait(TaskClass taskClass, int count, const std::function<void(int)>& function)
+{
+    QAtomicInt next;
+    QSemaphore done;
+    const int helperCount = qMin(count, threadCount()) - 1;
+    std::vector<std::unique_ptr<IndexRunner>> helpers;
+    for (int idx = 0; idx < helperCount; ++idx) {
+        helpers.emplace_back(new IndexRunner(&function, count, &next, &done));
+        start(helpers.back().get(), taskClass);
+    }
+    IndexRunner(&function, count, &next, &done).runIndexes();
+    int startedHelperCount = 0;
+    for (const auto& helper : helpers) {
+        if (!tryTake(helper.get())) {
+            ++startedHelperCount;
+        }
+    }
+    done.acquire(startedHelperCount);
+}
+
+void TaskScheduler::acquireSlot(TaskClass taskClass)
+{
+    QMutexLocker locker(&d->mMutex);
+    while (!d->canRun(taskClass) || !d->hasIdleThread()) {
+        d->mSlotReleased.wait(&d->mMutex);
+    }
+    TaskSchedulerPrivate::ClassState& state = d->mClasses[taskClass];
+    ++state.mStats.running;
+    ++state.mStats.started;
+    ++d->mAcquiredSlots;
+}
+
+void TaskScheduler::releaseSlot(TaskClass taskClass)
+{
+    QMutexLocker locker(&d->mMutex);
+    --d->mClasses[taskClass].mStats.running;
+    --d->mAcquiredSlots;
+    d->mSlotReleased.wakeAll();
+    d->dispatch();
+}
+
+void TaskScheduler::setQuota(TaskClass taskClass, int quota)
+{
+    QMutexLocker locker(&d->mMutex);
+    d->mClasses[taskClass].mStats.quota = qMax(1, quota);
+    d->mSlotReleased.wakeAll();
+    d->dispatch();
+}
+
+TaskScheduler::Stats TaskScheduler::stats(TaskClass taskClass) const
+{
+    QMutexLocker locker(&d->mMutex);
+    return d->mClasses[taskClass].mStats;
+}
+
+int TaskScheduler::threadCount() const
+{
+    return d->mPool.maxThreadCount();
+}
+
+} // namespace
@@ -0,0 +1,216 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// STL
+#include <functional>
+
+// Qt
+#include <QAtomicInt>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QRunnable>
+#include <QSharedPointer>
+
+namespace Gwenview
+{
+
+/**
+ * A task running a function and reporting its result to a QFuture
+ */
+template <typename T>
+class TaskSchedulerFunctionTask : public QRunnable
+{
+public:
+    explicit TaskSchedulerFunctionTask(const std::function<T()>& function)
+    : mFunction(function)
+    {
+        mInterface.reportStarted();
+    }
+
+    QFuture<T> future()
+    {
+        return mInterface.future();
+    }
+
+    void run() override
+    {
+        if (!mInterface.isCanceled()) {
+            const T result = mFunction();
+            mInterface.reportResult(result);
+        }
+        mInterface.reportFinished();
+    }
+
+private:
+    std::function<T()> mFunction;
+    QFutureInterface<T> mInterface;
+};
+
+template <>
+inline void TaskSchedulerFunctionTask<void>::run()
+{
+    if (!mInterface.isCanceled()) {
+        mFunction();
+    }
+    mInterface.reportFinished();
+}
+
+struct TaskSchedulerPrivate;
+/**
+ * Runs the image work of Gwenview on a single pool of threads.
+ *
+ * Each task belongs to a class. When a thread is available, it picks the
+ * oldest task of the most important class which has not reached its quota.
+ * Whatever their quotas, the classes other than ViewClass never run more
+ * than threadCount() - 1 tasks together. This way, generating thumbnails or
+ * saving images cannot keep the image being viewed from being decoded.
+ */
+class GWENVIEWLIB_EXPORT TaskScheduler
+{
+public:
+    /**
+     * From the most to the least important
+     */
+    enum TaskClass {
+        ViewClass,       ///< Work the user is waiting for: viewed image, editing
+        PreloadClass,    ///< Images which are likely to be viewed soon
+        ThumbnailClass,  ///< Generating and scaling thumbnails
+        BackgroundClass, ///< Storing images and thumbnails
+        TaskClassCount
+    };
+
+    struct Stats {
+        int queued = 0;         ///< Tasks waiting for a thread
+        int running = 0;        ///< Running tasks, including acquired slots
+        int quota = 0;          ///< Maximum number of running tasks
+        qint64 started = 0;     ///< Tasks started so far
+        qint64 totalWaitMs = 0; ///< Time started tasks spent in the queue
+        qint64 maxWaitMs = 0;   ///< Longest time a task spent in the queue
+    };
+
+    TaskScheduler();
+    ~TaskScheduler();
+
+    static TaskScheduler* instance();
+
+    /**
+     * Queues @p runnable. As with QThreadPool::start(), @p runnable is
+     * deleted after it has run if its autoDelete() is true.
+     */
+    void start(QRunnable* runnable, TaskClass taskClass);
+
+    /**
+     * Removes @p runnable from the queue if it has not started yet. The
+     * caller then owns @p runnable.
+     */
+    bool tryTake(QRunnable* runnable);
+
+    /**
+     * Runs @p function in a task of class @p taskClass
+     */
+    template <typename Function>
+    auto run(TaskClass taskClass, Function function) -> QFuture<decltype(function())>
+    {
+        typedef decltype(function()) Result;
+        TaskSchedulerFunctionTask<Result>* task = new TaskSchedulerFunctionTask<Result>(function);
+        QFuture<Result> future = task->future();
+        start(task, taskClass);
+        return future;
+    }
+
+    /**
+     * Calls @p function on each item of @p sequence, which must not be
+     * modified until the returned future has finished. Items are handed out
+     * in chunks, idle threads pick the next chunk. Canceling the future
+     * skips the items which have not been processed yet.
+     */
+    template <typename Sequence, typename Function>
+    QFuture<void> map(TaskClass taskClass, Sequence& sequence, Function function)
+    {
+        struct MapState {
+            QFutureInterface<void> mInterface;
+            QAtomicInt mRemainingChunks;
+        };
+        QSharedPointer<MapState> state(new MapState);
+        state->mInterface.reportStarted();
+        QFuture<void> future = state->mInterface.future();
+
+        const int count = sequence.size();
+        if (count == 0) {
+            state->mInterface.reportFinished();
+            return future;
+        }
+        const int chunkSize = qMax(1, count / (threadCount() * 4));
+        state->mRemainingChunks.store((count + chunkSize - 1) / chunkSize);
+
+        const auto begin = sequence.begin();
+        for (int first = 0; first < count; first += chunkSize) {
+            const int last = qMin(first + chunkSize, count);
+            start(new TaskSchedulerFunctionTask<void>([state, begin, first, last, function]() {
+                for (auto it = begin + first; it != begin + last && !state->mInterface.isCanceled(); ++it) {
+                    function(*it);
+                }
+                if (!state->mRemainingChunks.deref()) {
+                    state->mInterface.reportFinished();
+                }
+            }), taskClass);
+        }
+        return future;
+    }
+
+    /**
+     * Calls @p function with each index from 0 to @p count - 1 and returns
+     * once all calls are done. The calling thread makes the calls too, and
+     * only waits for the helper tasks which have started: helpers still
+     * queued when the indexes run out are taken back. This way the caller
+     * never waits for a pool busy with longer tasks.
+     */
+    void runAndWait(TaskClass taskClass, int count, const std::function<void(int)>& function);
+
+    /**
+     * Blocks until a task of class @p taskClass is allowed to run. This lets
+     * threads which do not belong to the scheduler follow the quotas. Call
+     * releaseSlot() when done.
+     *
+     * The calling thread competes with the pool for the same cores: until
+     * the slot is released, the pool runs one task less.
+     */
+    void acquireSlot(TaskClass taskClass);
+
+    void releaseSlot(TaskClass taskClass);
+
+    void setQuota(TaskClass taskClass, int quota);
+
+    Stats stats(TaskClass taskClass) const;
+
+    int threadCount() const;
+
+private:
+    TaskSchedulerPrivate* const d;
+};
+
+} // namespace
+
+#endif /* TASKSCHEDULER_H */
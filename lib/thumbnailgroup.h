@@ -34,24 +34,41 @@ namespace ThumbnailGroup
 {
 enum Enum {
     Normal,
-    Large
+    Large,
+    XLarge,
+    XXLarge
 };
 
+/**
+ * All groups, from the smallest to the largest
+ */
+static const Enum allGroups[] = { Normal, Large, XLarge, XXLarge };
+
 inline int pixelSize(Enum value)
 {
-    if (value == Normal) {
+    switch (value) {
+    case Normal:
         return 128;
-    } else {
+    case Large:
         return 256;
+    case XLarge:
+        return 512;
+    case XXLarge:
+        return 1024;
     }
+    return 256;
 }
 
 inline Enum fromPixelSize(int value)
 {
     if (value <= 128) {
         return Normal;
-    } else {
+    } else if (value <= 256) {
         return Large;
+    } else if (value <= 512) {
+        return XLarge;
+    } else {
+        return XXLarge;
     }
 }
 } // namespace ThumbnailGroup
@@ -22,10 +22,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "thumbnailgenerator.h"
 
 // Local
+#include "imageheader.h"
 #include "imageutils.h"
-#include "jpegcontent.h"
 #include "gwenviewconfig.h"
 #include "exiv2imageloader.h"
+#include "taskscheduler.h"
+#include "tracer.h"
 
 // KDE
 #include <QDebug>
@@ -33,10 +35,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include <kdcraw/kdcraw.h>
 #endif
 
+// STL
+#include <limits>
+
 // Qt
+#include <QBuffer>
+#include <QFile>
 #include <QImageReader>
 #include <QMatrix>
-#include <QBuffer>
+
+// Exiv2
+#include <exiv2/exif.hpp>
+#include <exiv2/image.hpp>
 
 namespace Gwenview
 {
@@ -52,6 +62,49 @@ namespace Gwenview
 
 const int MIN_PREV_SIZE = 1000;
 
+static QByteArray smallestJpegPreview(Exiv2ImageLoader* loader, int pixelSize)
+{
+    const QList<Exiv2ImageLoader::Preview> previews = loader->previews();
+    for (int idx = 0; idx < previews.count(); ++idx) {
+        const Exiv2ImageLoader::Preview& preview = previews.at(idx);
+        if (preview.mimeType != QLatin1String("image/jpeg")
+                || qMax(preview.size.width(), preview.size.height()) < pixelSize) {
+            continue;
+        }
+        const QByteArray data = loader->previewData(idx);
+        if (!data.isEmpty()) {
+            return data;
+        }
+    }
+    return QByteArray();
+}
+
+// Decodes an embedded preview, scaled down to pixelSize. Returns a null image
+// if it cannot be decoded.
+static QImage decodePreview(QByteArray data, int pixelSize)
+{
+    if (data.isEmpty()) {
+        return QImage();
+    }
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    QSize previewSize = reader.size();
+    if (previewSize.isValid() && reader.supportsOption(QImageIOHandler::ScaledSize)
+            && qMax(previewSize.width(), previewSize.height()) > pixelSize) {
+        previewSize.scale(pixelSize, pixelSize, Qt::KeepAspectRatio);
+        reader.setScaledSize(previewSize);
+    }
+    QImage preview;
+    if (!reader.read(&preview)) {
+        return QImage();
+    }
+    if (qMax(preview.width(), preview.height()) > pixelSize) {
+        preview = preview.scaled(pixelSize, pixelSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return preview;
+}
+
 //------------------------------------------------------------------------
 //
 // ThumbnailContext
@@ -59,6 +112,8 @@ const int MIN_PREV_SIZE = 1000;
 //------------------------------------------------------------------------
 bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
 {
+    TraceSpan span("thumbnail", "generate");
+    span.setDetail(pixPath);
     mImage = QImage();
     mNeedCaching = true;
     Orientation orientation = NORMAL;
@@ -68,23 +123,34 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
     QByteArray formatHint = pixPath.section(QLatin1Char('.'), -1).toLocal8Bit().toLower();
     QImageReader reader(pixPath);
 
-    JpegContent content;
+    ImageHeader header;
     QByteArray format;
+    QFile file;
     QByteArray data;
     QBuffer buffer;
     int previewRatio = 1;
+    QSize rawSize;
 
 #ifdef KDCRAW_FOUND
     // raw images deserve special treatment
     if (KDcrawIface::KDcraw::rawFilesList().contains(QString::fromLatin1(formatHint))) {
-        // use KDCraw to extract the preview
-        bool ret = KDcrawIface::KDcraw::loadEmbeddedPreview(data, pixPath);
-
-        // We need QImage. Loading JpegContent from QImage - exif lost
-        // Loading QImage from JpegContent - unimplemented, would go with loadFromData
-        if (!ret || !originalImage.loadFromData(data) || qMin(originalImage.width(), originalImage.height()) < MIN_PREV_SIZE) {
-            // if the emebedded preview loading failed or gets just a small image, load
-            // half preview instead. That's slower...
+        // Pick the smallest embedded JPEG preview which is large enough for
+        // the thumbnail, without decoding any. It is decoded once, scaled, by
+        // the code below.
+        Exiv2ImageLoader loader;
+        if (loader.load(pixPath)) {
+            data = smallestJpegPreview(&loader, pixelSize);
+            // The size of the sensor data, not the one of the preview
+            rawSize = loader.imageSize();
+            if (!rawSize.isValid() && !data.isEmpty()) {
+                // The largest preview is the closest to it
+                rawSize = loader.previews().last().size;
+            }
+        }
+
+        if (data.isEmpty()) {
+            // if there is no large enough embedded preview, load half
+            // preview instead. That's slower...
             if (!KDcrawIface::KDcraw::loadHalfPreview(data, pixPath)) {
                 qWarning() << "unable to get preview for " << pixPath.toUtf8().constData();
                 return false;
@@ -92,8 +158,8 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
             previewRatio = 2;
         }
 
-        // And we need JpegContent too because of EXIF (orientation!).
-        if (!content.loadFromData(data)) {
+        // And we need the header too because of EXIF (orientation!).
+        if (!header.load(data)) {
             qWarning() << "unable to load preview for " << pixPath.toUtf8().constData();
             return false;
         }
@@ -113,7 +179,25 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
         }
 
         if (reader.format() == "jpeg" && GwenviewConfig::applyExifOrientation()) {
-            content.load(pixPath);
+            // Map the file: looking for the embedded thumbnail only reads the
+            // pages holding the metadata, and decoding the full image reuses
+            // the same bytes instead of reading the file a second time.
+            file.setFileName(pixPath);
+            const qint64 size = file.open(QIODevice::ReadOnly) ? file.size() : 0;
+            if (size > 0 && size <= std::numeric_limits<int>::max()) {
+                const uchar* mapped = file.map(0, size);
+                if (mapped) {
+                    data = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), size);
+                } else {
+                    data = file.readAll();
+                }
+            }
+            if (header.load(data)) {
+                buffer.setBuffer(&data);
+                buffer.open(QIODevice::ReadOnly);
+                reader.setDevice(&buffer);
+                reader.setFormat("jpeg");
+            }
         }
     }
 
@@ -121,9 +205,13 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
     // If applyExifOrientation is not set, don't use the
     // embedded thumbnail since it might be rotated differently
     // than the actual image
-    if (!content.rawData().isEmpty() && GwenviewConfig::applyExifOrientation()) {
-        QImage thumbnail = content.thumbnail();
-        orientation = content.orientation();
+    if (header.format() == "jpeg" && GwenviewConfig::applyExifOrientation()) {
+        QImage thumbnail;
+        if (header.thumbnailOffset() >= 0) {
+            const uchar* thumbnailData = reinterpret_cast<const uchar*>(data.constData()) + header.thumbnailOffset();
+            thumbnail = QImage::fromData(thumbnailData, header.thumbnailLength(), "JPEG");
+        }
+        orientation = header.orientation();
 
         if (qMax(thumbnail.width(), thumbnail.height()) >= pixelSize) {
             mImage = thumbnail;
@@ -131,8 +219,10 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
                 QMatrix matrix = ImageUtils::transformMatrix(orientation);
                 mImage = mImage.transformed(matrix);
             }
-            mOriginalWidth = content.size().width();
-            mOriginalHeight = content.size().height();
+            // For raw files, header describes the preview
+            const QSize size = rawSize.isValid() ? rawSize : header.size();
+            mOriginalWidth = size.width();
+            mOriginalHeight = size.height();
             return true;
         }
     }
@@ -163,8 +253,13 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
     if (!originalSize.isValid()) {
         originalSize = originalImage.size();
     }
-    mOriginalWidth = originalSize.width() * previewRatio;
-    mOriginalHeight = originalSize.height() * previewRatio;
+    if (rawSize.isValid()) {
+        originalSize = rawSize;
+    } else {
+        originalSize *= previewRatio;
+    }
+    mOriginalWidth = originalSize.width();
+    mOriginalHeight = originalSize.height();
 
     if (qMax(mOriginalWidth, mOriginalHeight) <= pixelSize) {
         mImage = originalImage;
@@ -180,6 +275,60 @@ bool ThumbnailContext::load(const QString &pixPath, int pixelSize)
     return true;
 }
 
+bool ThumbnailContext::loadEmbeddedPreview(const QByteArray& data, int pixelSize)
+{
+    GV_TRACE("thumbnail", "embeddedPreview");
+    mImage = QImage();
+    mNeedCaching = true;
+
+    Exiv2ImageLoader loader;
+    if (!loader.load(data)) {
+        return false;
+    }
+    const QSize originalSize = loader.imageSize();
+    if (!originalSize.isValid()) {
+        return false;
+    }
+    mOriginalWidth = originalSize.width();
+    mOriginalHeight = originalSize.height();
+
+    // Use the smallest preview which is large enough. If it cannot be
+    // decoded, or is not in data, try the next larger one.
+    QImage preview;
+    const QList<Exiv2ImageLoader::Preview> previews = loader.previews();
+    for (int idx = 0; idx < previews.count() && preview.isNull(); ++idx) {
+        const QSize size = previews.at(idx).size;
+        if (qMax(size.width(), size.height()) >= pixelSize) {
+            preview = decodePreview(loader.previewData(idx), pixelSize);
+        }
+    }
+    if (preview.isNull()) {
+        return false;
+    }
+
+    Exiv2::Image::AutoPtr image = loader.popImage();
+    Orientation orientation = NOT_AVAILABLE;
+    try {
+        const Exiv2::ExifData& exifData = image->exifData();
+        Exiv2::ExifData::const_iterator it = exifData.findKey(Exiv2::ExifKey("Exif.Image.Orientation"));
+        if (it != exifData.end()) {
+            orientation = Orientation(it->toLong());
+        }
+    } catch (const Exiv2::Error& error) {
+        qWarning() << "Could not read embedded preview:" << error.what();
+        return false;
+    }
+
+    mImage = preview;
+    if (GwenviewConfig::applyExifOrientation() && orientation != NORMAL && orientation != NOT_AVAILABLE) {
+        mImage = mImage.transformed(ImageUtils::transformMatrix(orientation));
+        if (orientation >= TRANSPOSE) {
+            qSwap(mOriginalWidth, mOriginalHeight);
+        }
+    }
+    return true;
+}
+
 //------------------------------------------------------------------------
 //
 // ThumbnailGenerator
@@ -269,8 +418,13 @@ void ThumbnailGenerator::run()
         Q_ASSERT(!pixPath.isNull());
         LOG("Loading" << pixPath);
         ThumbnailContext context;
+        // Share the CPU with the other image work
+        TaskScheduler::instance()->acquireSlot(TaskScheduler::ThumbnailClass);
         bool ok = context.load(pixPath, pixelSize);
+        TaskScheduler::instance()->releaseSlot(TaskScheduler::ThumbnailClass);
 
+        QString thumbnailPath;
+        QImage imageToCache;
         {
             QMutexLocker lock(&mMutex);
             if (ok) {
@@ -278,13 +432,21 @@ void ThumbnailGenerator::run()
                 mOriginalWidth = context.mOriginalWidth;
                 mOriginalHeight = context.mOriginalHeight;
                 if (context.mNeedCaching) {
-                    cacheThumbnail();
+                    addThumbnailInfo(&mImage, mOriginalUri, mOriginalTime, mOriginalFileSize,
+                                     mOriginalMimeType, QSize(mOriginalWidth, mOriginalHeight));
+                    thumbnailPath = mThumbnailPath;
+                    imageToCache = mImage;
                 }
             } else {
                 qWarning() << "Could not generate thumbnail for file" << mOriginalUri;
             }
             mPixPath.clear(); // done, ready for next
         }
+        if (!imageToCache.isNull()) {
+            // Emitted without holding mMutex: the writer may block us until
+            // it has caught up
+            emit thumbnailReadyToBeCached(thumbnailPath, imageToCache);
+        }
         if (testCancel()) {
             return;
         }
@@ -299,17 +461,20 @@ void ThumbnailGenerator::run()
     LOG("Ending thread");
 }
 
-void ThumbnailGenerator::cacheThumbnail()
+void ThumbnailGenerator::addThumbnailInfo(QImage* image,
+                                          const QString& originalUri,
+                                          time_t originalTime,
+                                          KIO::filesize_t originalFileSize,
+                                          const QString& originalMimeType,
+                                          const QSize& originalSize)
 {
-    mImage.setText(QStringLiteral("Thumb::URI")          , mOriginalUri);
-    mImage.setText(QStringLiteral("Thumb::MTime")        , QString::number(mOriginalTime));
-    mImage.setText(QStringLiteral("Thumb::Size")         , QString::number(mOriginalFileSize));
-    mImage.setText(QStringLiteral("Thumb::Mimetype")     , mOriginalMimeType);
-    mImage.setText(QStringLiteral("Thumb::Image::Width") , QString::number(mOriginalWidth));
-    mImage.setText(QStringLiteral("Thumb::Image::Height"), QString::number(mOriginalHeight));
-    mImage.setText(QStringLiteral("Software")            , QStringLiteral("Gwenview"));
-
-    emit thumbnailReadyToBeCached(mThumbnailPath, mImage);
+    image->setText(QStringLiteral("Thumb::URI")          , originalUri);
+    image->setText(QStringLiteral("Thumb::MTime")        , QString::number(originalTime));
+    image->setText(QStringLiteral("Thumb::Size")         , QString::number(originalFileSize));
+    image->setText(QStringLiteral("Thumb::Mimetype")     , originalMimeType);
+    image->setText(QStringLiteral("Thumb::Image::Width") , QString::number(originalSize.width()));
+    image->setText(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
+    image->setText(QStringLiteral("Software")            , QStringLiteral("Gwenview"));
 }
 
 } // namespace
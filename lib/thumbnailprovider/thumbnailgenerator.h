@@ -43,6 +43,13 @@ struct ThumbnailContext {
     bool mNeedCaching;
 
     bool load(const QString &pixPath, int pixelSize);
+
+    /**
+     * Loads the smallest preview embedded in the metadata of @p data which
+     * is at least @p pixelSize large. @p data can contain only the beginning
+     * of the file.
+     */
+    bool loadEmbeddedPreview(const QByteArray& data, int pixelSize);
 };
 
 class ThumbnailGenerator : public QThread
@@ -66,6 +73,17 @@ public:
     time_t originalTime() const;
     KIO::filesize_t originalFileSize() const;
     QString originalMimeType() const;
+
+    /**
+     * Sets the text keys the thumbnail spec requires on cached thumbnails
+     */
+    static void addThumbnailInfo(QImage* image,
+                                 const QString& originalUri,
+                                 time_t originalTime,
+                                 KIO::filesize_t originalFileSize,
+                                 const QString& originalMimeType,
+                                 const QSize& originalSize);
+
 protected:
     void run() override;
 
@@ -75,7 +93,6 @@ Q_SIGNALS:
 
 private:
     bool testCancel();
-    void cacheThumbnail();
     QImage mImage;
     QString mPixPath;
     QString mThumbnailPath;
@@ -31,22 +31,28 @@
 #include <QDir>
 #include <QFile>
 #include <QImage>
+#include <QMutex>
 #include <QPixmap>
+#include <QSet>
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QTemporaryFile>
 #include <QApplication>
 #include <QStandardPaths>
+#include <qplatformdefs.h>
 
 // KDE
+#include <KIO/FileJob>
 #include <KIO/JobUiDelegate>
 #include <KIO/PreviewJob>
 #include <KJobWidgets>
 
 // Local
 #include "mimetypeutils.h"
+#include "taskscheduler.h"
 #include "thumbnailwriter.h"
 #include "thumbnailgenerator.h"
+#include "tracer.h"
 #include "urlutils.h"
 
 namespace Gwenview
@@ -77,28 +83,132 @@ static QString generateThumbnailPath(const QString& uri, ThumbnailGroup::Enum gr
     return baseDir + QFile::encodeName(QString::fromLatin1(md5.result().toHex())) + QStringLiteral(".png");
 }
 
+static bool isInThumbnailBaseDir(const QUrl& url)
+{
+    return url.isLocalFile()
+        && url.adjusted(QUrl::RemoveFilename|QUrl::StripTrailingSlash).path().startsWith(ThumbnailProvider::thumbnailBaseDir());
+}
+
+static bool isThumbnailValid(const QImage& thumb, const QString& originalUri, time_t originalTime, KIO::filesize_t originalFileSize)
+{
+    if (thumb.isNull()) {
+        return false;
+    }
+    KIO::filesize_t fileSize = thumb.text(QStringLiteral("Thumb::Size")).toULongLong();
+    return thumb.text(QStringLiteral("Thumb::URI")) == originalUri &&
+           thumb.text(QStringLiteral("Thumb::MTime")).toInt() == originalTime &&
+           (fileSize == 0 || fileSize == originalFileSize);
+}
+
+// Returns an invalid size if the thumbnail does not contain the size of the original
+static QSize originalImageSize(const QImage& thumb)
+{
+    bool ok;
+    int width = thumb.text(QStringLiteral("Thumb::Image::Width")).toInt(&ok);
+    if (!ok) {
+        return QSize();
+    }
+    int height = thumb.text(QStringLiteral("Thumb::Image::Height")).toInt(&ok);
+    if (!ok) {
+        return QSize();
+    }
+    return QSize(width, height);
+}
+
+// Maximum number of items whose cache is validated in one go
+static const int CACHE_PROBE_BATCH_SIZE = 64;
+
+// Amount of data read from the beginning of remote originals to look for an
+// embedded preview. This is enough for EXIF thumbnails and the small previews
+// found at the beginning of most raw files.
+static const int REMOTE_HEAD_SIZE = 256 * 1024;
+
+// Reading the beginning of the next remote originals while the current one is
+// being processed hides the latency
+static const int MAX_REMOTE_HEAD_JOBS = 4;
+static const int REMOTE_HEAD_LOOKAHEAD = 8;
+
+static ThumbnailContext loadThumbnailFromRemoteHead(const QByteArray& data, int pixelSize)
+{
+    ThumbnailContext context;
+    if (!context.loadEmbeddedPreview(data, pixelSize)) {
+        context.mImage = QImage();
+    }
+    return context;
+}
+
+//------------------------------------------------------------------------
+//
+// RemoteHeadBuffer
+//
+//------------------------------------------------------------------------
+RemoteHeadBuffer::RemoteHeadBuffer(int size)
+: mSize(size)
+, mFinished(false)
+{
+}
+
+int RemoteHeadBuffer::append(const QByteArray& chunk)
+{
+    if (mFinished) {
+        return 0;
+    }
+    mData += chunk.left(mSize - mData.size());
+    // An empty chunk means we reached the end of the file
+    if (chunk.isEmpty() || mData.size() >= mSize) {
+        mFinished = true;
+        return 0;
+    }
+    return mSize - mData.size();
+}
+
+void RemoteHeadBuffer::finish()
+{
+    mFinished = true;
+}
+
+bool RemoteHeadBuffer::isFinished() const
+{
+    return mFinished;
+}
+
+QByteArray RemoteHeadBuffer::data() const
+{
+    return mData;
+}
+
 //------------------------------------------------------------------------
 //
 // ThumbnailProvider static methods
 //
 //------------------------------------------------------------------------
-static QString sThumbnailBaseDir;
+// Read by cache lookups running on worker threads
+struct ThumbnailBaseDir
+{
+    QMutex mMutex;
+    QString mDir;
+};
+Q_GLOBAL_STATIC(ThumbnailBaseDir, sThumbnailBaseDir)
+
 QString ThumbnailProvider::thumbnailBaseDir()
 {
-    if (sThumbnailBaseDir.isEmpty()) {
+    QMutexLocker locker(&sThumbnailBaseDir->mMutex);
+    QString& dir = sThumbnailBaseDir->mDir;
+    if (dir.isEmpty()) {
         const QByteArray customDir = qgetenv("GV_THUMBNAIL_DIR");
         if (customDir.isEmpty()) {
-            sThumbnailBaseDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/thumbnails/");
+            dir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/thumbnails/");
         } else {
-            sThumbnailBaseDir = QFile::decodeName(customDir) + QLatin1Char('/');
+            dir = QFile::decodeName(customDir) + QLatin1Char('/');
         }
     }
-    return sThumbnailBaseDir;
+    return dir;
 }
 
 void ThumbnailProvider::setThumbnailBaseDir(const QString& dir)
 {
-    sThumbnailBaseDir = dir;
+    QMutexLocker locker(&sThumbnailBaseDir->mMutex);
+    sThumbnailBaseDir->mDir = dir;
 }
 
 QString ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Enum group)
@@ -111,6 +221,12 @@ QString ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Enum group)
     case ThumbnailGroup::Large:
         dir += QStringLiteral("large/");
         break;
+    case ThumbnailGroup::XLarge:
+        dir += QStringLiteral("x-large/");
+        break;
+    case ThumbnailGroup::XXLarge:
+        dir += QStringLiteral("xx-large/");
+        break;
     }
     return dir;
 }
@@ -118,8 +234,9 @@ QString ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Enum group)
 void ThumbnailProvider::deleteImageThumbnail(const QUrl &url)
 {
     QString uri = generateOriginalUri(url);
-    QFile::remove(generateThumbnailPath(uri, ThumbnailGroup::Normal));
-    QFile::remove(generateThumbnailPath(uri, ThumbnailGroup::Large));
+    for (ThumbnailGroup::Enum group : ThumbnailGroup::allGroups) {
+        QFile::remove(generateThumbnailPath(uri, group));
+    }
 }
 
 static void moveThumbnailHelper(const QString& oldUri, const QString& newUri, ThumbnailGroup::Enum group)
@@ -139,8 +256,9 @@ void ThumbnailProvider::moveThumbnail(const QUrl &oldUrl, const QUrl& newUrl)
 {
     QString oldUri = generateOriginalUri(oldUrl);
     QString newUri = generateOriginalUri(newUrl);
-    moveThumbnailHelper(oldUri, newUri, ThumbnailGroup::Normal);
-    moveThumbnailHelper(oldUri, newUri, ThumbnailGroup::Large);
+    for (ThumbnailGroup::Enum group : ThumbnailGroup::allGroups) {
+        moveThumbnailHelper(oldUri, newUri, group);
+    }
 }
 
 //------------------------------------------------------------------------
@@ -154,14 +272,17 @@ ThumbnailProvider::ThumbnailProvider()
 , mOriginalTime(0)
 {
     LOG(this);
+    mCacheProbeWatcher = new QFutureWatcher<void>(this);
+    connect(mCacheProbeWatcher, SIGNAL(finished()), SLOT(slotCacheProbed()));
+    mRemoteHeadWatcher = new QFutureWatcher<ThumbnailContext>(this);
+    connect(mRemoteHeadWatcher, SIGNAL(finished()), SLOT(slotRemoteHeadDecoded()));
 
     // Make sure we have a place to store our thumbnails
-    QString thumbnailDirNormal = ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Normal);
-    QString thumbnailDirLarge = ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::Large);
-    QDir().mkpath(thumbnailDirNormal);
-    QDir().mkpath(thumbnailDirLarge);
-    QFile::setPermissions(thumbnailDirNormal, QFileDevice::WriteOwner | QFileDevice::ReadOwner | QFileDevice::ExeOwner);
-    QFile::setPermissions(thumbnailDirLarge, QFileDevice::WriteOwner | QFileDevice::ReadOwner | QFileDevice::ExeOwner);
+    for (ThumbnailGroup::Enum group : ThumbnailGroup::allGroups) {
+        const QString thumbnailDir = ThumbnailProvider::thumbnailBaseDir(group);
+        QDir().mkpath(thumbnailDir);
+        QFile::setPermissions(thumbnailDir, QFileDevice::WriteOwner | QFileDevice::ReadOwner | QFileDevice::ExeOwner);
+    }
 
     // Look for images and store the items in our todo list
     mCurrentItem = KFileItem();
@@ -172,6 +293,10 @@ ThumbnailProvider::ThumbnailProvider()
 ThumbnailProvider::~ThumbnailProvider()
 {
     LOG(this);
+    // Probes work on mCacheProbes, they must be done before it goes away
+    mCacheProbeWatcher->waitForFinished();
+    mRemoteHeadWatcher->waitForFinished();
+    clearRemoteHeads();
     abortSubjob();
     mThumbnailGenerator->cancel();
     disconnect(mThumbnailGenerator, nullptr, this, nullptr);
@@ -189,6 +314,12 @@ void ThumbnailProvider::stop()
     // but also make sure that at most two ThumbnailGenerators are running.
     // startCreatingThumbnail() will take care that these two threads won't work on the same item.
     mItems.clear();
+    mProbedOriginalTimes.clear();
+    clearRemoteHeads();
+    if (mState == STATE_READORIGHEAD) {
+        // Nothing is going to resume the current item
+        mCurrentItem = KFileItem();
+    }
     abortSubjob();
     if (mThumbnailGenerator->isRunning() && !mPreviousThumbnailGenerator) {
         mPreviousThumbnailGenerator = mThumbnailGenerator;
@@ -207,6 +338,10 @@ const KFileItemList& ThumbnailProvider::pendingItems() const
 
 void ThumbnailProvider::setThumbnailGroup(ThumbnailGroup::Enum group)
 {
+    if (mThumbnailGroup != group) {
+        // Probe results are only valid for one group
+        mProbedOriginalTimes.clear();
+    }
     mThumbnailGroup = group;
 }
 
@@ -241,9 +376,15 @@ void ThumbnailProvider::removeItems(const KFileItemList& itemList)
         // If we are removing the next item, update to be the item after or the
         // first if we removed the last item
         mItems.removeAll(item);
+        mProbedOriginalTimes.remove(item.url());
+        forgetRemoteHead(item.url().adjusted(QUrl::NormalizePathSegments));
 
         if (item == mCurrentItem) {
             abortSubjob();
+            if (mState == STATE_READORIGHEAD) {
+                // Its head has been forgotten, nothing is going to resume it
+                mCurrentItem = KFileItem();
+            }
         }
     }
 
@@ -256,11 +397,12 @@ void ThumbnailProvider::removeItems(const KFileItemList& itemList)
 void ThumbnailProvider::removePendingItems()
 {
     mItems.clear();
+    mProbedOriginalTimes.clear();
 }
 
 bool ThumbnailProvider::isRunning() const
 {
-    return !mCurrentItem.isNull();
+    return !mCurrentItem.isNull() || mCacheProbeWatcher->isRunning();
 }
 
 //-Internal--------------------------------------------------------------
@@ -271,9 +413,11 @@ void ThumbnailProvider::createNewThumbnailGenerator()
             SLOT(thumbnailReady(QImage,QSize)),
             Qt::QueuedConnection);
 
+    // Direct connection: queueThumbnail() is thread-safe and blocks the
+    // generator thread when the writer cannot keep up
     connect(mThumbnailGenerator, SIGNAL(thumbnailReadyToBeCached(QString,QImage)),
             sThumbnailWriter, SLOT(queueThumbnail(QString,QImage)),
-            Qt::QueuedConnection);
+            Qt::DirectConnection);
 }
 
 void ThumbnailProvider::abortSubjob()
@@ -292,6 +436,12 @@ void ThumbnailProvider::determineNextIcon()
     LOG(this);
     mState = STATE_NEXTTHUMB;
 
+    if (mCacheProbeWatcher->isRunning()) {
+        // slotCacheProbed() will call us again
+        mCurrentItem = KFileItem();
+        return;
+    }
+
     // No more items ?
     if (mItems.isEmpty()) {
         LOG("No more items. Nothing to do");
@@ -300,6 +450,12 @@ void ThumbnailProvider::determineNextIcon()
         return;
     }
 
+    // Validate the cache of the next local items in one go
+    if (startCacheProbe()) {
+        mCurrentItem = KFileItem();
+        return;
+    }
+
     mCurrentItem = mItems.takeFirst();
     LOG("mCurrentItem.url=" << mCurrentItem.url());
 
@@ -308,8 +464,16 @@ void ThumbnailProvider::determineNextIcon()
     mCurrentUrl = mCurrentItem.url().adjusted(QUrl::NormalizePathSegments);
     mOriginalFileSize = mCurrentItem.size();
 
-    // Do direct stat instead of using KIO if the file is local (faster)
-    if (UrlUtils::urlIsFastLocalFile(mCurrentUrl)) {
+    QHash<QUrl, time_t>::Iterator probedIt = mProbedOriginalTimes.find(mCurrentItem.url());
+    if (probedIt != mProbedOriginalTimes.end()) {
+        // A probe already found out there is no valid thumbnail
+        mOriginalTime = probedIt.value();
+        mProbedOriginalTimes.erase(probedIt);
+        mOriginalUri = generateOriginalUri(mCurrentUrl);
+        mThumbnailPath = generateThumbnailPath(mOriginalUri, mThumbnailGroup);
+        QMetaObject::invokeMethod(this, "generateThumbnail", Qt::QueuedConnection);
+    } else if (UrlUtils::urlIsFastLocalFile(mCurrentUrl)) {
+        // Do direct stat instead of using KIO if the file is local (faster)
         QFileInfo fileInfo(mCurrentUrl.toLocalFile());
         mOriginalTime = fileInfo.lastModified().toTime_t();
         QMetaObject::invokeMethod(this, "checkThumbnail", Qt::QueuedConnection);
@@ -337,6 +501,7 @@ void ThumbnailProvider::slotResult(KJob * job)
     case STATE_STATORIG: {
         // Could not stat original, drop this one and move on to the next one
         if (job->error()) {
+            forgetRemoteHead(mCurrentUrl);
             emitThumbnailLoadingFailed();
             determineNextIcon();
             return;
@@ -349,6 +514,11 @@ void ThumbnailProvider::slotResult(KJob * job)
         return;
     }
 
+    case STATE_READORIGHEAD:
+        // Not a subjob, see slotRemoteHeadResult()
+        Q_ASSERT(false);
+        return;
+
     case STATE_DOWNLOADORIG:
         if (job->error()) {
             emitThumbnailLoadingFailed();
@@ -386,26 +556,47 @@ void ThumbnailProvider::thumbnailReady(const QImage& _img, const QSize& _size)
 
 QImage ThumbnailProvider::loadThumbnailFromCache() const
 {
-    QImage image = sThumbnailWriter->value(mThumbnailPath);
+    return loadThumbnailFromCache(mThumbnailPath, mOriginalUri, mThumbnailGroup, mOriginalTime);
+}
+
+QImage ThumbnailProvider::loadThumbnailFromCache(const QString& thumbnailPath, const QString& originalUri,
+                                                 ThumbnailGroup::Enum thumbnailGroup, time_t originalTime)
+{
+    QImage image = sThumbnailWriter->value(thumbnailPath);
     if (!image.isNull()) {
         return image;
     }
 
-    image = QImage(mThumbnailPath);
-    if (image.isNull() && mThumbnailGroup == ThumbnailGroup::Normal) {
-        // If there is a large-sized thumbnail, generate the normal-sized version from it
-        QString largeThumbnailPath = generateThumbnailPath(mOriginalUri, ThumbnailGroup::Large);
-        QImage largeImage(largeThumbnailPath);
-        if (largeImage.isNull()) {
-            return image;
+    image = QImage(thumbnailPath);
+    if (!image.isNull()) {
+        return image;
+    }
+
+    // If there is a thumbnail from a larger group, generate our version from
+    // it. Try the closest group first, it is the cheapest to load and scale.
+    for (ThumbnailGroup::Enum group : ThumbnailGroup::allGroups) {
+        if (group <= thumbnailGroup) {
+            continue;
         }
-        int size = ThumbnailGroup::pixelSize(ThumbnailGroup::Normal);
-        image = largeImage.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        Q_FOREACH(const QString& key, largeImage.textKeys()) {
-            QString text = largeImage.text(key);
+        const QString largerThumbnailPath = generateThumbnailPath(originalUri, group);
+        QImage largerImage = sThumbnailWriter->value(largerThumbnailPath);
+        if (largerImage.isNull()) {
+            largerImage = QImage(largerThumbnailPath);
+        }
+        if (largerImage.isNull()
+                || largerImage.text(QStringLiteral("Thumb::MTime")).toInt() != originalTime) {
+            continue;
+        }
+        const int size = ThumbnailGroup::pixelSize(thumbnailGroup);
+        image = largerImage.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        Q_FOREACH(const QString& key, largerImage.textKeys()) {
+            QString text = largerImage.text(key);
             image.setText(key, text);
         }
-        sThumbnailWriter->queueThumbnail(mThumbnailPath, image);
+        // May run in a TaskScheduler task: do not wait for the writers. The
+        // thumbnail can be scaled again next time if it gets dropped.
+        sThumbnailWriter->queueThumbnailIfRoom(thumbnailPath, image);
+        break;
     }
 
     return image;
@@ -420,8 +611,7 @@ void ThumbnailProvider::checkThumbnail()
     }
 
     // If we are in the thumbnail dir, just load the file
-    if (mCurrentUrl.isLocalFile()
-            && mCurrentUrl.adjusted(QUrl::RemoveFilename|QUrl::StripTrailingSlash).path().startsWith(thumbnailBaseDir())) {
+    if (isInThumbnailBaseDir(mCurrentUrl)) {
         QImage image(mCurrentUrl.toLocalFile());
         emitThumbnailLoaded(image, image.size());
         determineNextIcon();
@@ -434,33 +624,26 @@ void ThumbnailProvider::checkThumbnail()
     LOG("Stat thumb" << mThumbnailPath);
 
     QImage thumb = loadThumbnailFromCache();
-    KIO::filesize_t fileSize = thumb.text(QStringLiteral("Thumb::Size")).toULongLong();
-    if (!thumb.isNull()) {
-        if (thumb.text(QStringLiteral("Thumb::URI")) == mOriginalUri &&
-                thumb.text(QStringLiteral("Thumb::MTime")).toInt() == mOriginalTime &&
-                 (fileSize == 0 || fileSize == mOriginalFileSize)) {
-            int width = 0, height = 0;
-            QSize size;
-            bool ok;
-
-            width = thumb.text(QStringLiteral("Thumb::Image::Width")).toInt(&ok);
-            if (ok) height = thumb.text(QStringLiteral("Thumb::Image::Height")).toInt(&ok);
-            if (ok) {
-                size = QSize(width, height);
-            } else {
-                LOG("Thumbnail for" << mOriginalUri << "does not contain correct image size information");
-                // Don't try to determine the size of a video, it probably won't work and
-                // will cause high I/O usage with big files (bug #307007).
-                if (MimeTypeUtils::urlKind(mCurrentUrl) == MimeTypeUtils::KIND_VIDEO) {
-                    emitThumbnailLoaded(thumb, QSize());
-                    determineNextIcon();
-                    return;
-                }
-            }
-            emitThumbnailLoaded(thumb, size);
-            determineNextIcon();
-            return;
-        }
+    if (isThumbnailValid(thumb, mOriginalUri, mOriginalTime, mOriginalFileSize)) {
+        // If the thumbnail does not contain the image size, don't try to
+        // determine it: for videos it probably won't work and will cause
+        // high I/O usage with big files (bug #307007).
+        // The head may have been prefetched before we knew it was not needed.
+        forgetRemoteHead(mCurrentUrl);
+        emitThumbnailLoaded(thumb, originalImageSize(thumb));
+        determineNextIcon();
+        return;
+    }
+
+    generateThumbnail();
+}
+
+void ThumbnailProvider::generateThumbnail()
+{
+    if (mCurrentItem.isNull()) {
+        // This can happen if current item has been removed by removeItems()
+        determineNextIcon();
+        return;
     }
 
     // Thumbnail not found or not valid
@@ -468,25 +651,16 @@ void ThumbnailProvider::checkThumbnail()
         if (mCurrentUrl.isLocalFile()) {
             // Original is a local file, create the thumbnail
             startCreatingThumbnail(mCurrentUrl.toLocalFile());
-        } else {
-            // Original is remote, download it
-            mState = STATE_DOWNLOADORIG;
-
-            QTemporaryFile tempFile;
-            tempFile.setAutoRemove(false);
-            if (!tempFile.open()) {
-                qWarning() << "Couldn't create temp file to download " << mCurrentUrl.toDisplayString();
-                emitThumbnailLoadingFailed();
-                determineNextIcon();
-                return;
+        } else if (shouldReadRemoteHead(mCurrentItem)) {
+            // Original is remote, look for a preview in its first bytes
+            mState = STATE_READORIGHEAD;
+            startReadingRemoteHead(mCurrentUrl);
+            prefetchRemoteHeads();
+            if (mRemoteHeads.value(mCurrentUrl).isFinished()) {
+                processRemoteHead();
             }
-            mTempPath = tempFile.fileName();
-
-            QUrl url = QUrl::fromLocalFile(mTempPath);
-            KIO::Job* job = KIO::file_copy(mCurrentUrl, url, -1, KIO::Overwrite | KIO::HideProgressInfo);
-            KJobWidgets::setWindow(job, qApp->activeWindow());
-            LOG("Download remote file" << mCurrentUrl.toDisplayString() << "to" << url.toDisplayString());
-            addSubjob(job);
+        } else {
+            downloadOriginal();
         }
     } else {
         // Not a raster image, use a KPreviewJob
@@ -508,6 +682,269 @@ void ThumbnailProvider::checkThumbnail()
     }
 }
 
+void ThumbnailProvider::downloadOriginal()
+{
+    // Original is remote, download it
+    mState = STATE_DOWNLOADORIG;
+
+    QTemporaryFile tempFile;
+    tempFile.setAutoRemove(false);
+    if (!tempFile.open()) {
+        qWarning() << "Couldn't create temp file to download " << mCurrentUrl.toDisplayString();
+        emitThumbnailLoadingFailed();
+        determineNextIcon();
+        return;
+    }
+    mTempPath = tempFile.fileName();
+
+    QUrl url = QUrl::fromLocalFile(mTempPath);
+    KIO::Job* job = KIO::file_copy(mCurrentUrl, url, -1, KIO::Overwrite | KIO::HideProgressInfo);
+    KJobWidgets::setWindow(job, qApp->activeWindow());
+    LOG("Download remote file" << mCurrentUrl.toDisplayString() << "to" << url.toDisplayString());
+    GV_TRACE_EVENT("thumbnail", "downloadOriginal", mCurrentUrl.toDisplayString());
+    addSubjob(job);
+}
+
+bool ThumbnailProvider::shouldReadRemoteHead(const KFileItem& item) const
+{
+    if (item.url().isLocalFile() || MimeTypeUtils::fileItemKind(item) != MimeTypeUtils::KIND_RASTER_IMAGE) {
+        return false;
+    }
+    // Only worth it for large files. The size must be known, since KIO does
+    // not tell when a read stops at the end of the file
+    const KIO::filesize_t size = item.size();
+    return size != KIO::filesize_t(-1) && size > KIO::filesize_t(2 * REMOTE_HEAD_SIZE);
+}
+
+void ThumbnailProvider::startReadingRemoteHead(const QUrl& url)
+{
+    if (mRemoteHeads.contains(url)) {
+        return;
+    }
+    LOG("Reading head of" << url.toDisplayString());
+    mRemoteHeads.insert(url, RemoteHeadBuffer(REMOTE_HEAD_SIZE));
+
+    KIO::FileJob* job = KIO::open(url, QIODevice::ReadOnly);
+    KJobWidgets::setWindow(job, qApp->activeWindow());
+    connect(job, SIGNAL(open(KIO::Job*)), SLOT(slotRemoteHeadOpened(KIO::Job*)));
+    connect(job, SIGNAL(data(KIO::Job*,QByteArray)), SLOT(slotRemoteHeadData(KIO::Job*,QByteArray)));
+    connect(job, SIGNAL(result(KJob*)), SLOT(slotRemoteHeadResult(KJob*)));
+    mRemoteHeadJobs.insert(job, url);
+}
+
+void ThumbnailProvider::prefetchRemoteHeads()
+{
+    int count = 0;
+    for (const KFileItem& item : qAsConst(mItems)) {
+        if (mRemoteHeadJobs.count() >= MAX_REMOTE_HEAD_JOBS || ++count > REMOTE_HEAD_LOOKAHEAD) {
+            break;
+        }
+        if (shouldReadRemoteHead(item)) {
+            startReadingRemoteHead(item.url().adjusted(QUrl::NormalizePathSegments));
+        }
+    }
+}
+
+void ThumbnailProvider::slotRemoteHeadOpened(KIO::Job* job)
+{
+    static_cast<KIO::FileJob*>(job)->read(REMOTE_HEAD_SIZE);
+}
+
+void ThumbnailProvider::slotRemoteHeadData(KIO::Job* job, const QByteArray& data)
+{
+    KIO::FileJob* fileJob = static_cast<KIO::FileJob*>(job);
+    const QUrl url = mRemoteHeadJobs.value(fileJob);
+    QHash<QUrl, RemoteHeadBuffer>::Iterator it = mRemoteHeads.find(url);
+    if (it == mRemoteHeads.end()) {
+        finishRemoteHead(fileJob);
+        return;
+    }
+    // Slaves may send less than what we asked for, ask for the rest
+    const int remaining = it->append(data);
+    if (remaining > 0) {
+        fileJob->read(remaining);
+    } else {
+        finishRemoteHead(fileJob);
+    }
+}
+
+void ThumbnailProvider::slotRemoteHeadResult(KJob* job)
+{
+    // Only called if the job fails or ends before we got all the data
+    LOG("Reading head failed:" << job->errorString());
+    finishRemoteHead(static_cast<KIO::FileJob*>(job));
+}
+
+void ThumbnailProvider::finishRemoteHead(KIO::FileJob* job)
+{
+    const QUrl url = mRemoteHeadJobs.take(job);
+    disconnect(job, nullptr, this, nullptr);
+    if (!job->error()) {
+        job->close();
+    }
+    QHash<QUrl, RemoteHeadBuffer>::Iterator it = mRemoteHeads.find(url);
+    if (it != mRemoteHeads.end()) {
+        it->finish();
+    }
+
+    if (mState == STATE_READORIGHEAD && url == mCurrentUrl && !mCurrentItem.isNull()) {
+        processRemoteHead();
+    }
+    prefetchRemoteHeads();
+}
+
+void ThumbnailProvider::processRemoteHead()
+{
+    const QByteArray data = mRemoteHeads.take(mCurrentUrl).data();
+    if (data.isEmpty()) {
+        downloadOriginal();
+        return;
+    }
+    mRemoteHeadDecodingUrl = mCurrentUrl;
+    const int pixelSize = ThumbnailGroup::pixelSize(mThumbnailGroup);
+    mRemoteHeadWatcher->setFuture(TaskScheduler::instance()->run(TaskScheduler::ThumbnailClass, [data, pixelSize]() {
+        return loadThumbnailFromRemoteHead(data, pixelSize);
+    }));
+}
+
+void ThumbnailProvider::slotRemoteHeadDecoded()
+{
+    if (mState != STATE_READORIGHEAD || mCurrentItem.isNull() || mCurrentUrl != mRemoteHeadDecodingUrl) {
+        // We have been stopped in the meantime
+        return;
+    }
+    const ThumbnailContext context = mRemoteHeadWatcher->result();
+    if (context.mImage.isNull()) {
+        LOG("No usable preview in head of" << mCurrentUrl.toDisplayString());
+        downloadOriginal();
+        return;
+    }
+
+    QImage image = context.mImage;
+    if (context.mNeedCaching) {
+        ThumbnailGenerator::addThumbnailInfo(&image, mOriginalUri, mOriginalTime, mOriginalFileSize,
+                                             mCurrentItem.mimetype(),
+                                             QSize(context.mOriginalWidth, context.mOriginalHeight));
+        sThumbnailWriter->queueThumbnail(mThumbnailPath, image);
+    }
+    emitThumbnailLoaded(image, QSize(context.mOriginalWidth, context.mOriginalHeight));
+    determineNextIcon();
+}
+
+void ThumbnailProvider::forgetRemoteHead(const QUrl& url)
+{
+    if (mRemoteHeads.remove(url) == 0) {
+        return;
+    }
+    KIO::FileJob* job = mRemoteHeadJobs.key(url);
+    if (job) {
+        mRemoteHeadJobs.remove(job);
+        disconnect(job, nullptr, this, nullptr);
+        job->kill();
+    }
+}
+
+void ThumbnailProvider::clearRemoteHeads()
+{
+    for (QHash<KIO::FileJob*, QUrl>::ConstIterator it = mRemoteHeadJobs.constBegin(); it != mRemoteHeadJobs.constEnd(); ++it) {
+        disconnect(it.key(), nullptr, this, nullptr);
+        it.key()->kill();
+    }
+    mRemoteHeadJobs.clear();
+    mRemoteHeads.clear();
+}
+
+bool ThumbnailProvider::startCacheProbe()
+{
+    Q_ASSERT(mCacheProbes.isEmpty());
+    for (const KFileItem& item : qAsConst(mItems)) {
+        if (mCacheProbes.count() == CACHE_PROBE_BATCH_SIZE) {
+            break;
+        }
+        const QUrl url = item.url().adjusted(QUrl::NormalizePathSegments);
+        if (mProbedOriginalTimes.contains(item.url())
+                || !UrlUtils::urlIsFastLocalFile(url)
+                || isInThumbnailBaseDir(url)) {
+            // Only probe leading items, to keep thumbnails coming in order
+            break;
+        }
+        CacheProbe probe;
+        probe.item = item;
+        probe.localPath = url.toLocalFile();
+        probe.originalUri = generateOriginalUri(url);
+        probe.thumbnailPath = generateThumbnailPath(probe.originalUri, mThumbnailGroup);
+        probe.group = mThumbnailGroup;
+        probe.originalFileSize = item.size();
+        probe.probed = false;
+        probe.statOk = false;
+        probe.originalTime = 0;
+        mCacheProbes << probe;
+    }
+    if (mCacheProbes.isEmpty()) {
+        return false;
+    }
+    LOG("Probing" << mCacheProbes.count() << "items");
+    mCacheProbeWatcher->setFuture(TaskScheduler::instance()->map(TaskScheduler::ThumbnailClass, mCacheProbes, &ThumbnailProvider::probeCache));
+    return true;
+}
+
+void ThumbnailProvider::probeCache(CacheProbe& probe)
+{
+    GV_TRACE("thumbnail", "cacheProbe");
+    QT_STATBUF buf;
+    probe.probed = true;
+    probe.statOk = QT_STAT(QFile::encodeName(probe.localPath).constData(), &buf) == 0;
+    if (!probe.statOk) {
+        return;
+    }
+    probe.originalTime = buf.st_mtime;
+    QImage thumb = loadThumbnailFromCache(probe.thumbnailPath, probe.originalUri, probe.group, probe.originalTime);
+    if (isThumbnailValid(thumb, probe.originalUri, probe.originalTime, probe.originalFileSize)) {
+        probe.thumbnail = thumb;
+    }
+}
+
+void ThumbnailProvider::slotCacheProbed()
+{
+    QSet<QUrl> pendingUrls;
+    for (const KFileItem& item : qAsConst(mItems)) {
+        pendingUrls.insert(item.url());
+    }
+
+    // Deliver all cache hits at once, only keep the items which need to be generated
+    QSet<QUrl> doneUrls;
+    for (const CacheProbe& probe : qAsConst(mCacheProbes)) {
+        const QUrl url = probe.item.url();
+        if (!probe.probed || probe.group != mThumbnailGroup || !pendingUrls.contains(url)) {
+            // Removed or thumbnail group changed while we were probing
+            continue;
+        }
+        if (!probe.statOk) {
+            doneUrls.insert(url);
+            emit thumbnailLoadingFailed(probe.item);
+        } else if (!probe.thumbnail.isNull()) {
+            doneUrls.insert(url);
+            emit thumbnailLoaded(probe.item, QPixmap::fromImage(probe.thumbnail),
+                                 originalImageSize(probe.thumbnail), probe.originalFileSize);
+        } else {
+            mProbedOriginalTimes.insert(url, probe.originalTime);
+        }
+    }
+    mCacheProbes.clear();
+
+    if (!doneUrls.isEmpty()) {
+        KFileItemList items;
+        items.reserve(mItems.count() - doneUrls.count());
+        for (const KFileItem& item : qAsConst(mItems)) {
+            if (!doneUrls.contains(item.url())) {
+                items << item;
+            }
+        }
+        mItems = items;
+    }
+    determineNextIcon();
+}
+
 void ThumbnailProvider::startCreatingThumbnail(const QString& pixPath)
 {
     LOG("Creating thumbnail from" << pixPath);
@@ -566,4 +1003,36 @@ bool ThumbnailProvider::isThumbnailWriterEmpty()
     return sThumbnailWriter->isEmpty();
 }
 
+QImage ThumbnailProvider::cachedThumbnail(const QUrl &url_)
+{
+    const QUrl url = url_.adjusted(QUrl::NormalizePathSegments);
+    if (!UrlUtils::urlIsFastLocalFile(url)) {
+        return QImage();
+    }
+    const QFileInfo fileInfo(url.toLocalFile());
+    if (!fileInfo.exists()) {
+        return QImage();
+    }
+    const QString uri = generateOriginalUri(url);
+    const time_t mtime = fileInfo.lastModified().toTime_t();
+
+    // Largest first
+    const ThumbnailGroup::Enum groups[] = {
+        ThumbnailGroup::XXLarge, ThumbnailGroup::XLarge, ThumbnailGroup::Large, ThumbnailGroup::Normal
+    };
+    for (ThumbnailGroup::Enum group : groups) {
+        const QString path = generateThumbnailPath(uri, group);
+        QImage image = sThumbnailWriter->value(path);
+        if (image.isNull()) {
+            image = QImage(path);
+        }
+        if (!image.isNull()
+                && image.text(QStringLiteral("Thumb::URI")) == uri
+                && image.text(QStringLiteral("Thumb::MTime")).toInt() == mtime) {
+            return image;
+        }
+    }
+    return QImage();
+}
+
 } // namespace
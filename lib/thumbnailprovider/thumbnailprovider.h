@@ -27,14 +27,22 @@
 #include <lib/gwenviewlib_export.h>
 
 // Qt
+#include <QFutureWatcher>
+#include <QHash>
 #include <QImage>
 #include <QPixmap>
 #include <QPointer>
+#include <QVector>
 
 // KDE
 #include <KIO/Job>
 #include <KFileItem>
 
+namespace KIO
+{
+class FileJob;
+}
+
 // Local
 #include <lib/thumbnailgroup.h>
 
@@ -43,6 +51,37 @@ namespace Gwenview
 
 class ThumbnailGenerator;
 class ThumbnailWriter;
+struct ThumbnailContext;
+
+/**
+ * Collects the first bytes of a remote file. KIO may deliver them in chunks
+ * smaller than what has been asked for.
+ */
+class GWENVIEWLIB_EXPORT RemoteHeadBuffer
+{
+public:
+    explicit RemoteHeadBuffer(int size = 0);
+
+    /**
+     * Appends @p chunk and returns how many bytes must still be read, or 0
+     * once the buffer is full or @p chunk is empty, which marks the end of
+     * the file.
+     */
+    int append(const QByteArray& chunk);
+
+    /**
+     * Stops collecting, for example because the read failed
+     */
+    void finish();
+
+    bool isFinished() const;
+    QByteArray data() const;
+
+private:
+    QByteArray mData;
+    int mSize;
+    bool mFinished;
+};
 
 /**
  * A job that determines the thumbnails for the images in the current directory
@@ -114,6 +153,13 @@ public:
      */
     static bool isThumbnailWriterEmpty();
 
+    /**
+     * Returns the largest up-to-date cached thumbnail for the local file
+     * @p url, or a null image if there is none. Does not generate anything,
+     * but reads and decodes thumbnail files: call it from a worker thread.
+     */
+    static QImage cachedThumbnail(const QUrl &url);
+
 Q_SIGNALS:
     /**
      * Emitted when the thumbnail for the @p item has been loaded
@@ -134,11 +180,17 @@ private Q_SLOTS:
     void determineNextIcon();
     void slotGotPreview(const KFileItem&, const QPixmap&);
     void checkThumbnail();
+    void generateThumbnail();
+    void slotCacheProbed();
+    void slotRemoteHeadOpened(KIO::Job*);
+    void slotRemoteHeadData(KIO::Job*, const QByteArray&);
+    void slotRemoteHeadResult(KJob*);
+    void slotRemoteHeadDecoded();
     void thumbnailReady(const QImage&, const QSize&);
     void emitThumbnailLoadingFailed();
 
 private:
-    enum { STATE_STATORIG, STATE_DOWNLOADORIG, STATE_PREVIEWJOB, STATE_NEXTTHUMB } mState;
+    enum { STATE_STATORIG, STATE_READORIGHEAD, STATE_DOWNLOADORIG, STATE_PREVIEWJOB, STATE_NEXTTHUMB } mState;
 
     KFileItemList mItems;
     KFileItem mCurrentItem;
@@ -169,6 +221,48 @@ private:
 
     QStringList mPreviewPlugins;
 
+    /**
+     * Stat result and cached thumbnail for an item, filled on a worker thread
+     */
+    struct CacheProbe {
+        KFileItem item;
+        QString localPath;
+        QString originalUri;
+        QString thumbnailPath;
+        ThumbnailGroup::Enum group;
+        KIO::filesize_t originalFileSize;
+        // Filled by probeCache()
+        bool probed;
+        bool statOk;
+        time_t originalTime;
+        QImage thumbnail;
+    };
+    QVector<CacheProbe> mCacheProbes;
+    QFutureWatcher<void>* mCacheProbeWatcher;
+
+    // Modification time of local items whose cached thumbnail has been found
+    // missing or outdated by a probe
+    QHash<QUrl, time_t> mProbedOriginalTimes;
+
+    bool startCacheProbe();
+    static void probeCache(CacheProbe& probe);
+
+    // The first bytes of remote originals, which often contain a preview
+    // large enough to avoid downloading the whole file
+    QHash<QUrl, RemoteHeadBuffer> mRemoteHeads;
+    QHash<KIO::FileJob*, QUrl> mRemoteHeadJobs;
+    QFutureWatcher<ThumbnailContext>* mRemoteHeadWatcher;
+    QUrl mRemoteHeadDecodingUrl;
+
+    bool shouldReadRemoteHead(const KFileItem& item) const;
+    void startReadingRemoteHead(const QUrl& url);
+    void prefetchRemoteHeads();
+    void finishRemoteHead(KIO::FileJob* job);
+    void processRemoteHead();
+    void forgetRemoteHead(const QUrl& url);
+    void clearRemoteHeads();
+    void downloadOriginal();
+
     void createNewThumbnailGenerator();
     void abortSubjob();
     void startCreatingThumbnail(const QString& path);
@@ -176,6 +270,8 @@ private:
     void emitThumbnailLoaded(const QImage& img, const QSize& size);
 
     QImage loadThumbnailFromCache() const;
+    static QImage loadThumbnailFromCache(const QString& thumbnailPath, const QString& originalUri,
+                                         ThumbnailGroup::Enum group, time_t originalTime);
 };
 
 } // namespace
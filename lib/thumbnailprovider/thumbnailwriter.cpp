@@ -22,11 +22,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "thumbnailwriter.h"
 
 // Local
+#include "gwenviewconfig.h"
+#include "memoryregistry.h"
+#include "taskscheduler.h"
+#include "tracer.h"
 
 // Qt
-#include <QImage>
+#include <QCoreApplication>
 #include <QDebug>
 #include <QTemporaryFile>
+#include <QThread>
 
 namespace Gwenview
 {
@@ -40,8 +45,19 @@ namespace Gwenview
 #define LOG(x) ;
 #endif
 
-static void storeThumbnailToDiskCache(const QString& path, const QImage& image)
+// Generator threads are blocked when there are more thumbnails than this
+// waiting to be stored...
+static const int MAX_QUEUED_THUMBNAILS = 256;
+// ... or when the waiting thumbnails use more memory than this
+static const qint64 MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+
+// Encoding is CPU bound but writers also wait for the disk, there is no
+// point in having more than a few of them
+static const int MAX_WRITERS = 4;
+
+static void storeThumbnailToDiskCache(const QString& path, const QImage& image, int quality)
 {
+    GV_TRACE("thumbnail", "store");
     LOG(path);
     QTemporaryFile tmp(path + QStringLiteral(".gwenview.tmpXXXXXX.png"));
     if (!tmp.open()) {
@@ -49,7 +65,7 @@ static void storeThumbnailToDiskCache(const QString& path, const QImage& image)
         return;
     }
 
-    if (!image.save(tmp.fileName(), "png")) {
+    if (!image.save(tmp.fileName(), "png", quality)) {
         qWarning() << "Could not save thumbnail";
         return;
     }
@@ -57,37 +73,121 @@ static void storeThumbnailToDiskCache(const QString& path, const QImage& image)
     QFile::rename(tmp.fileName(), path);
 }
 
+ThumbnailWriter::ThumbnailWriter()
+: mQueuedBytes(0)
+, mSerial(0)
+, mRunningWriters(0)
+{
+    // Qt PNG writer turns quality into a zlib level with (100 - quality) * 9 / 91,
+    // do the reverse
+    const int level = qBound(0, GwenviewConfig::thumbnailCompressionLevel(), 9);
+    mCompressionQuality = 100 - (level * 91 + 8) / 9;
+
+    mMaxWriters = qBound(1, QThread::idealThreadCount() / 2, MAX_WRITERS);
+
+    // Make sure the scheduler outlives us: we wait for our writers when
+    // destroyed
+    TaskScheduler::instance();
+
+    // Queued thumbnails cannot be dropped, so there is nothing to do on
+    // memory pressure
+    MemoryRegistry::instance()->addCache(QStringLiteral("Thumbnails waiting to be written"), [this](MemoryRegistry::CacheUsage* usage) {
+        QMutexLocker locker(&mMutex);
+        usage->bytes = mQueuedBytes;
+        usage->entries = mCache.count();
+    }, this);
+}
+
+ThumbnailWriter::~ThumbnailWriter()
+{
+    wait();
+}
+
+bool ThumbnailWriter::isFull() const
+{
+    return mQueue.count() >= MAX_QUEUED_THUMBNAILS || mQueuedBytes >= MAX_QUEUED_BYTES;
+}
+
 void ThumbnailWriter::queueThumbnail(const QString& path, const QImage& image)
 {
     LOG(path);
     QMutexLocker locker(&mMutex);
-    mCache.insert(path, image);
-    start();
+    if (QThread::currentThread() != thread()) {
+        // Called from a generator thread: slow it down until writers catch up
+        while (isFull()) {
+            mRoomAvailable.wait(&mMutex);
+        }
+    }
+    enqueue(path, image);
+}
+
+bool ThumbnailWriter::queueThumbnailIfRoom(const QString& path, const QImage& image)
+{
+    LOG(path);
+    QMutexLocker locker(&mMutex);
+    if (isFull()) {
+        LOG("Queue is full, dropping" << path);
+        return false;
+    }
+    enqueue(path, image);
+    return true;
+}
+
+void ThumbnailWriter::enqueue(const QString& path, const QImage& image)
+{
+    Cache::Iterator it = mCache.find(path);
+    if (it == mCache.end()) {
+        it = mCache.insert(path, Entry());
+        mQueue.enqueue(path);
+    } else {
+        // Either still queued, or being stored by a writer, which will
+        // queue it again when done
+        mQueuedBytes -= it->image.byteCount();
+    }
+    it->image = image;
+    it->serial = ++mSerial;
+    mQueuedBytes += image.byteCount();
+
+    if (mRunningWriters < mMaxWriters) {
+        ++mRunningWriters;
+        TaskScheduler::instance()->run(TaskScheduler::BackgroundClass, [this]() {
+            writeQueuedThumbnails();
+        });
+    }
 }
 
-void ThumbnailWriter::run()
+void ThumbnailWriter::writeQueuedThumbnails()
 {
     QMutexLocker locker(&mMutex);
-    while (!mCache.isEmpty()) {
-        Cache::ConstIterator it = mCache.constBegin();
-        const QString path = it.key();
-        const QImage image = it.value();
+    while (!mQueue.isEmpty()) {
+        const QString path = mQueue.dequeue();
+        const Entry entry = mCache.value(path);
 
         // This part of the thread is the most time consuming but it does not
         // depend on mCache so we can unlock here. This way other thumbnails
         // can be added or queried
         locker.unlock();
-        storeThumbnailToDiskCache(path, image);
+        storeThumbnailToDiskCache(path, entry.image, mCompressionQuality);
         locker.relock();
 
-        mCache.remove(path);
+        Cache::Iterator it = mCache.find(path);
+        if (it->serial == entry.serial) {
+            mQueuedBytes -= it->image.byteCount();
+            mCache.erase(it);
+        } else {
+            // Queued again while we were storing it
+            mQueue.enqueue(path);
+        }
+        mRoomAvailable.wakeAll();
     }
+    --mRunningWriters;
+    mWritersDone.wakeAll();
 }
 
 QImage ThumbnailWriter::value(const QString& path) const
 {
     QMutexLocker locker(&mMutex);
-    return mCache.value(path);
+    return mCache.value(path).image;
 }
 
 bool ThumbnailWriter::isEmpty() const
@@ -96,4 +196,18 @@ bool ThumbnailWriter::isEmpty() const
     return mCache.isEmpty();
 }
 
+qint64 ThumbnailWriter::queuedBytes() const
+{
+    QMutexLocker locker(&mMutex);
+    return mQueuedBytes;
+}
+
+void ThumbnailWriter::wait()
+{
+    QMutexLocker locker(&mMutex);
+    while (mRunningWriters > 0) {
+        mWritersDone.wait(&mMutex);
+    }
+}
+
 } // namespace
@@ -27,36 +27,78 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Qt
 #include <QHash>
+#include <QImage>
 #include <QMutex>
-#include <QThread>
-
-class QImage;
+#include <QObject>
+#include <QQueue>
+#include <QWaitCondition>
 
 namespace Gwenview
 {
 
 /**
- * Store thumbnails to disk when done generating them
+ * Store thumbnails to disk when done generating them.
+ *
+ * Thumbnails are encoded by a few background tasks of the TaskScheduler. The queue is bounded:
+ * queueThumbnail() blocks the calling thread while it is full, unless it is
+ * called from the thread the writer belongs to. TaskScheduler tasks must use
+ * queueThumbnailIfRoom() instead: by blocking, they would hold the threads
+ * the writers need.
  */
-class ThumbnailWriter : public QThread
+class ThumbnailWriter : public QObject
 {
     Q_OBJECT
 public:
+    ThumbnailWriter();
+    ~ThumbnailWriter() override;
+
     // Return thumbnail if it has still not been stored
     QImage value(const QString&) const;
 
     bool isEmpty() const;
 
+    /**
+     * Amount of memory used by the thumbnails which have not been stored yet
+     */
+    qint64 queuedBytes() const;
+
+    /**
+     * Blocks until all queued thumbnails have been stored
+     */
+    void wait();
+
+    /**
+     * Queues the thumbnail if the queue is not full. Never blocks. Returns
+     * false if the thumbnail has been dropped.
+     */
+    bool queueThumbnailIfRoom(const QString&, const QImage&);
+
 public Q_SLOTS:
     void queueThumbnail(const QString&, const QImage&);
 
-protected:
-    void run() override;
-
 private:
-    typedef QHash<QString, QImage> Cache;
+    struct Entry {
+        QImage image;
+        // Changes each time the path is queued, so that a writer can tell
+        // whether the path has been queued again while it was storing it
+        int serial;
+    };
+    typedef QHash<QString, Entry> Cache;
     Cache mCache;
+    QQueue<QString> mQueue;
+    qint64 mQueuedBytes;
+    int mSerial;
+    int mRunningWriters;
+    int mMaxWriters;
+    int mCompressionQuality;
     mutable QMutex mMutex;
+    QWaitCondition mRoomAvailable;
+    QWaitCondition mWritersDone;
+
+    bool isFull() const;
+    // Must be called with mMutex locked
+    void enqueue(const QString&, const QImage&);
+    void writeQueuedThumbnails();
 };
 
 } // namespace
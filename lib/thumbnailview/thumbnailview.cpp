@@ -20,18 +20,22 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "thumbnailview.h"
 
 // Std
+#include <algorithm>
+#include <list>
 #include <math.h>
 
 // Qt
 #include <QApplication>
 #include <QDragEnterEvent>
 #include <QDropEvent>
+#include <QFutureWatcher>
 #include <QPainter>
 #include <QPointer>
 #include <QQueue>
 #include <QScrollBar>
 #include <QTimeLine>
 #include <QTimer>
+#include <QVector>
 #include <QDrag>
 #include <QMimeData>
 #include <QDebug>
@@ -51,7 +55,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "mimetypeutils.h"
 #include "urlutils.h"
 #include <lib/gvdebug.h>
+#include <lib/gwenviewconfig.h>
+#include <lib/memoryregistry.h>
+#include <lib/taskscheduler.h>
 #include <lib/thumbnailprovider/thumbnailprovider.h>
+#include <lib/tracer.h>
 
 namespace Gwenview
 {
@@ -65,8 +73,15 @@ namespace Gwenview
 #define LOG(x) ;
 #endif
 
-/** How many msec to wait before starting to smooth thumbnails */
-const int SMOOTH_DELAY = 500;
+/** How many msec to wait before starting to smooth thumbnails, to group the
+ * thumbnails of a repaint in the same batch */
+const int SMOOTH_DELAY = 20;
+
+/** How many thumbnails are smoothed in parallel before being committed */
+const int SMOOTH_BATCH_SIZE = 32;
+
+/** How many msec to wait before checking the memory used by thumbnails */
+const int CACHE_TRIM_DELAY = 1000;
 
 const int WHEEL_ZOOM_MULTIPLIER = 4;
 
@@ -86,6 +101,46 @@ static QUrl urlForIndex(const QModelIndex& index)
     return item.isNull() ? QUrl() : item.url();
 }
 
+// Works with QPixmap on the GUI thread and with QImage in smoothing threads
+template <class T>
+static T scaleThumbnail(const T& pix, const QSize& size, ThumbnailView::ThumbnailScaleMode scaleMode, Qt::TransformationMode transformationMode)
+{
+    switch (scaleMode) {
+    case ThumbnailView::ScaleToFit:
+        return pix.scaled(size.width(), size.height(), Qt::KeepAspectRatio, transformationMode);
+    case ThumbnailView::ScaleToSquare: {
+        int minSize = qMin(pix.width(), pix.height());
+        T pix2 = pix.copy((pix.width() - minSize) / 2, (pix.height() - minSize) / 2, minSize, minSize);
+        return pix2.scaled(size.width(), size.height(), Qt::KeepAspectRatio, transformationMode);
+    }
+    case ThumbnailView::ScaleToHeight:
+        return pix.scaledToHeight(size.height(), transformationMode);
+    case ThumbnailView::ScaleToWidth:
+        return pix.scaledToWidth(size.width(), transformationMode);
+    }
+    // Keep compiler happy
+    Q_ASSERT(0);
+    return T();
+}
+
+/**
+ * A thumbnail being smoothed in a worker thread
+ */
+struct SmoothJob
+{
+    QUrl mUrl;
+    qint64 mGroupPixKey;
+    QImage mImage;
+    QSize mSize;
+    ThumbnailView::ThumbnailScaleMode mScaleMode;
+};
+
+static void smoothThumbnail(SmoothJob& job)
+{
+    GV_TRACE("thumbnail", "smooth");
+    job.mImage = scaleThumbnail(job.mImage, job.mSize, job.mScaleMode, Qt::SmoothTransformation);
+}
+
 struct Thumbnail
 {
     Thumbnail(const QPersistentModelIndex& index_, const QDateTime& mtime)
@@ -93,12 +148,14 @@ struct Thumbnail
         , mModificationTime(mtime)
         , mFileSize(0)
         , mRough(true)
-        , mWaitingForThumbnail(true) {}
+        , mWaitingForThumbnail(true)
+        , mEvicted(false) {}
 
     Thumbnail()
         : mFileSize(0)
         , mRough(true)
-        , mWaitingForThumbnail(true) {}
+        , mWaitingForThumbnail(true)
+        , mEvicted(false) {}
 
     /**
      * Init the thumbnail based on a icon
@@ -138,6 +195,31 @@ struct Thumbnail
         mRealFullSize = QSize();
         mRough = true;
         mWaitingForThumbnail = true;
+        mEvicted = false;
+    }
+
+    /**
+     * Drop pixmaps to free memory. They will be reloaded from the thumbnail
+     * disk cache when the item becomes visible again.
+     */
+    void evict()
+    {
+        mGroupPix = QPixmap();
+        mAdjustedPix = QPixmap();
+        mRough = true;
+        mWaitingForThumbnail = true;
+        mEvicted = true;
+    }
+
+    /// Memory used by the pixmaps, in bytes
+    qint64 cost() const
+    {
+        return pixmapCost(mGroupPix) + pixmapCost(mAdjustedPix);
+    }
+
+    static qint64 pixmapCost(const QPixmap& pix)
+    {
+        return qint64(pix.width()) * pix.height() * pix.depth() / 8;
     }
 
     QPersistentModelIndex mIndex;
@@ -158,9 +240,13 @@ struct Thumbnail
     bool mRough;
     /// Set to true if mGroupPix should be replaced with a real thumbnail
     bool mWaitingForThumbnail;
+    /// Set to true if pixmaps have been dropped to free memory
+    bool mEvicted;
 };
 
 typedef QHash<QUrl, Thumbnail> ThumbnailForUrl;
+// Least recently used first
+typedef std::list<QUrl> ThumbnailLruList;
 typedef QQueue<QUrl> UrlQueue;
 typedef QSet<QPersistentModelIndex> PersistentModelIndexSet;
 
@@ -177,6 +263,21 @@ struct ThumbnailViewPrivate
 
     UrlQueue mSmoothThumbnailQueue;
     QTimer mSmoothThumbnailTimer;
+    QVector<SmoothJob> mSmoothJobs;
+    QFutureWatcher<void> mSmoothWatcher;
+    // Incremented when the thumbnail size changes, to drop obsolete smoothing results
+    int mSmoothGeneration;
+    int mSmoothJobsGeneration;
+
+    // Thumbnails which may hold pixmaps. Entries for urls which are not in
+    // mThumbnailForUrl anymore are removed when trimming.
+    ThumbnailLruList mLruList;
+    QHash<QUrl, ThumbnailLruList::iterator> mLruPositions;
+    QTimer mCacheTrimTimer;
+    // Painted thumbnails which had a pixmap, and evicted thumbnails which
+    // had to be loaded again
+    qint64 mCacheHits;
+    qint64 mCacheMisses;
 
     QPixmap mWaitingThumbnail;
     QPointer<ThumbnailProvider> mThumbnailProvider;
@@ -255,24 +356,166 @@ struct ThumbnailViewPrivate
         drag->setHotSpot(dragPixmap.hotSpot);
     }
 
+    void scheduleSmoothing()
+    {
+        if (!mSmoothThumbnailTimer.isActive() && !mSmoothWatcher.isRunning()) {
+            mSmoothThumbnailTimer.start(SMOOTH_DELAY);
+        }
+    }
+
+    /**
+     * Starts smoothing the next batch of thumbnails, visible ones first
+     */
+    void startSmoothing()
+    {
+        if (mSmoothWatcher.isRunning()) {
+            return;
+        }
+        Q_ASSERT(mSmoothJobs.isEmpty());
+        const QRect viewportRect = q->viewport()->rect();
+        UrlQueue visibleQueue, hiddenQueue;
+        for (const QUrl& url : qAsConst(mSmoothThumbnailQueue)) {
+            ThumbnailForUrl::ConstIterator it = mThumbnailForUrl.constFind(url);
+            if (it == mThumbnailForUrl.constEnd() || !it.value().mRough || it.value().mGroupPix.isNull()) {
+                continue;
+            }
+            if (q->visualRect(it.value().mIndex).intersects(viewportRect)) {
+                visibleQueue.enqueue(url);
+            } else {
+                hiddenQueue.enqueue(url);
+            }
+        }
+        mSmoothThumbnailQueue = visibleQueue;
+        mSmoothThumbnailQueue.append(hiddenQueue);
+
+        while (!mSmoothThumbnailQueue.isEmpty() && mSmoothJobs.count() < SMOOTH_BATCH_SIZE) {
+            const QUrl url = mSmoothThumbnailQueue.dequeue();
+            const Thumbnail& thumbnail = mThumbnailForUrl[url];
+            SmoothJob job;
+            job.mUrl = url;
+            job.mGroupPixKey = thumbnail.mGroupPix.cacheKey();
+            job.mImage = thumbnail.mGroupPix.toImage();
+            job.mSize = mThumbnailSize;
+            job.mScaleMode = mScaleMode;
+            mSmoothJobs << job;
+        }
+        if (mSmoothJobs.isEmpty()) {
+            return;
+        }
+        mSmoothJobsGeneration = mSmoothGeneration;
+        mSmoothWatcher.setFuture(TaskScheduler::instance()->map(TaskScheduler::ThumbnailClass, mSmoothJobs, smoothThumbnail));
+    }
+
+    /**
+     * Replaces the rough thumbnails with the smoothed ones in one go
+     */
+    void commitSmoothedThumbnails()
+    {
+        if (mSmoothJobsGeneration == mSmoothGeneration) {
+            for (const SmoothJob& job : qAsConst(mSmoothJobs)) {
+                ThumbnailForUrl::Iterator it = mThumbnailForUrl.find(job.mUrl);
+                // The thumbnail may have been removed, evicted or replaced meanwhile
+                if (it == mThumbnailForUrl.end() || it.value().mGroupPix.cacheKey() != job.mGroupPixKey) {
+                    continue;
+                }
+                Thumbnail& thumbnail = it.value();
+                thumbnail.mAdjustedPix = QPixmap::fromImage(job.mImage);
+                thumbnail.mRough = false;
+            }
+            q->viewport()->update();
+        }
+        mSmoothJobs.clear();
+        if (!mSmoothThumbnailQueue.isEmpty()) {
+            startSmoothing();
+        }
+    }
+
+    void scheduleCacheTrim()
+    {
+        if (!mCacheTrimTimer.isActive()) {
+            mCacheTrimTimer.start();
+        }
+    }
+
+    qint64 cacheBudget() const
+    {
+        return qint64(GwenviewConfig::thumbnailMemoryCacheSize()) * 1024 * 1024;
+    }
+
+    /**
+     * Moves url to the most recently used end of mLruList, or to the least
+     * recently used end if it is not painted
+     */
+    void touchThumbnail(const QUrl& url, bool painted)
+    {
+        auto it = mLruPositions.find(url);
+        if (it != mLruPositions.end()) {
+            if (painted) {
+                mLruList.splice(mLruList.end(), mLruList, it.value());
+            }
+            return;
+        }
+        mLruPositions.insert(url, mLruList.insert(painted ? mLruList.end() : mLruList.begin(), url));
+    }
+
+    void forgetThumbnail(const QUrl& url)
+    {
+        auto it = mLruPositions.find(url);
+        if (it != mLruPositions.end()) {
+            mLruList.erase(it.value());
+            mLruPositions.erase(it);
+        }
+    }
+
+    bool isVisible(const Thumbnail& thumbnail) const
+    {
+        return thumbnail.mIndex.isValid() && q->viewport()->rect().intersects(q->visualRect(thumbnail.mIndex));
+    }
+
+    /**
+     * Drop the pixmaps of the least recently painted thumbnails until we are
+     * below budget. Visible thumbnails are kept even if that means staying
+     * above budget: they would be loaded again right away.
+     */
+    void trimCache(qint64 budget)
+    {
+        qint64 total = 0;
+        for (const Thumbnail& thumbnail : qAsConst(mThumbnailForUrl)) {
+            total += thumbnail.cost();
+        }
+        LOG("Thumbnail cache:" << total / 1024 << "KB, hits:" << mCacheHits << "misses:" << mCacheMisses);
+        if (total <= budget) {
+            return;
+        }
+
+        // Go a bit below the budget so that we do not have to trim again as
+        // soon as a new thumbnail arrives
+        const qint64 target = budget * 3 / 4;
+        for (auto lruIt = mLruList.begin(); lruIt != mLruList.end() && total > target;) {
+            const QUrl url = *lruIt;
+            ThumbnailForUrl::Iterator it = mThumbnailForUrl.find(url);
+            if (it == mThumbnailForUrl.end() || it.value().cost() == 0) {
+                mLruPositions.remove(url);
+                lruIt = mLruList.erase(lruIt);
+                continue;
+            }
+            Thumbnail& thumbnail = it.value();
+            if (isVisible(thumbnail)) {
+                ++lruIt;
+                continue;
+            }
+            total -= thumbnail.cost();
+            thumbnail.evict();
+            mSmoothThumbnailQueue.removeAll(url);
+            mLruPositions.remove(url);
+            lruIt = mLruList.erase(lruIt);
+        }
+        LOG("Trimmed thumbnail cache to" << total / 1024 << "KB");
+    }
+
     QPixmap scale(const QPixmap& pix, Qt::TransformationMode transformationMode)
     {
-        switch (mScaleMode) {
-        case ThumbnailView::ScaleToFit:
-            return pix.scaled(mThumbnailSize.width(), mThumbnailSize.height(), Qt::KeepAspectRatio, transformationMode);
-        case ThumbnailView::ScaleToSquare: {
-            int minSize = qMin(pix.width(), pix.height());
-            QPixmap pix2 = pix.copy((pix.width() - minSize) / 2, (pix.height() - minSize) / 2, minSize, minSize);
-            return pix2.scaled(mThumbnailSize.width(), mThumbnailSize.height(), Qt::KeepAspectRatio, transformationMode);
-        }
-        case ThumbnailView::ScaleToHeight:
-            return pix.scaledToHeight(mThumbnailSize.height(), transformationMode);
-        case ThumbnailView::ScaleToWidth:
-            return pix.scaledToWidth(mThumbnailSize.width(), transformationMode);
-        }
-        // Keep compiler happy
-        Q_ASSERT(0);
-        return QPixmap();
+        return scaleThumbnail(pix, mThumbnailSize, mScaleMode, transformationMode);
     }
 };
 
@@ -311,7 +554,34 @@ ThumbnailView::ThumbnailView(QWidget* parent)
     connect(&d->mScheduledThumbnailGenerationTimer, &QTimer::timeout, this, &ThumbnailView::generateThumbnailsForItems);
 
     d->mSmoothThumbnailTimer.setSingleShot(true);
-    connect(&d->mSmoothThumbnailTimer, &QTimer::timeout, this, &ThumbnailView::smoothNextThumbnail);
+    connect(&d->mSmoothThumbnailTimer, &QTimer::timeout, this, &ThumbnailView::smoothNextThumbnails);
+    d->mSmoothGeneration = 0;
+    d->mSmoothJobsGeneration = 0;
+    connect(&d->mSmoothWatcher, &QFutureWatcherBase::finished, this, [this]() {
+        d->commitSmoothedThumbnails();
+    });
+
+    d->mCacheHits = 0;
+    d->mCacheMisses = 0;
+    d->mCacheTrimTimer.setSingleShot(true);
+    d->mCacheTrimTimer.setInterval(CACHE_TRIM_DELAY);
+    connect(&d->mCacheTrimTimer, &QTimer::timeout, this, [this]() {
+        d->trimCache(d->cacheBudget());
+    });
+
+    MemoryRegistry* registry = MemoryRegistry::instance();
+    registry->addCache(QStringLiteral("Thumbnail view pixmaps"), [this](MemoryRegistry::CacheUsage* usage) {
+        for (const Thumbnail& thumbnail : qAsConst(d->mThumbnailForUrl)) {
+            usage->bytes += thumbnail.cost();
+        }
+        usage->entries = d->mThumbnailForUrl.count();
+        usage->hits = d->mCacheHits;
+        usage->misses = d->mCacheMisses;
+    }, this);
+    connect(registry, &MemoryRegistry::memoryPressure, this, [this]() {
+        // Evicted thumbnails are reloaded from the disk cache when painted
+        d->trimCache(d->cacheBudget() / 4);
+    });
 
     setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, &ThumbnailView::customContextMenuRequested, this, &ThumbnailView::showContextMenu);
@@ -321,6 +591,8 @@ ThumbnailView::ThumbnailView(QWidget* parent)
 
 ThumbnailView::~ThumbnailView()
 {
+    // Smoothing threads work on d->mSmoothJobs
+    d->mSmoothWatcher.waitForFinished();
     delete d;
 }
 
@@ -332,6 +604,7 @@ ThumbnailView::ThumbnailScaleMode ThumbnailView::thumbnailScaleMode() const
 void ThumbnailView::setThumbnailScaleMode(ThumbnailScaleMode mode)
 {
     d->mScaleMode = mode;
+    ++d->mSmoothGeneration;
     setUniformItemSizes(mode == ScaleToFit || mode == ScaleToSquare);
 }
 
@@ -381,6 +654,7 @@ void ThumbnailView::updateThumbnailSize()
     // Stop smoothing
     d->mSmoothThumbnailTimer.stop();
     d->mSmoothThumbnailQueue.clear();
+    ++d->mSmoothGeneration;
 
     // Clear adjustedPixes
     ThumbnailForUrl::iterator
@@ -472,6 +746,7 @@ void ThumbnailView::rowsAboutToBeRemoved(const QModelIndex& parent, int start, i
 
         QUrl url = item.url();
         d->mThumbnailForUrl.remove(url);
+        d->forgetThumbnail(url);
         d->mSmoothThumbnailQueue.removeAll(url);
 
         itemList.append(item);
@@ -554,7 +829,10 @@ void ThumbnailView::setThumbnail(const KFileItem& item, const QPixmap& pixmap, c
     thumbnail.mFullSize = size.isValid() ? size : QSize(largeGroupSize, largeGroupSize);
     thumbnail.mRealFullSize = size;
     thumbnail.mWaitingForThumbnail = false;
+    thumbnail.mEvicted = false;
     thumbnail.mFileSize = fileSize;
+    d->touchThumbnail(item.url(), false);
+    d->scheduleCacheTrim();
 
     update(thumbnail.mIndex);
     if (d->mScaleMode != ScaleToFit) {
@@ -607,6 +885,7 @@ QPixmap ThumbnailView::thumbnailForIndex(const QModelIndex& index, QSize* fullSi
         it = d->mThumbnailForUrl.insert(url, thumbnail);
     }
     Thumbnail& thumbnail = it.value();
+    d->touchThumbnail(url, true);
 
     // If dir or archive, generate a thumbnail from fileitem pixmap
     MimeTypeUtils::Kind kind = MimeTypeUtils::fileItemKind(item);
@@ -635,21 +914,24 @@ QPixmap ThumbnailView::thumbnailForIndex(const QModelIndex& index, QSize* fullSi
     }
 
     if (thumbnail.mGroupPix.isNull()) {
+        if (thumbnail.mEvicted) {
+            ++d->mCacheMisses;
+        }
         if (fullSize) {
             *fullSize = QSize();
         }
         return d->mWaitingThumbnail;
     }
+    ++d->mCacheHits;
 
     // Adjust thumbnail
     if (thumbnail.mAdjustedPix.isNull()) {
         d->roughAdjustThumbnail(&thumbnail);
+        d->scheduleCacheTrim();
     }
     if (thumbnail.mRough && !d->mSmoothThumbnailQueue.contains(url)) {
         d->mSmoothThumbnailQueue.enqueue(url);
-        if (!d->mSmoothThumbnailTimer.isActive()) {
-            d->mSmoothThumbnailTimer.start(SMOOTH_DELAY);
-        }
+        d->scheduleSmoothing();
     }
     if (fullSize) {
         *fullSize = thumbnail.mRealFullSize;
@@ -850,6 +1132,12 @@ void ThumbnailView::generateThumbnailsForItems()
                 distance = distance + visibleSurface;
             }
         } else {
+            if (it != d->mThumbnailForUrl.constEnd() && it.value().mEvicted) {
+                // Thumbnail has been dropped to free memory, only reload it
+                // once it becomes visible, otherwise we would keep reloading
+                // and dropping thumbnails
+                continue;
+            }
             // Item is not visible, order thumbnails according to distance
             // Start at 2 * visibleSurface to ensure invisible thumbnails are
             // generated *after* visible thumbnails
@@ -921,32 +1209,9 @@ QPixmap ThumbnailView::busySequenceCurrentPixmap() const
     return d->mBusySequence.frameAt(d->mBusyAnimationTimeLine->currentFrame());
 }
 
-void ThumbnailView::smoothNextThumbnail()
+void ThumbnailView::smoothNextThumbnails()
 {
-    if (d->mSmoothThumbnailQueue.isEmpty()) {
-        return;
-    }
-
-    if (d->mThumbnailProvider && d->mThumbnailProvider->isRunning()) {
-        // give mThumbnailProvider priority over smoothing
-        d->mSmoothThumbnailTimer.start(SMOOTH_DELAY);
-        return;
-    }
-
-    QUrl url = d->mSmoothThumbnailQueue.dequeue();
-    ThumbnailForUrl::Iterator it = d->mThumbnailForUrl.find(url);
-    GV_RETURN_IF_FAIL2(it != d->mThumbnailForUrl.end(), url << "not in mThumbnailForUrl.");
-
-    Thumbnail& thumbnail = it.value();
-    thumbnail.mAdjustedPix = d->scale(thumbnail.mGroupPix, Qt::SmoothTransformation);
-    thumbnail.mRough = false;
-
-    GV_RETURN_IF_FAIL2(thumbnail.mIndex.isValid(), "index for" << url << "is invalid.");
-    update(thumbnail.mIndex);
-
-    if (!d->mSmoothThumbnailQueue.isEmpty()) {
-        d->mSmoothThumbnailTimer.start(0);
-    }
+    d->startSmoothing();
 }
 
 void ThumbnailView::reloadThumbnail(const QModelIndex& index)
@@ -962,6 +1227,7 @@ void ThumbnailView::reloadThumbnail(const QModelIndex& index)
         return;
     }
     d->mThumbnailForUrl.erase(it);
+    d->forgetThumbnail(url);
     generateThumbnailsForItems();
 }
 
@@ -204,7 +204,7 @@ private Q_SLOTS:
      */
     void updateBusyIndexes();
 
-    void smoothNextThumbnail();
+    void smoothNextThumbnails();
 
 private:
     friend struct ThumbnailViewPrivate;
@@ -35,6 +35,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 
 // Local
 #include <lib/exiv2imageloader.h>
+#include <lib/memoryregistry.h>
 #include <lib/urlutils.h>
 
 namespace Gwenview
@@ -125,6 +126,25 @@ struct CacheItem
 
 typedef QHash<QUrl, CacheItem> Cache;
 
+static Cache& dateTimeCache()
+{
+    static Cache cache;
+    static bool registered = false;
+    if (!registered) {
+        registered = true;
+        MemoryRegistry* registry = MemoryRegistry::instance();
+        registry->addCache(QStringLiteral("File dates"), [](MemoryRegistry::CacheUsage* usage) {
+            // Estimate: QDateTime and QUrl have private data on the heap
+            usage->bytes = qint64(cache.count()) * (sizeof(QUrl) + sizeof(CacheItem) + 3 * 64);
+            usage->entries = cache.count();
+        });
+        QObject::connect(registry, &MemoryRegistry::memoryPressure, registry, []() {
+            cache.clear();
+        });
+    }
+    return cache;
+}
+
 QDateTime dateTimeForFileItem(const KFileItem& fileItem, CachePolicy cachePolicy)
 {
     if (cachePolicy == SkipCache) {
@@ -133,7 +153,7 @@ QDateTime dateTimeForFileItem(const KFileItem& fileItem, CachePolicy cachePolicy
         return item.realTime;
     }
 
-    static Cache cache;
+    Cache& cache = dateTimeCache();
     const QUrl url = fileItem.targetUrl();
 
     Cache::iterator it = cache.find(url);
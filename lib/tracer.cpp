@@ -0,0 +1,197 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "tracer.h"
+
+// Qt
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+namespace Gwenview
+{
+
+// Keeps a forgotten trace from eating all the memory
+static const int MAX_EVENT_COUNT = 1000000;
+
+// Duration of instant events
+static const qint64 INSTANT_DURATION = -1;
+
+struct TraceEvent
+{
+    const char* mCategory;
+    const char* mName;
+    qint64 mStart;
+    qint64 mDuration;
+    int mThreadId;
+    QString mDetail;
+};
+
+struct TracerState
+{
+    QMutex mMutex;
+    QElapsedTimer mTimer;
+    QString mFileName;
+    QVector<TraceEvent> mEvents;
+    QHash<int, QString> mThreadNames;
+    int mDroppedEventCount = 0;
+};
+
+Q_GLOBAL_STATIC(TracerState, sState)
+
+QBasicAtomicInt Tracer::sEnabled = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+static QString currentThreadName()
+{
+    QThread* thread = QThread::currentThread();
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+        return QStringLiteral("Main");
+    }
+    if (!thread->objectName().isEmpty()) {
+        return thread->objectName();
+    }
+    return QString::fromLatin1(thread->metaObject()->className());
+}
+
+// Must be called with the mutex of the state locked
+static int currentThreadId(TracerState* state)
+{
+    static QAtomicInt sNextId;
+    static thread_local int sId = 0;
+    if (sId == 0) {
+        sId = sNextId.fetchAndAddRelaxed(1) + 1;
+        state->mThreadNames.insert(sId, currentThreadName());
+    }
+    return sId;
+}
+
+void Tracer::start(const QString& fileName)
+{
+    TracerState* state = sState;
+    QMutexLocker locker(&state->mMutex);
+    state->mFileName = fileName;
+    state->mEvents.clear();
+    state->mDroppedEventCount = 0;
+    state->mTimer.start();
+    sEnabled.store(1);
+}
+
+void Tracer::startFromEnvironment()
+{
+    const QString fileName = QString::fromLocal8Bit(qgetenv("GV_TRACE_FILE"));
+    if (!fileName.isEmpty()) {
+        start(fileName);
+    }
+}
+
+bool Tracer::stop()
+{
+    if (!sEnabled.load()) {
+        return true;
+    }
+    sEnabled.store(0);
+
+    TracerState* state = sState;
+    QMutexLocker locker(&state->mMutex);
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    QJsonArray events;
+    for (auto it = state->mThreadNames.constBegin(), end = state->mThreadNames.constEnd(); it != end; ++it) {
+        events.append(QJsonObject {
+            {QStringLiteral("name"), QStringLiteral("thread_name")},
+            {QStringLiteral("ph"), QStringLiteral("M")},
+            {QStringLiteral("pid"), pid},
+            {QStringLiteral("tid"), it.key()},
+            {QStringLiteral("args"), QJsonObject {{QStringLiteral("name"), it.value()}}}
+        });
+    }
+    for (const TraceEvent& event : qAsConst(state->mEvents)) {
+        QJsonObject object {
+            {QStringLiteral("name"), QString::fromLatin1(event.mName)},
+            {QStringLiteral("cat"), QString::fromLatin1(event.mCategory)},
+            {QStringLiteral("ts"), event.mStart},
+            {QStringLiteral("pid"), pid},
+            {QStringLiteral("tid"), event.mThreadId}
+        };
+        if (event.mDuration == INSTANT_DURATION) {
+            object.insert(QStringLiteral("ph"), QStringLiteral("i"));
+            // Only mark the thread of the event, not the whole process
+            object.insert(QStringLiteral("s"), QStringLiteral("t"));
+        } else {
+            object.insert(QStringLiteral("ph"), QStringLiteral("X"));
+            object.insert(QStringLiteral("dur"), event.mDuration);
+        }
+        if (!event.mDetail.isEmpty()) {
+            object.insert(QStringLiteral("args"), QJsonObject {{QStringLiteral("detail"), event.mDetail}});
+        }
+        events.append(object);
+    }
+    if (state->mDroppedEventCount > 0) {
+        qWarning() << "Trace is full," << state->mDroppedEventCount << "events have been dropped";
+    }
+    state->mEvents.clear();
+
+    QFile file(state->mFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write trace to" << state->mFileName << ":" << file.errorString();
+        return false;
+    }
+    const QJsonObject root {
+        {QStringLiteral("traceEvents"), events},
+        {QStringLiteral("displayTimeUnit"), QStringLiteral("ms")}
+    };
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+qint64 Tracer::now()
+{
+    return sState->mTimer.nsecsElapsed() / 1000;
+}
+
+void Tracer::addSpan(const char* category, const char* name, qint64 start, qint64 duration, const QString& detail)
+{
+    TracerState* state = sState;
+    QMutexLocker locker(&state->mMutex);
+    if (!sEnabled.load()) {
+        return;
+    }
+    if (state->mEvents.size() >= MAX_EVENT_COUNT) {
+        ++state->mDroppedEventCount;
+        return;
+    }
+    state->mEvents.append({category, name, start, duration, currentThreadId(state), detail});
+}
+
+void Tracer::addEvent(const char* category, const char* name, const QString& detail)
+{
+    addSpan(category, name, now(), INSTANT_DURATION, detail);
+}
+
+} // namespace
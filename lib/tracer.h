@@ -0,0 +1,145 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <lib/gwenviewlib_export.h>
+
+// Qt
+#include <QAtomicInt>
+#include <QString>
+
+namespace Gwenview
+{
+
+/**
+ * Records how long the stages of loading, scaling, thumbnailing and saving
+ * take, and writes them in the Chrome trace event format. The result can be
+ * opened in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Recording is started by the --trace command line option or the
+ * GV_TRACE_FILE environment variable. When it is not started, a span costs a
+ * single atomic read.
+ */
+class GWENVIEWLIB_EXPORT Tracer
+{
+public:
+    /**
+     * Starts recording. The trace is written to @p fileName by stop().
+     */
+    static void start(const QString& fileName);
+
+    /**
+     * Starts recording if the GV_TRACE_FILE environment variable is set
+     */
+    static void startFromEnvironment();
+
+    /**
+     * Stops recording and writes the trace. Returns false if it could not be
+     * written.
+     */
+    static bool stop();
+
+    static bool isEnabled()
+    {
+        return sEnabled.load();
+    }
+
+    /**
+     * Microseconds since recording started
+     */
+    static qint64 now();
+
+    /**
+     * @p category and @p name must be string literals: they are stored as is
+     */
+    static void addSpan(const char* category, const char* name, qint64 start, qint64 duration, const QString& detail);
+
+    /**
+     * Records something which happened at a single point in time, like a
+     * cache running out of memory. Prefer GV_TRACE_EVENT(), which does not
+     * build @p detail when recording is not started.
+     */
+    static void addEvent(const char* category, const char* name, const QString& detail);
+
+private:
+    static QBasicAtomicInt sEnabled;
+};
+
+/**
+ * Records the time spent between its creation and its destruction
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const char* name)
+    : mCategory(category)
+    , mName(name)
+    , mStart(Tracer::isEnabled() ? Tracer::now() : -1)
+    {}
+
+    ~TraceSpan()
+    {
+        if (mStart >= 0) {
+            Tracer::addSpan(mCategory, mName, mStart, Tracer::now() - mStart, mDetail);
+        }
+    }
+
+    /**
+     * Sets a text shown with the span, for example the url being loaded
+     */
+    void setDetail(const QString& detail)
+    {
+        if (mStart >= 0) {
+            mDetail = detail;
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+    const char* const mCategory;
+    const char* const mName;
+    const qint64 mStart;
+    QString mDetail;
+};
+
+} // namespace
+
+#define GV_TRACE_SPAN_NAME2(line) gvTraceSpan##line
+#define GV_TRACE_SPAN_NAME(line) GV_TRACE_SPAN_NAME2(line)
+
+/**
+ * Records the time spent until the end of the current scope
+ */
+#define GV_TRACE(category, name) \
+    Gwenview::TraceSpan GV_TRACE_SPAN_NAME(__LINE__)(category, name)
+
+/**
+ * Records an instant event. @p detail is only evaluated when recording.
+ */
+#define GV_TRACE_EVENT(category, name, detail) \
+    do { \
+        if (Gwenview::Tracer::isEnabled()) { \
+            Gwenview::Tracer::addEvent(category, name, detail); \
+        } \
+    } while (0)
+
+#endif /* TRACER_H */
@@ -22,6 +22,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include "cmsprofiletest.h"
 
 // Local
+#include <lib/cms/cmsdisplaytransform.h>
+#include <lib/cms/cmsmonitorprofilewatcher.h>
 #include <lib/cms/cmsprofile.h>
 #include <lib/exiv2imageloader.h>
 #include <testutils.h>
@@ -30,6 +32,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA
 #include <qtest.h>
 
 // Qt
+#include <QGuiApplication>
+#include <QImage>
+#include <QScreen>
+#include <QSignalSpy>
+
+// lcms
+#include <lcms2.h>
 
 QTEST_MAIN(CmsProfileTest)
 
@@ -64,6 +73,68 @@ void CmsProfileTest::testLoadFromImageData_data()
 }
 #undef NEW_ROW
 
+void CmsProfileTest::testDisplayTransformCache()
+{
+    QByteArray data;
+    {
+        QFile file(pathForTestFile("cms/colourTestFakeBRG.png"));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        data = file.readAll();
+    }
+    // Load the same profile twice: transforms must be shared
+    Cms::Profile::Ptr profile1 = Cms::Profile::loadFromImageData(data, "png");
+    Cms::Profile::Ptr profile2 = Cms::Profile::loadFromImageData(data, "png");
+    QVERIFY(profile1);
+    QVERIFY(profile2);
+    QCOMPARE(profile1->id(), profile2->id());
+
+    Cms::DisplayTransform::Ptr transform1 = Cms::DisplayTransform::get(profile1, INTENT_PERCEPTUAL, QImage::Format_RGB32);
+    Cms::DisplayTransform::Ptr transform2 = Cms::DisplayTransform::get(profile2, INTENT_PERCEPTUAL, QImage::Format_RGB32);
+    QVERIFY(transform1);
+    QCOMPARE(transform1.data(), transform2.data());
+
+    Cms::DisplayTransform::Ptr transform3 = Cms::DisplayTransform::get(profile1, INTENT_PERCEPTUAL, QImage::Format_ARGB32);
+    QVERIFY(transform3);
+    QVERIFY(transform1.data() != transform3.data());
+
+    QVERIFY(!Cms::DisplayTransform::get(profile1, INTENT_PERCEPTUAL, QImage::Format_RGB888));
+
+    // Applying the transform in stripes must give the same result as applying
+    // it in one go
+    QImage image(1024, 512, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            image.setPixel(x, y, qRgb(x % 256, y % 256, (x + y) % 256));
+        }
+    }
+    QImage expected = image;
+    for (int y = 0; y < expected.height(); ++y) {
+        QImage line = expected.copy(0, y, expected.width(), 1);
+        transform1->apply(&line);
+        for (int x = 0; x < expected.width(); ++x) {
+            expected.setPixel(x, y, line.pixel(x, 0));
+        }
+    }
+    transform1->apply(&image);
+    QCOMPARE(image, expected);
+}
+
+void CmsProfileTest::testMonitorProfileWatcher()
+{
+    Cms::MonitorProfileWatcher* watcher = Cms::MonitorProfileWatcher::instance();
+    QCOMPARE(Cms::MonitorProfileWatcher::instance(), watcher);
+    QVERIFY(Cms::Profile::getMonitorProfile());
+
+    // Pretend the primary screen changed
+    QSignalSpy spy(watcher, SIGNAL(monitorProfileChanged()));
+    QVERIFY(QMetaObject::invokeMethod(qApp, "primaryScreenChanged", Qt::DirectConnection,
+                                      Q_ARG(QScreen*, QGuiApplication::primaryScreen())));
+    QCOMPARE(spy.count(), 1);
+
+    // The profile is read again
+    QVERIFY(Cms::Profile::getMonitorProfile());
+}
+
 #if 0
 
 void CmsProfileTest::testLoadFromExiv2Image()
@@ -35,6 +35,8 @@ class CmsProfileTest : public QObject
 private Q_SLOTS:
     void testLoadFromImageData();
     void testLoadFromImageData_data();
+    void testDisplayTransformCache();
+    void testMonitorProfileWatcher();
 #if 0 // Need some test data
     void testLoadFromExiv2Image();
     void testLoadFromExiv2Image_data();
@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <QConicalGradient>
 #include <QImage>
 #include <QPainter>
+#include <QSet>
 
 // KDE
 #include <QDebug>
@@ -36,6 +37,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "../lib/document/documentfactory.h"
 #include "../lib/imagemetainfomodel.h"
 #include "../lib/imageutils.h"
+#include "../lib/paintutils.h"
 #include "../lib/transformimageoperation.h"
 #include "testutils.h"
 
@@ -259,6 +261,32 @@ void DocumentTest::testLoadDownSampledPng()
     QCOMPARE(stateSpy.mState, Document::Loaded);
 }
 
+void DocumentTest::testReadyImageForZoom()
+{
+    QUrl url = urlForTestFile("orient6.jpg");
+    Document::Ptr doc = DocumentFactory::instance()->load(url);
+    QVERIFY(doc->readyImageForZoom(0.2).isNull());
+
+    QSignalSpy downSampledImageReadySpy(doc.data(), SIGNAL(downSampledImageReady()));
+    bool ready = doc->prepareDownSampledImageForZoom(0.2);
+    QVERIFY2(!ready, "There should not be a down sampled image at this point");
+    while (downSampledImageReadySpy.count() == 0) {
+        QTest::qWait(100);
+    }
+
+    // A smaller zoom can use the bigger down sampled image
+    const QSize expectedSize = doc->size() / 2;
+    QCOMPARE(doc->readyImageForZoom(0.2).size(), expectedSize);
+    QCOMPARE(doc->readyImageForZoom(0.05).size(), expectedSize);
+
+    // A bigger zoom needs the full image
+    if (doc->image().isNull()) {
+        QVERIFY(doc->readyImageForZoom(0.5).isNull());
+    } else {
+        QCOMPARE(doc->readyImageForZoom(0.5).size(), doc->image().size());
+    }
+}
+
 void DocumentTest::testLoadRemote()
 {
     QUrl url = setUpRemoteTestDir("test.png");
@@ -307,6 +335,46 @@ void DocumentTest::testLoadAnimated()
     QVERIFY2(spy.count() > count, "No imageRectUpdated() signal received after restarting");
 }
 
+void DocumentTest::testAnimatedFramesAreReused()
+{
+    QUrl srcUrl = urlForTestFile("4frames.gif");
+    Document::Ptr doc = DocumentFactory::instance()->load(srcUrl);
+    doc->waitUntilLoaded();
+    QVERIFY(doc->isAnimated());
+
+    QVector<QImage> images;
+    QVector<QRect> updatedRects;
+    const QMetaObject::Connection connection = connect(doc.data(), &Document::imageRectUpdated, [&](const QRect& rect) {
+        images << doc->image();
+        updatedRects << rect;
+    });
+
+    // Frames last 100 ms, play the animation more than twice
+    doc->startAnimation();
+    QTRY_VERIFY_WITH_TIMEOUT(images.count() > 8, 5000);
+    doc->stopAnimation();
+    disconnect(connection);
+
+    // Once the whole animation has been decoded, the same frames are shown
+    // again instead of being decoded again
+    QSet<qint64> uniqueKeys;
+    for (const QImage& image : qAsConst(images)) {
+        uniqueKeys << image.cacheKey();
+    }
+    QVERIFY2(uniqueKeys.count() <= 4, "Frames have been decoded more than once");
+
+    // The first frame is shown whole, then the updated rect covers the
+    // pixels which changed since the previous frame
+    QCOMPARE(updatedRects.first(), images.first().rect());
+    for (int idx = 1; idx < images.count(); ++idx) {
+        const QRect changedRect = PaintUtils::changedRect(images.at(idx - 1), images.at(idx));
+        QVERIFY(!updatedRects.at(idx).isEmpty());
+        if (!changedRect.isEmpty()) {
+            QVERIFY(updatedRects.at(idx).contains(changedRect));
+        }
+    }
+}
+
 void DocumentTest::testPrepareDownSampledAfterFailure()
 {
     QUrl url = urlForTestFile("empty.png");
@@ -109,8 +109,10 @@ private Q_SLOTS:
     void testLoadDownSampled();
     void testLoadDownSampled_data();
     void testLoadDownSampledPng();
+    void testReadyImageForZoom();
     void testLoadRemote();
     void testLoadAnimated();
+    void testAnimatedFramesAreReused();
     void testPrepareDownSampledAfterFailure();
     void testDeleteWhileLoading();
     void testLoadRotated();
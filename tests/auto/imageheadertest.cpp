@@ -0,0 +1,276 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "imageheadertest.h"
+
+// Local
+#include <lib/cms/cmsprofile.h>
+#include <lib/imageheader.h>
+#include <lib/jpegcontent.h>
+#include <testutils.h>
+
+// Qt
+#include <QBuffer>
+#include <QDataStream>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QTest>
+
+QTEST_MAIN(ImageHeaderTest)
+
+using namespace Gwenview;
+
+static QByteArray readTestFile(const QString& fileName)
+{
+    QFile file(pathForTestFile(fileName));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+void ImageHeaderTest::testLoad()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QByteArray, format);
+    const QByteArray data = readTestFile(fileName);
+    QVERIFY(!data.isEmpty());
+
+    ImageHeader header;
+    QVERIFY(header.load(data));
+    QCOMPARE(header.format(), format);
+
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, format);
+    QCOMPARE(header.size(), reader.size());
+
+    if (format == "jpeg") {
+        JpegContent content;
+        QVERIFY(content.loadFromData(data));
+        QCOMPARE(header.orientation(), content.orientation());
+    }
+}
+
+#define NEW_ROW(fileName, format) QTest::newRow(fileName) << fileName << QByteArray(format)
+void ImageHeaderTest::testLoad_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QByteArray>("format");
+
+    NEW_ROW("orient6.jpg", "jpeg");
+    NEW_ROW("orient1_vflip.jpg", "jpeg");
+    NEW_ROW("embedded-thumbnail.jpg", "jpeg");
+    NEW_ROW("1x10k.jpg", "jpeg");
+    NEW_ROW("test.png", "png");
+    NEW_ROW("1x10k.png", "png");
+    // The format comes from the content, not from the extension
+    NEW_ROW("png-with-jpeg-extension.jpg", "png");
+}
+
+void ImageHeaderTest::testIccProfile()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QByteArray, format);
+    const QByteArray data = readTestFile(fileName);
+
+    ImageHeader header;
+    QVERIFY(header.load(data));
+    QVERIFY(!header.iccProfile().isEmpty());
+
+    Cms::Profile::Ptr expected = Cms::Profile::loadFromImageData(data, format);
+    Cms::Profile::Ptr profile = Cms::Profile::loadFromIccData(header.iccProfile());
+    QVERIFY(expected);
+    QVERIFY(profile);
+    QCOMPARE(profile->id(), expected->id());
+}
+
+void ImageHeaderTest::testIccProfile_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QByteArray>("format");
+
+    NEW_ROW("cms/colourTestFakeBRG.png", "png");
+    NEW_ROW("cms/colourTestsRGB.png", "png");
+    NEW_ROW("cms/Upper_Left.jpg", "jpeg");
+    NEW_ROW("cms/Lower_Right.jpg", "jpeg");
+}
+#undef NEW_ROW
+
+void ImageHeaderTest::testThumbnail()
+{
+    const QByteArray data = readTestFile(QStringLiteral("embedded-thumbnail.jpg"));
+    ImageHeader header;
+    QVERIFY(header.load(data));
+    QVERIFY(header.exifOffset() > 0);
+    QVERIFY(header.thumbnailOffset() > header.exifOffset());
+
+    const QImage thumbnail = QImage::fromData(data.mid(header.thumbnailOffset(), header.thumbnailLength()), "jpeg");
+    QVERIFY(!thumbnail.isNull());
+
+    JpegContent content;
+    QVERIFY(content.loadFromData(data));
+    QCOMPARE(thumbnail.size(), content.thumbnail().size());
+}
+
+static void writeTiffEntry(QDataStream& stream, quint16 tag, quint16 type, quint32 value)
+{
+    stream << tag << type << quint32(1);
+    if (type == 3) {
+        stream << quint16(value) << quint16(0);
+    } else {
+        stream << value;
+    }
+}
+
+void ImageHeaderTest::testTiffThumbnail()
+{
+    QFETCH(int, compression);
+    QFETCH(bool, hasThumbnail);
+
+    // Two directories, the second one has JPEG tags
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.writeRawData("II*\0", 4);
+    stream << quint32(8);
+    // First directory, at 8
+    stream << quint16(2);
+    writeTiffEntry(stream, 256, 3, 4);
+    writeTiffEntry(stream, 257, 3, 3);
+    stream << quint32(8 + 2 + 2 * 12 + 4);
+    // Second directory, at 38
+    const quint32 jpegOffset = 38 + 2 + 3 * 12 + 4;
+    stream << quint16(3);
+    writeTiffEntry(stream, 259, 3, compression);
+    writeTiffEntry(stream, 513, 4, jpegOffset);
+    writeTiffEntry(stream, 514, 4, 16);
+    stream << quint32(0);
+    stream.writeRawData(QByteArray(16, '\xff').constData(), 16);
+
+    ImageHeader header;
+    QVERIFY(header.load(data));
+    QCOMPARE(header.size(), QSize(4, 3));
+    if (hasThumbnail) {
+        QCOMPARE(header.thumbnailOffset(), int(jpegOffset));
+        QCOMPARE(header.thumbnailLength(), 16);
+    } else {
+        QCOMPARE(header.thumbnailOffset(), -1);
+    }
+}
+
+void ImageHeaderTest::testTiffThumbnail_data()
+{
+    QTest::addColumn<int>("compression");
+    QTest::addColumn<bool>("hasThumbnail");
+
+    QTest::newRow("old-style jpeg") << 6 << true;
+    // Another page, whose strips happen to use the same tags
+    QTest::newRow("uncompressed page") << 1 << false;
+}
+
+void ImageHeaderTest::testBogusChunkLength()
+{
+    // A WebP file whose second chunk claims to be almost 2 GB long
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.writeRawData("RIFF", 4);
+    stream << quint32(0);
+    stream.writeRawData("WEBPVP8X", 8);
+    stream << quint32(10) << quint32(0);
+    // Canvas size minus one, on 24 bits
+    stream << quint8(4) << quint8(0) << quint8(0) << quint8(2) << quint8(0) << quint8(0);
+    stream.writeRawData("JUNK", 4);
+    stream << quint32(0x7ffffffd);
+    stream.writeRawData("junk", 4);
+
+    ImageHeader header;
+    QVERIFY(header.load(data));
+    QCOMPARE(header.size(), QSize(5, 3));
+}
+
+void ImageHeaderTest::testPartialData()
+{
+    ImageHeader header;
+    QVERIFY(!header.load(QByteArray()));
+    QVERIFY(header.format().isEmpty());
+
+    // The size is at the beginning of the file
+    const QByteArray data = readTestFile(QStringLiteral("test.png"));
+    QVERIFY(header.load(data.left(64)));
+    QCOMPARE(header.size(), QImage::fromData(data).size());
+}
+
+void ImageHeaderTest::testTruncatedIccProfile()
+{
+    // Start of image, 5x3 frame, then a profile in a single APP2 segment
+    const QByteArray profile(50, 'p');
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << quint16(0xFFD8);
+    stream << quint16(0xFFC0) << quint16(8) << quint8(8) << quint16(3) << quint16(5) << quint8(1);
+    stream << quint16(0xFFE2) << quint16(2 + 14 + profile.size());
+    stream.writeRawData("ICC_PROFILE\0", 12);
+    stream << quint8(1) << quint8(1);
+    stream.writeRawData(profile.constData(), profile.size());
+
+    ImageHeader header;
+    QVERIFY(header.load(data));
+    QCOMPARE(header.size(), QSize(5, 3));
+    QCOMPARE(header.iccProfile(), profile);
+
+    // No profile is better than a corrupted one
+    QVERIFY(header.load(data.left(data.size() - 10)));
+    QCOMPARE(header.size(), QSize(5, 3));
+    QVERIFY(header.iccProfile().isEmpty());
+}
+
+void ImageHeaderTest::testWrittenImages()
+{
+    QFETCH(QByteArray, format);
+    if (!QImageWriter::supportedImageFormats().contains(format)) {
+        QSKIP("Image format not supported");
+    }
+    QImage image(7, 5, QImage::Format_RGB32);
+    image.fill(Qt::red);
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, format);
+    QVERIFY(writer.write(image));
+
+    ImageHeader header;
+    QVERIFY(header.load(buffer.data()));
+    QCOMPARE(header.format(), format);
+    QCOMPARE(header.size(), image.size());
+}
+
+void ImageHeaderTest::testWrittenImages_data()
+{
+    QTest::addColumn<QByteArray>("format");
+
+    QTest::newRow("jpeg") << QByteArray("jpeg");
+    QTest::newRow("png") << QByteArray("png");
+    QTest::newRow("tiff") << QByteArray("tiff");
+    QTest::newRow("webp") << QByteArray("webp");
+}
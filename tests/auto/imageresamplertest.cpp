@@ -0,0 +1,156 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "imageresamplertest.h"
+
+// Local
+#include <lib/imageresampler.h>
+
+// Qt
+#include <QDebug>
+#include <QPainter>
+#include <QTest>
+
+QTEST_MAIN(ImageResamplerTest)
+
+using namespace Gwenview;
+
+Q_DECLARE_METATYPE(ImageResampler::Filter)
+
+static bool allPixelsAre(const QImage& image, QRgb color)
+{
+    for (int y = 0; y < image.height(); ++y) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            if (line[x] != color) {
+                qWarning() << "Pixel" << x << y << "is" << QString::number(line[x], 16) << "instead of" << QString::number(color, 16);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void ImageResamplerTest::testFlatColor_data()
+{
+    QTest::addColumn<ImageResampler::Filter>("filter");
+    QTest::addColumn<int>("format");
+    QTest::addColumn<QSize>("destSize");
+
+    const QList<QSize> sizes = { QSize(31, 17), QSize(100, 100), QSize(450, 200) };
+    for (const QSize& size : sizes) {
+        const QByteArray suffix = QByteArray::number(size.width()) + 'x' + QByteArray::number(size.height());
+        QTest::newRow("box-" + suffix) << ImageResampler::BoxFilter << int(QImage::Format_RGB32) << size;
+        QTest::newRow("mitchell-" + suffix) << ImageResampler::MitchellFilter << int(QImage::Format_RGB32) << size;
+        QTest::newRow("lanczos3-" + suffix) << ImageResampler::Lanczos3Filter << int(QImage::Format_RGB32) << size;
+        QTest::newRow("lanczos3-premultiplied-" + suffix) << ImageResampler::Lanczos3Filter << int(QImage::Format_ARGB32_Premultiplied) << size;
+    }
+}
+
+/**
+ * Filters must not change the color of flat areas, whatever the zoom
+ */
+void ImageResamplerTest::testFlatColor()
+{
+    QFETCH(ImageResampler::Filter, filter);
+    QFETCH(int, format);
+    QFETCH(QSize, destSize);
+
+    QImage image(300, 150, QImage::Format(format));
+    const QRgb color = qRgb(12, 128, 250);
+    image.fill(color);
+
+    const QImage result = ImageResampler::scale(image, image.rect(), destSize, filter);
+    QCOMPARE(result.size(), destSize);
+    QCOMPARE(int(result.format()), format);
+    QVERIFY(allPixelsAre(result, color));
+}
+
+/**
+ * Pixels outside the source rect must not be used
+ */
+void ImageResamplerTest::testSourceRect()
+{
+    QImage image(200, 100, QImage::Format_RGB32);
+    image.fill(Qt::red);
+    {
+        QPainter painter(&image);
+        painter.fillRect(100, 0, 100, 100, Qt::blue);
+    }
+
+    const QImage result = ImageResampler::scale(image, QRect(100, 0, 100, 100), QSize(37, 37), ImageResampler::Lanczos3Filter);
+    QCOMPARE(result.size(), QSize(37, 37));
+    QVERIFY(allPixelsAre(result, qRgb(0, 0, 255)));
+}
+
+/**
+ * Transparent pixels must not bleed into opaque ones, and the result must keep
+ * the format of the image
+ */
+void ImageResamplerTest::testPremultipliedAlpha()
+{
+    QImage image(100, 100, QImage::Format_ARGB32);
+    image.fill(qRgba(255, 0, 0, 0));
+    {
+        QPainter painter(&image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.fillRect(0, 0, 50, 100, Qt::green);
+    }
+
+    const QImage result = ImageResampler::scale(image, image.rect(), QSize(20, 20), ImageResampler::MitchellFilter);
+    QCOMPARE(result.format(), QImage::Format_ARGB32);
+    for (int y = 0; y < result.height(); ++y) {
+        for (int x = 0; x < result.width(); ++x) {
+            const QRgb pixel = result.pixel(x, y);
+            if (qAlpha(pixel) > 0) {
+                QCOMPARE(qRed(pixel), 0);
+            }
+        }
+    }
+    QCOMPARE(qAlpha(result.pixel(0, 10)), 255);
+    QCOMPARE(qAlpha(result.pixel(19, 10)), 0);
+}
+
+/**
+ * Scaling a rect with its margin, then cropping the margin, must give the same
+ * pixels as scaling the whole image
+ */
+void ImageResamplerTest::testSourceMargin()
+{
+    QImage image(256, 256, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            image.setPixel(x, y, qRgb(x, y, (x * y) % 256));
+        }
+    }
+
+    const ImageResampler::Filter filter = ImageResampler::Lanczos3Filter;
+    const int margin = ImageResampler::sourceMargin(filter, 0.25);
+    QVERIFY(margin >= 12);
+
+    const QImage expected = ImageResampler::scale(image, image.rect(), QSize(64, 64), filter);
+    // Bottom half of the image, with a margin of whole destination pixels
+    const int destMargin = (margin + 3) / 4;
+    const QRect sourceRect(0, 128 - destMargin * 4, 256, 128 + destMargin * 4);
+    const QImage part = ImageResampler::scale(image, sourceRect, QSize(64, 32 + destMargin), filter)
+                        .copy(0, destMargin, 64, 32);
+    QCOMPARE(part, expected.copy(0, 32, 64, 32));
+}
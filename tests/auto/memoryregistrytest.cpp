@@ -0,0 +1,87 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "memoryregistrytest.h"
+
+// Local
+#include <lib/memoryregistry.h>
+
+// Qt
+#include <QScopedPointer>
+#include <QSignalSpy>
+#include <QTest>
+
+QTEST_MAIN(MemoryRegistryTest)
+
+using namespace Gwenview;
+
+static int countCaches(const QString& name)
+{
+    int count = 0;
+    const QList<MemoryRegistry::CacheUsage> usages = MemoryRegistry::instance()->cacheUsages();
+    for (const MemoryRegistry::CacheUsage& usage : usages) {
+        if (usage.name == name) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void MemoryRegistryTest::testCacheUsages()
+{
+    MemoryRegistry* registry = MemoryRegistry::instance();
+    const qlonglong totalBefore = registry->totalBytes();
+    int entries = 3;
+    // Declared after entries, so that it unregisters the cache before
+    // entries goes out of scope
+    QObject owner;
+    registry->addCache(QStringLiteral("testCacheUsages"), [&entries](MemoryRegistry::CacheUsage* usage) {
+        usage->bytes = entries * 100;
+        usage->entries = entries;
+    }, &owner);
+
+    QCOMPARE(countCaches(QStringLiteral("testCacheUsages")), 1);
+    QCOMPARE(registry->totalBytes(), totalBefore + 300);
+
+    // Usage is computed each time it is asked for
+    entries = 5;
+    QCOMPARE(registry->totalBytes(), totalBefore + 500);
+    QVERIFY(registry->report().contains(QStringLiteral("testCacheUsages: 5 entries")));
+}
+
+void MemoryRegistryTest::testOwner()
+{
+    QScopedPointer<QObject> owner(new QObject);
+    MemoryRegistry::instance()->addCache(QStringLiteral("testOwner"), [](MemoryRegistry::CacheUsage* usage) {
+        usage->bytes = 1;
+    }, owner.data());
+    QCOMPARE(countCaches(QStringLiteral("testOwner")), 1);
+
+    owner.reset();
+    QCOMPARE(countCaches(QStringLiteral("testOwner")), 0);
+}
+
+void MemoryRegistryTest::testReleaseMemory()
+{
+    QSignalSpy spy(MemoryRegistry::instance(), &MemoryRegistry::memoryPressure);
+    MemoryRegistry::instance()->releaseMemory();
+    QCOMPARE(spy.count(), 1);
+}
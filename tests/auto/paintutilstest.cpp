@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 */
 #include <qtest.h>
+#include <QImage>
 
 #include "../lib/paintutils.h"
 
@@ -41,3 +42,43 @@ void PaintUtilsTest::testScaledRect()
     QFETCH(QRect,  expected);
     QCOMPARE(Gwenview::PaintUtils::containingRect(input), expected);
 }
+
+void PaintUtilsTest::testChangedRect_data()
+{
+    QTest::addColumn<int>("format");
+    QTest::addColumn<QRect>("paintedRect");
+    QTest::addColumn<QRect>("expected");
+
+    QTest::newRow("unchanged") << int(QImage::Format_ARGB32) << QRect() << QRect();
+    QTest::newRow("one pixel") << int(QImage::Format_ARGB32) << QRect(3, 4, 1, 1) << QRect(3, 4, 1, 1);
+    QTest::newRow("rect") << int(QImage::Format_RGB32) << QRect(2, 5, 6, 3) << QRect(2, 5, 6, 3);
+    QTest::newRow("whole image") << int(QImage::Format_ARGB32) << QRect(0, 0, 16, 12) << QRect(0, 0, 16, 12);
+    // Only rows are compared for other depths
+    QTest::newRow("8 bits") << int(QImage::Format_Grayscale8) << QRect(2, 5, 6, 3) << QRect(0, 5, 16, 3);
+}
+
+void PaintUtilsTest::testChangedRect()
+{
+    QFETCH(int, format);
+    QFETCH(QRect, paintedRect);
+    QFETCH(QRect, expected);
+
+    QImage previous(16, 12, QImage::Format(format));
+    previous.fill(Qt::white);
+    QImage image = previous.copy();
+    for (int y = paintedRect.top(); y <= paintedRect.bottom(); ++y) {
+        for (int x = paintedRect.left(); x <= paintedRect.right(); ++x) {
+            image.setPixelColor(x, y, Qt::black);
+        }
+    }
+    QCOMPARE(Gwenview::PaintUtils::changedRect(previous, image), expected);
+}
+
+void PaintUtilsTest::testChangedRectCannotCompare()
+{
+    QImage image(16, 12, QImage::Format_ARGB32);
+    image.fill(Qt::white);
+    QCOMPARE(Gwenview::PaintUtils::changedRect(QImage(), image), image.rect());
+    QCOMPARE(Gwenview::PaintUtils::changedRect(image.copy(0, 0, 8, 8), image), image.rect());
+    QCOMPARE(Gwenview::PaintUtils::changedRect(image.convertToFormat(QImage::Format_RGB32), image), image.rect());
+}
@@ -32,6 +32,9 @@ class PaintUtilsTest : public QObject
 private Q_SLOTS:
     void testScaledRect();
     void testScaledRect_data();
+    void testChangedRect();
+    void testChangedRect_data();
+    void testChangedRectCannotCompare();
 };
 
 #endif // PAINTUTILSTEST_H
@@ -84,6 +84,24 @@ void RecursiveDirModelTest::testBasic_data()
             << "d2/a.jpg"
             << "d3/a.jpg"
         );
+    // More dirs than the model lists concurrently
+    NEW_ROW("images_in_many_dirs",
+        QStringList()
+            << "d1/a.jpg"
+            << "d2/a.jpg"
+            << "d3/a.jpg"
+            << "d4/a.jpg"
+            << "d5/a.jpg"
+            << "d5/d51/a.jpg"
+            << "d5/d52/a.jpg"
+            << "d6/a.jpg"
+            << "d7/a.jpg",
+        QStringList()
+            << "d5/d53/a.jpg"
+            << "d8/a.jpg",
+        QStringList()
+            << "d1/a.jpg"
+        );
 #undef NEW_ROW
 }
 
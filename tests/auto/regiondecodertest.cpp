@@ -0,0 +1,91 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "regiondecodertest.h"
+
+// Qt
+#include <QBuffer>
+#include <QPainter>
+#include <QSignalSpy>
+#include <QTest>
+
+// Local
+#include <lib/document/regiondecoder.h>
+#include "testutils.h"
+
+QTEST_MAIN(RegionDecoderTest)
+
+using namespace Gwenview;
+
+void RegionDecoderTest::initTestCase()
+{
+    // Several tiles in each direction, with partial tiles on the edges
+    QImage image(1500, 1100, QImage::Format_RGB32);
+    QPainter painter(&image);
+    painter.fillRect(image.rect(), Qt::white);
+    for (int x = 0; x < image.width(); x += 100) {
+        for (int y = 0; y < image.height(); y += 100) {
+            painter.fillRect(x, y, 50, 50, QColor::fromHsv((x + y) % 360, 255, 255));
+        }
+    }
+    painter.end();
+
+    QBuffer buffer(&mData);
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY(image.save(&buffer, "jpeg", 95));
+    QVERIFY(mImage.loadFromData(mData, "jpeg"));
+}
+
+void RegionDecoderTest::testRegion_data()
+{
+    QTest::addColumn<QRect>("rect");
+
+    QTest::newRow("inside-tile") << QRect(10, 20, 100, 50);
+    QTest::newRow("across-tiles") << QRect(400, 300, 700, 500);
+    QTest::newRow("edges") << QRect(1000, 600, 500, 500);
+    QTest::newRow("all") << QRect(0, 0, 1500, 1100);
+}
+
+void RegionDecoderTest::testRegion()
+{
+    QFETCH(QRect, rect);
+
+    RegionDecoder decoder(mData, "jpeg", mImage.size());
+    QSignalSpy spy(&decoder, SIGNAL(regionReady()));
+    QVERIFY(decoder.region(rect).isNull());
+    QVERIFY(!decoder.prepareRegion(rect));
+    while (!decoder.prepareRegion(rect)) {
+        spy.clear();
+        QVERIFY(TestUtils::waitForSignal(spy));
+        QVERIFY(!decoder.hasFailed());
+    }
+
+    const QImage region = decoder.region(rect);
+    QCOMPARE(region.size(), rect.size());
+    QVERIFY(TestUtils::fuzzyImageCompare(region.convertToFormat(QImage::Format_RGB32), mImage.copy(rect).convertToFormat(QImage::Format_RGB32)));
+    QVERIFY(decoder.memoryUsage() > 0);
+}
+
+void RegionDecoderTest::testIsSupported()
+{
+    // Too small to be worth it
+    QVERIFY(!RegionDecoder::isSupported(mData, "jpeg", mImage.size()));
+}
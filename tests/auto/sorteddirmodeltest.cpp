@@ -26,10 +26,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <lib/semanticinfo/sorteddirmodel.h>
 
 // Qt
+#include <QFile>
 
 // KDE
 #include <qtest.h>
 #include <KDirLister>
+#include <KDirModel>
 #include <QTemporaryDir>
 
 using namespace Gwenview;
@@ -47,6 +49,16 @@ void SortedDirModelTest::initTestCase()
     createEmptyFile(mSandBoxDir.absoluteFilePath("dirs_and_docs/file.png"));
     mSandBoxDir.mkdir("docs_only");
     createEmptyFile(mSandBoxDir.absoluteFilePath("docs_only/file.png"));
+    mSandBoxDir.mkdir("blacklisted");
+    createEmptyFile(mSandBoxDir.absoluteFilePath("blacklisted/a.png"));
+    createEmptyFile(mSandBoxDir.absoluteFilePath("blacklisted/b.xcf"));
+    createEmptyFile(mSandBoxDir.absoluteFilePath("blacklisted/c.XCF"));
+    // Enough files for SortedDirModel to sort using precomputed keys
+    mSandBoxDir.mkdir("many_docs");
+    mSandBoxDir.mkdir("many_docs/dir");
+    for (int idx = 0; idx < 1500; ++idx) {
+        createEmptyFile(mSandBoxDir.absoluteFilePath(QString("many_docs/img%1.png").arg(idx)));
+    }
 }
 
 void SortedDirModelTest::testHasDocuments_data()
@@ -75,3 +87,89 @@ void SortedDirModelTest::testHasDocuments()
     loop.exec();
     QCOMPARE(model.hasDocuments(), hasDocuments);
 }
+
+void SortedDirModelTest::testBlackListedExtensions()
+{
+    QUrl url = QUrl::fromLocalFile(mSandBoxDir.absoluteFilePath("blacklisted"));
+
+    SortedDirModel model;
+    model.setBlackListedExtensions(QStringList() << "xcf");
+    QEventLoop loop;
+    connect(model.dirLister(), SIGNAL(completed()), &loop, SLOT(quit()));
+    model.dirLister()->openUrl(url);
+    loop.exec();
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.urlForIndex(model.index(0, 0)).fileName(), QString("a.png"));
+
+    // Changing the blacklist must be taken into account, even if the item
+    // info is already known
+    model.setBlackListedExtensions(QStringList());
+    model.applyFilters();
+    QTest::qWait(100);
+    QCOMPARE(model.rowCount(), 3);
+}
+
+void SortedDirModelTest::testSortByName()
+{
+    QUrl url = QUrl::fromLocalFile(mSandBoxDir.absoluteFilePath("many_docs"));
+
+    SortedDirModel model;
+    QEventLoop loop;
+    connect(model.dirLister(), SIGNAL(completed()), &loop, SLOT(quit()));
+    model.dirLister()->openUrl(url);
+    loop.exec();
+    QCOMPARE(model.rowCount(), 1501);
+
+    model.sort(KDirModel::Name, Qt::AscendingOrder);
+    QCOMPARE(model.urlForIndex(model.index(0, 0)).fileName(), QString("dir"));
+    for (int row = 1; row < model.rowCount(); ++row) {
+        QCOMPARE(model.urlForIndex(model.index(row, 0)).fileName(), QString("img%1.png").arg(row - 1));
+    }
+
+    model.sort(KDirModel::Name, Qt::DescendingOrder);
+    QCOMPARE(model.urlForIndex(model.index(0, 0)).fileName(), QString("dir"));
+    QCOMPARE(model.urlForIndex(model.index(1, 0)).fileName(), QString("img1499.png"));
+    QCOMPARE(model.urlForIndex(model.index(1500, 0)).fileName(), QString("img0.png"));
+}
+
+void SortedDirModelTest::testSortAfterChanges()
+{
+    mSandBoxDir.mkdir("changing_docs");
+    for (int idx = 0; idx < 1200; ++idx) {
+        createEmptyFile(mSandBoxDir.absoluteFilePath(QString("changing_docs/img%1.png").arg(idx)));
+    }
+    QUrl url = QUrl::fromLocalFile(mSandBoxDir.absoluteFilePath("changing_docs"));
+
+    SortedDirModel model;
+    QEventLoop loop;
+    connect(model.dirLister(), SIGNAL(completed()), &loop, SLOT(quit()));
+    model.dirLister()->openUrl(url);
+    loop.exec();
+    model.sort(KDirModel::Name, Qt::AscendingOrder);
+    QCOMPARE(model.rowCount(), 1200);
+
+    // Removing rows moves the following ones in the source model: the ranks
+    // computed by sort() must follow them
+    QVERIFY(QFile::remove(mSandBoxDir.absoluteFilePath("changing_docs/img0.png")));
+    QVERIFY(QFile::remove(mSandBoxDir.absoluteFilePath("changing_docs/img1.png")));
+    model.dirLister()->updateDirectory(url);
+    loop.exec();
+    QCOMPARE(model.rowCount(), 1198);
+
+    // New rows must be sorted with the others
+    createEmptyFile(mSandBoxDir.absoluteFilePath("changing_docs/img5a.png"));
+    model.dirLister()->updateDirectory(url);
+    loop.exec();
+    QCOMPARE(model.rowCount(), 1199);
+
+    QStringList expected;
+    for (int idx = 2; idx < 1200; ++idx) {
+        expected << QString("img%1.png").arg(idx);
+        if (idx == 5) {
+            expected << QString("img5a.png");
+        }
+    }
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QCOMPARE(model.urlForIndex(model.index(row, 0)).fileName(), expected.at(row));
+    }
+}
@@ -37,6 +37,9 @@ private Q_SLOTS:
     void initTestCase();
     void testHasDocuments_data();
     void testHasDocuments();
+    void testBlackListedExtensions();
+    void testSortByName();
+    void testSortAfterChanges();
 
 private:
     TestUtils::SandBoxDir mSandBoxDir;
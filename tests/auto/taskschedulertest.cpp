@@ -0,0 +1,217 @@
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+#include "taskschedulertest.h"
+
+// Qt
+#include <QFuture>
+#include <QMutex>
+#include <QSemaphore>
+#include <QStringList>
+#include <QVector>
+#include <QTest>
+
+// Local
+#include "../lib/taskscheduler.h"
+
+QTEST_MAIN(TaskSchedulerTest)
+
+using namespace Gwenview;
+
+void TaskSchedulerTest::testClassOrder()
+{
+    TaskScheduler scheduler;
+    const int threadCount = scheduler.threadCount();
+
+    // Keep all threads busy
+    QSemaphore gate;
+    for (int idx = 0; idx < threadCount; ++idx) {
+        scheduler.run(TaskScheduler::ViewClass, [&gate]() {
+            gate.acquire();
+        });
+    }
+
+    QMutex mutex;
+    QStringList order;
+    auto record = [&mutex, &order](const QString& name) {
+        return [&mutex, &order, name]() {
+            QMutexLocker locker(&mutex);
+            order << name;
+        };
+    };
+    QFuture<void> background = scheduler.run(TaskScheduler::BackgroundClass, record(QStringLiteral("background")));
+    QFuture<void> thumbnail = scheduler.run(TaskScheduler::ThumbnailClass, record(QStringLiteral("thumbnail")));
+    QFuture<void> view = scheduler.run(TaskScheduler::ViewClass, record(QStringLiteral("view")));
+    QCOMPARE(scheduler.stats(TaskScheduler::ViewClass).queued, 1);
+    QCOMPARE(scheduler.stats(TaskScheduler::ThumbnailClass).queued, 1);
+    QCOMPARE(scheduler.stats(TaskScheduler::BackgroundClass).queued, 1);
+
+    // Free one thread: queued tasks run one after the other, most important
+    // class first
+    gate.release(1);
+    background.waitForFinished();
+    thumbnail.waitForFinished();
+    view.waitForFinished();
+    QCOMPARE(order, QStringList() << QStringLiteral("view") << QStringLiteral("thumbnail") << QStringLiteral("background"));
+
+    gate.release(threadCount - 1);
+}
+
+void TaskSchedulerTest::testQuota()
+{
+    TaskScheduler scheduler;
+    scheduler.setQuota(TaskScheduler::BackgroundClass, 1);
+
+    QSemaphore gate;
+    QFuture<void> first = scheduler.run(TaskScheduler::BackgroundClass, [&gate]() {
+        gate.acquire();
+    });
+    QFuture<void> second = scheduler.run(TaskScheduler::BackgroundClass, [&gate]() {
+        gate.acquire();
+    });
+
+    TaskScheduler::Stats stats = scheduler.stats(TaskScheduler::BackgroundClass);
+    QCOMPARE(stats.running, 1);
+    QCOMPARE(stats.queued, 1);
+
+    // Other classes are not held back
+    QFuture<int> view = scheduler.run(TaskScheduler::ViewClass, []() {
+        return 42;
+    });
+    QCOMPARE(view.result(), 42);
+
+    gate.release(2);
+    first.waitForFinished();
+    second.waitForFinished();
+    stats = scheduler.stats(TaskScheduler::BackgroundClass);
+    QCOMPARE(stats.queued, 0);
+    QCOMPARE(stats.started, qint64(2));
+}
+
+void TaskSchedulerTest::testViewThreadIsReserved()
+{
+    TaskScheduler scheduler;
+    const int threadCount = scheduler.threadCount();
+    scheduler.setQuota(TaskScheduler::PreloadClass, threadCount);
+    scheduler.setQuota(TaskScheduler::ThumbnailClass, threadCount);
+
+    QSemaphore gate;
+    QVector<QFuture<void>> futures;
+    for (int idx = 0; idx < threadCount; ++idx) {
+        futures << scheduler.run(TaskScheduler::ThumbnailClass, [&gate]() {
+            gate.acquire();
+        });
+        futures << scheduler.run(TaskScheduler::PreloadClass, [&gate]() {
+            gate.acquire();
+        });
+    }
+    const int running = scheduler.stats(TaskScheduler::PreloadClass).running
+        + scheduler.stats(TaskScheduler::ThumbnailClass).running;
+    QCOMPARE(running, threadCount - 1);
+
+    QFuture<int> view = scheduler.run(TaskScheduler::ViewClass, []() {
+        return 42;
+    });
+    QCOMPARE(view.result(), 42);
+
+    gate.release(2 * threadCount);
+    for (const QFuture<void>& future : futures) {
+        future.waitForFinished();
+    }
+}
+
+void TaskSchedulerTest::testAcquiredSlotUsesThread()
+{
+    TaskScheduler scheduler;
+    const int threadCount = scheduler.threadCount();
+
+    QSemaphore gate;
+    QVector<QFuture<void>> futures;
+    for (int idx = 0; idx < threadCount - 1; ++idx) {
+        futures << scheduler.run(TaskScheduler::ViewClass, [&gate]() {
+            gate.acquire();
+        });
+    }
+
+    // The last thread is taken by the slot
+    scheduler.acquireSlot(TaskScheduler::ThumbnailClass);
+    QCOMPARE(scheduler.stats(TaskScheduler::ThumbnailClass).running, 1);
+    QFuture<int> view = scheduler.run(TaskScheduler::ViewClass, []() {
+        return 42;
+    });
+    QCOMPARE(scheduler.stats(TaskScheduler::ViewClass).queued, 1);
+
+    scheduler.releaseSlot(TaskScheduler::ThumbnailClass);
+    QCOMPARE(view.result(), 42);
+
+    gate.release(threadCount - 1);
+    for (const QFuture<void>& future : futures) {
+        future.waitForFinished();
+    }
+}
+
+static void increment(int& value)
+{
+    ++value;
+}
+
+void TaskSchedulerTest::testMap()
+{
+    TaskScheduler scheduler;
+    QVector<int> values(1000);
+    for (int idx = 0; idx < values.count(); ++idx) {
+        values[idx] = idx;
+    }
+
+    scheduler.map(TaskScheduler::ThumbnailClass, values, increment).waitForFinished();
+
+    for (int idx = 0; idx < values.count(); ++idx) {
+        QCOMPARE(values.at(idx), idx + 1);
+    }
+}
+
+void TaskSchedulerTest::testRunAndWaitWithBusyPool()
+{
+    TaskScheduler scheduler;
+    const int threadCount = scheduler.threadCount();
+
+    // Keep all threads busy
+    QSemaphore gate;
+    QVector<QFuture<void>> futures;
+    for (int idx = 0; idx < threadCount; ++idx) {
+        futures << scheduler.run(TaskScheduler::ViewClass, [&gate]() {
+            gate.acquire();
+        });
+    }
+
+    // The calling thread does all the work instead of waiting for the pool
+    QVector<int> values(100);
+    scheduler.runAndWait(TaskScheduler::ViewClass, values.count(), [&values](int idx) {
+        values[idx] = idx;
+    });
+    for (int idx = 0; idx < values.count(); ++idx) {
+        QCOMPARE(values.at(idx), idx);
+    }
+    QCOMPARE(scheduler.stats(TaskScheduler::ViewClass).queued, 0);
+
+    gate.release(threadCount);
+    for (const QFuture<void>& future : futures) {
+        future.waitForFinished();
+    }
+}
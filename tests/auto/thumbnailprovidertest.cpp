@@ -30,9 +30,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <QDebug>
 #include <KIO/CopyJob>
 #include <KIO/DeleteJob>
+#include <KIO/StatJob>
+#include <KIO/StoredTransferJob>
 
 // Local
 #include "../lib/thumbnailprovider/thumbnailprovider.h"
+#include "../lib/tracer.h"
 #include "testutils.h"
 
 // libc
@@ -105,6 +108,45 @@ void ThumbnailProviderTest::init()
     mSandBox.fill();
 }
 
+/**
+ * Stands in for a slow remote slave: answers each read with at most
+ * mChunkSize bytes, and with an empty chunk at the end of the file
+ */
+struct SlowRemote
+{
+    QByteArray mData;
+    int mChunkSize;
+    int mPos;
+    int mReadCount;
+
+    SlowRemote(const QByteArray& data, int chunkSize)
+    : mData(data)
+    , mChunkSize(chunkSize)
+    , mPos(0)
+    , mReadCount(0)
+    {}
+
+    QByteArray read(int size)
+    {
+        ++mReadCount;
+        const QByteArray chunk = mData.mid(mPos, qMin(size, mChunkSize));
+        mPos += chunk.size();
+        return chunk;
+    }
+};
+
+// Reads like ThumbnailProvider does: ask for the whole head, then for what
+// is still missing after each chunk
+static RemoteHeadBuffer readHead(SlowRemote* remote, int headSize)
+{
+    RemoteHeadBuffer buffer(headSize);
+    int remaining = headSize;
+    while (remaining > 0) {
+        remaining = buffer.append(remote->read(remaining));
+    }
+    return buffer;
+}
+
 static void syncRun(ThumbnailProvider *provider)
 {
     QEventLoop loop;
@@ -227,6 +269,51 @@ void ThumbnailProviderTest::testUseEmbeddedOrNot()
     }
 }
 
+void ThumbnailProviderTest::testDeriveFromLargerGroup()
+{
+    mSandBox.createTestImage("big.png", 1200, 600, Qt::red);
+    QUrl url("file://" + QDir(mSandBox.mPath).absoluteFilePath("big.png"));
+    KFileItemList list;
+    list << KFileItem(url);
+
+    // Generate an x-large thumbnail
+    {
+        ThumbnailProvider provider;
+        provider.setThumbnailGroup(ThumbnailGroup::XLarge);
+        provider.appendItems(list);
+        syncRun(&provider);
+        while (!ThumbnailProvider::isThumbnailWriterEmpty()) {
+            QTest::qWait(100);
+        }
+    }
+    QDir xlargeDir = ThumbnailProvider::thumbnailBaseDir(ThumbnailGroup::XLarge);
+    QStringList entryList = xlargeDir.entryList(QStringList("*.png"));
+    QCOMPARE(entryList.count(), 1);
+    const QString xlargePath = xlargeDir.filePath(entryList.first());
+
+    // Paint it blue, keeping its keys, so that we can tell whether the normal
+    // thumbnail has been derived from it or generated from the original
+    QImage xlarge(xlargePath);
+    QCOMPARE(xlarge.size(), QSize(512, 256));
+    QImage blue = createColoredImage(512, 256, Qt::blue);
+    Q_FOREACH(const QString& key, xlarge.textKeys()) {
+        blue.setText(key, xlarge.text(key));
+    }
+    QVERIFY(blue.save(xlargePath, "png"));
+
+    // Loading a normal thumbnail should scale down the x-large one
+    ThumbnailProvider provider;
+    provider.setThumbnailGroup(ThumbnailGroup::Normal);
+    provider.appendItems(list);
+    QSignalSpy spy(&provider, SIGNAL(thumbnailLoaded(KFileItem,QPixmap,QSize,qulonglong)));
+    syncRun(&provider);
+
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(2).toSize(), QSize(1200, 600));
+    const QPixmap thumbnailPix = qvariant_cast<QPixmap>(spy.at(0).at(1));
+    QVERIFY(TestUtils::imageCompare(createColoredImage(128, 64, Qt::blue), thumbnailPix.toImage()));
+}
+
 void ThumbnailProviderTest::testLoadRemote()
 {
     QUrl url = setUpRemoteTestDir("test.png");
@@ -253,6 +340,51 @@ void ThumbnailProviderTest::testLoadRemote()
     QCOMPARE(entryList.count(), 1);
 }
 
+void ThumbnailProviderTest::testLoadRemoteFromHead()
+{
+    QUrl url = setUpRemoteTestDir(QString());
+    if (!url.isValid()) {
+        QSKIP("Not running this test: failed to setup remote test dir.");
+    }
+    url = url.adjusted(QUrl::StripTrailingSlash);
+    url.setPath(url.path() + '/' + "large.jpg");
+
+    // embedded-thumbnail.jpg contains a white 128x64 thumbnail. Pad it so
+    // that it is large enough for only its head to be read.
+    QFile file(urlForTestFile("embedded-thumbnail.jpg").toLocalFile());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray data = file.readAll() + QByteArray(2 * 1024 * 1024, '\0');
+    KIO::StoredTransferJob* putJob = KIO::storedPut(data, url, -1, KIO::HideProgressInfo);
+    QVERIFY2(putJob->exec(), "Couldn't upload test image");
+
+    // The provider needs the size of the file, as it gets it from a listing
+    KIO::StatJob* statJob = KIO::stat(url, KIO::StatJob::SourceSide, 0);
+    QVERIFY2(statJob->exec(), "test url not found");
+    KFileItemList list;
+    list << KFileItem(statJob->statResult(), url);
+
+    const QString traceFileName = mSandBox.mPath + "/trace.json";
+    Tracer::start(traceFileName);
+    {
+        ThumbnailProvider provider;
+        provider.setThumbnailGroup(ThumbnailGroup::Normal);
+        provider.appendItems(list);
+        QSignalSpy spy(&provider, SIGNAL(thumbnailLoaded(KFileItem,QPixmap,QSize,qulonglong)));
+        syncRun(&provider);
+
+        QCOMPARE(spy.count(), 1);
+        const QPixmap thumbnailPix = qvariant_cast<QPixmap>(spy.at(0).at(1));
+        QVERIFY(TestUtils::imageCompare(createColoredImage(128, 64, Qt::white), thumbnailPix.toImage()));
+    }
+    QVERIFY(Tracer::stop());
+
+    // The thumbnail comes from the head of the file, the whole file must not
+    // have been downloaded
+    QFile traceFile(traceFileName);
+    QVERIFY(traceFile.open(QIODevice::ReadOnly));
+    QVERIFY(!traceFile.readAll().contains("\"downloadOriginal\""));
+}
+
 void ThumbnailProviderTest::testRemoveItemsWhileGenerating()
 {
     QDir dir(mSandBox.mPath);
@@ -276,3 +408,36 @@ void ThumbnailProviderTest::testRemoveItemsWhileGenerating()
     provider.removeItems(list);
     loop.exec();
 }
+
+void ThumbnailProviderTest::testRemoteHeadPartialChunks()
+{
+    QByteArray data;
+    for (int i = 0; i < 1000; ++i) {
+        data += char(i % 251);
+    }
+    SlowRemote remote(data, 64);
+    const RemoteHeadBuffer head = readHead(&remote, 300);
+    QVERIFY(head.isFinished());
+    QCOMPARE(head.data(), data.left(300));
+    // 4 chunks of 64 bytes then the remaining 44, the rest of the file is
+    // not requested
+    QCOMPARE(remote.mReadCount, 5);
+    QCOMPARE(remote.mPos, 300);
+}
+
+void ThumbnailProviderTest::testRemoteHeadEndOfFile()
+{
+    const QByteArray data(100, 'x');
+    SlowRemote remote(data, 30);
+    const RemoteHeadBuffer head = readHead(&remote, 300);
+    QVERIFY(head.isFinished());
+    QCOMPARE(head.data(), data);
+    // 4 chunks, then the empty one which ends the file
+    QCOMPARE(remote.mReadCount, 5);
+
+    // Chunks which arrive once finished are ignored
+    RemoteHeadBuffer buffer(10);
+    buffer.finish();
+    QCOMPARE(buffer.append(QByteArray(5, 'y')), 0);
+    QVERIFY(buffer.data().isEmpty());
+}
@@ -48,8 +48,12 @@ private Q_SLOTS:
     void initTestCase();
     void testLoadLocal();
     void testLoadRemote();
+    void testLoadRemoteFromHead();
     void testUseEmbeddedOrNot();
+    void testDeriveFromLargerGroup();
     void testRemoveItemsWhileGenerating();
+    void testRemoteHeadPartialChunks();
+    void testRemoteHeadEndOfFile();
 
 private:
     SandBox mSandBox;
@@ -0,0 +1,109 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "thumbnailviewtest.h"
+
+// Qt
+#include <QStandardItemModel>
+#include <QTest>
+
+// KDE
+#include <KDirModel>
+#include <KFileItem>
+
+// Local
+#include <lib/gwenviewconfig.h>
+#include <lib/memoryregistry.h>
+#include <lib/thumbnailview/thumbnailview.h>
+#include "testutils.h"
+
+QTEST_MAIN(ThumbnailViewTest)
+
+using namespace Gwenview;
+
+static MemoryRegistry::CacheUsage thumbnailCacheUsage()
+{
+    const QList<MemoryRegistry::CacheUsage> usages = MemoryRegistry::instance()->cacheUsages();
+    for (const MemoryRegistry::CacheUsage& usage : usages) {
+        if (usage.name == QLatin1String("Thumbnail view pixmaps")) {
+            return usage;
+        }
+    }
+    return MemoryRegistry::CacheUsage();
+}
+
+/**
+ * Delivers a thumbnail as ThumbnailProvider would
+ */
+static void setThumbnail(ThumbnailView* view, const KFileItem& item, const QSize& size)
+{
+    QPixmap pixmap(size);
+    pixmap.fill(Qt::red);
+    QMetaObject::invokeMethod(view, "setThumbnail", Qt::DirectConnection,
+                              Q_ARG(KFileItem, item), Q_ARG(QPixmap, pixmap), Q_ARG(QSize, size), Q_ARG(qulonglong, 0));
+}
+
+void ThumbnailViewTest::testCacheHitsAndMisses()
+{
+    const int rowCount = 100;
+    QStandardItemModel model;
+    QList<KFileItem> items;
+    for (int row = 0; row < rowCount; ++row) {
+        QUrl url = urlForTestFile(QStringLiteral("test.png"));
+        url.setQuery(QStringLiteral("row=%1").arg(row));
+        const KFileItem item(url, QStringLiteral("image/png"));
+        QStandardItem* modelItem = new QStandardItem(url.toString());
+        modelItem->setData(QVariant::fromValue(item), KDirModel::FileItemRole);
+        model.appendRow(modelItem);
+        items << item;
+    }
+
+    ThumbnailView view(nullptr);
+    view.setModel(&model);
+    view.setThumbnailWidth(48);
+    view.resize(100, 100);
+    view.doItemsLayout();
+
+    const QModelIndex first = model.index(0, 0);
+    const QModelIndex last = model.index(rowCount - 1, 0);
+
+    // Thumbnails which have never been loaded are neither hits nor misses
+    view.thumbnailForIndex(first);
+    view.thumbnailForIndex(last);
+    QCOMPARE(thumbnailCacheUsage().hits, qint64(0));
+    QCOMPARE(thumbnailCacheUsage().misses, qint64(0));
+
+    setThumbnail(&view, items.first(), QSize(48, 48));
+    QVERIFY(!view.thumbnailForIndex(first).isNull());
+    QVERIFY(!view.thumbnailForIndex(first).isNull());
+    QCOMPARE(thumbnailCacheUsage().hits, qint64(2));
+    QCOMPARE(thumbnailCacheUsage().misses, qint64(0));
+
+    // Big enough to go above what is kept on memory pressure, a quarter of
+    // the smallest budget. The last row is not visible, so its pixmap is
+    // dropped.
+    GwenviewConfig::setThumbnailMemoryCacheSize(16);
+    setThumbnail(&view, items.last(), QSize(1200, 1200));
+    MemoryRegistry::instance()->releaseMemory();
+    view.thumbnailForIndex(last);
+    QCOMPARE(thumbnailCacheUsage().hits, qint64(2));
+    QCOMPARE(thumbnailCacheUsage().misses, qint64(1));
+}
@@ -0,0 +1,125 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "tracertest.h"
+
+// Local
+#include <lib/tracer.h>
+
+// Qt
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QtConcurrentRun>
+
+QTEST_MAIN(TracerTest)
+
+using namespace Gwenview;
+
+void TracerTest::testDisabled()
+{
+    QVERIFY(!Tracer::isEnabled());
+    {
+        GV_TRACE("test", "ignored");
+    }
+    bool detailBuilt = false;
+    GV_TRACE_EVENT("test", "ignored", (detailBuilt = true, QString()));
+    QVERIFY(!detailBuilt);
+    QVERIFY(Tracer::stop());
+}
+
+void TracerTest::testWriteTrace()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QStringLiteral("/trace.json");
+    Tracer::start(fileName);
+    QVERIFY(Tracer::isEnabled());
+    {
+        TraceSpan span("test", "main");
+        span.setDetail(QStringLiteral("detail"));
+        QtConcurrent::run([]() {
+            GV_TRACE("test", "worker");
+        }).waitForFinished();
+    }
+    QVERIFY(Tracer::stop());
+    QVERIFY(!Tracer::isEnabled());
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QJsonArray events = QJsonDocument::fromJson(file.readAll()).object().value(QStringLiteral("traceEvents")).toArray();
+
+    QJsonObject mainSpan, workerSpan;
+    int threadNameCount = 0;
+    for (const QJsonValue& value : events) {
+        const QJsonObject event = value.toObject();
+        const QString phase = event.value(QStringLiteral("ph")).toString();
+        const QString name = event.value(QStringLiteral("name")).toString();
+        if (phase == QLatin1String("M")) {
+            ++threadNameCount;
+        } else if (name == QLatin1String("main")) {
+            mainSpan = event;
+        } else if (name == QLatin1String("worker")) {
+            workerSpan = event;
+        }
+    }
+    QCOMPARE(threadNameCount, 2);
+    QVERIFY(!mainSpan.isEmpty());
+    QVERIFY(!workerSpan.isEmpty());
+    QCOMPARE(mainSpan.value(QStringLiteral("cat")).toString(), QStringLiteral("test"));
+    QCOMPARE(mainSpan.value(QStringLiteral("args")).toObject().value(QStringLiteral("detail")).toString(), QStringLiteral("detail"));
+    QVERIFY(mainSpan.value(QStringLiteral("tid")).toInt() != workerSpan.value(QStringLiteral("tid")).toInt());
+
+    // The worker span is nested in the main one
+    const double mainStart = mainSpan.value(QStringLiteral("ts")).toDouble();
+    const double workerStart = workerSpan.value(QStringLiteral("ts")).toDouble();
+    QVERIFY(workerStart >= mainStart);
+    QVERIFY(workerStart + workerSpan.value(QStringLiteral("dur")).toDouble()
+            <= mainStart + mainSpan.value(QStringLiteral("dur")).toDouble());
+}
+
+void TracerTest::testEvent()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QStringLiteral("/trace.json");
+    Tracer::start(fileName);
+    GV_TRACE_EVENT("test", "event", QStringLiteral("detail %1").arg(42));
+    QVERIFY(Tracer::stop());
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QJsonArray events = QJsonDocument::fromJson(file.readAll()).object().value(QStringLiteral("traceEvents")).toArray();
+
+    QJsonObject instantEvent;
+    for (const QJsonValue& value : events) {
+        const QJsonObject event = value.toObject();
+        if (event.value(QStringLiteral("name")).toString() == QLatin1String("event")) {
+            instantEvent = event;
+        }
+    }
+    QVERIFY(!instantEvent.isEmpty());
+    QCOMPARE(instantEvent.value(QStringLiteral("ph")).toString(), QStringLiteral("i"));
+    QCOMPARE(instantEvent.value(QStringLiteral("s")).toString(), QStringLiteral("t"));
+    QVERIFY(!instantEvent.contains(QStringLiteral("dur")));
+    QCOMPARE(instantEvent.value(QStringLiteral("args")).toObject().value(QStringLiteral("detail")).toString(), QStringLiteral("detail 42"));
+}
@@ -0,0 +1,143 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab:
+/*
+Gwenview: an image viewer
+Copyright 2018 Gwenview authors
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Cambridge, MA 02110-1301, USA.
+
+*/
+// Self
+#include "zoombuffercachetest.h"
+
+// Local
+#include <lib/documentview/zoombuffercache.h>
+
+// Qt
+#include <QImage>
+#include <QPainter>
+#include <QTest>
+
+QTEST_MAIN(ZoomBufferCacheTest)
+
+using namespace Gwenview;
+
+static QPixmap filledPixmap(const QSize& size, const QColor& color)
+{
+    QPixmap pixmap(size);
+    pixmap.fill(color);
+    return pixmap;
+}
+
+void ZoomBufferCacheTest::testRestoreOtherZoom()
+{
+    ZoomBufferCache cache(4);
+    cache.store(1, QPoint(0, 0), filledPixmap(QSize(100, 100), Qt::red), QRect(0, 0, 100, 100));
+
+    QPixmap buffer(100, 100);
+    buffer.fill(Qt::transparent);
+    QPainter painter(&buffer);
+    QVERIFY(cache.restore(2, QRect(0, 0, 100, 100), &painter).isEmpty());
+    QCOMPARE(cache.count(), 1);
+}
+
+void ZoomBufferCacheTest::testRestoreRegion()
+{
+    // The buffer covers (100, 50, 100x100) but only its left half has been
+    // scaled
+    ZoomBufferCache cache(4);
+    cache.store(0.5, QPoint(100, 50), filledPixmap(QSize(100, 100), Qt::red), QRect(100, 50, 50, 100));
+
+    // Restore in a view scrolled to (120, 60)
+    const QRect rect(120, 60, 80, 80);
+    QPixmap buffer(rect.size());
+    buffer.fill(Qt::transparent);
+    QRegion region;
+    {
+        QPainter painter(&buffer);
+        region = cache.restore(0.5, rect, &painter);
+    }
+    QCOMPARE(region, QRegion(QRect(120, 60, 30, 80)));
+    QCOMPARE(cache.count(), 0);
+
+    // Only the restored region has been painted
+    const QImage image = buffer.toImage().convertToFormat(QImage::Format_ARGB32);
+    QCOMPARE(image.pixel(0, 0), QColor(Qt::red).rgba());
+    QCOMPARE(image.pixel(29, 79), QColor(Qt::red).rgba());
+    QCOMPARE(qAlpha(image.pixel(30, 0)), 0);
+    QCOMPARE(qAlpha(image.pixel(79, 79)), 0);
+}
+
+void ZoomBufferCacheTest::testReplaceSameZoom()
+{
+    ZoomBufferCache cache(4);
+    cache.store(2, QPoint(0, 0), filledPixmap(QSize(10, 10), Qt::red), QRect(0, 0, 10, 10));
+    cache.store(2, QPoint(10, 0), filledPixmap(QSize(10, 10), Qt::blue), QRect(10, 0, 10, 10));
+    QCOMPARE(cache.count(), 1);
+
+    QPixmap buffer(20, 10);
+    QPainter painter(&buffer);
+    QCOMPARE(cache.restore(2, QRect(0, 0, 20, 10), &painter), QRegion(QRect(10, 0, 10, 10)));
+}
+
+void ZoomBufferCacheTest::testMaxCount()
+{
+    ZoomBufferCache cache(2);
+    cache.store(1, QPoint(0, 0), filledPixmap(QSize(10, 10), Qt::red), QRect(0, 0, 10, 10));
+    cache.store(2, QPoint(0, 0), filledPixmap(QSize(10, 10), Qt::red), QRect(0, 0, 10, 10));
+    cache.store(3, QPoint(0, 0), filledPixmap(QSize(10, 10), Qt::red), QRect(0, 0, 10, 10));
+    QCOMPARE(cache.count(), 2);
+
+    QPixmap buffer(10, 10);
+    QPainter painter(&buffer);
+    QVERIFY(cache.restore(1, QRect(0, 0, 10, 10), &painter).isEmpty());
+    QVERIFY(!cache.restore(3, QRect(0, 0, 10, 10), &painter).isEmpty());
+}
+
+void ZoomBufferCacheTest::testByteCount()
+{
+    ZoomBufferCache cache(4);
+    QCOMPARE(cache.byteCount(), qint64(0));
+
+    const QPixmap pixmap = filledPixmap(QSize(10, 20), Qt::red);
+    cache.store(1, QPoint(0, 0), pixmap, QRect(0, 0, 10, 20));
+    // Nothing rendered, nothing stored
+    cache.store(2, QPoint(0, 0), pixmap, QRegion());
+    QCOMPARE(cache.count(), 1);
+    QCOMPARE(cache.byteCount(), qint64(10) * 20 * pixmap.depth() / 8);
+
+    cache.clear();
+    QCOMPARE(cache.count(), 0);
+    QCOMPARE(cache.byteCount(), qint64(0));
+}
+
+void ZoomBufferCacheTest::testInvalidate()
+{
+    ZoomBufferCache cache(4);
+    cache.store(0.5, QPoint(0, 0), filledPixmap(QSize(100, 100), Qt::red), QRect(0, 0, 100, 100));
+    cache.store(0.25, QPoint(5, 5), filledPixmap(QSize(10, 10), Qt::red), QRect(5, 5, 10, 10));
+
+    // An animation frame or an image operation changed part of the image.
+    // Zooming back must not restore the stale pixels.
+    const QRect imageRect(20, 20, 40, 40);
+    QCOMPARE(ZoomBufferCache::zoomedRect(imageRect, 0.5), QRect(9, 9, 22, 22));
+    cache.invalidate(imageRect);
+    // Nothing is left of the 0.25 buffer
+    QCOMPARE(cache.count(), 1);
+
+    QPixmap buffer(100, 100);
+    QPainter painter(&buffer);
+    const QRegion region = cache.restore(0.5, QRect(0, 0, 100, 100), &painter);
+    QCOMPARE(region, QRegion(QRect(0, 0, 100, 100)) - QRect(9, 9, 22, 22));
+}